@@ -0,0 +1,233 @@
+// callgrind_bench.cpp - Google Benchmark suite for the CallgrindGenerator hot paths
+//
+// The same source is built once per storage strategy so both can be compared:
+//   g++ -std=c++17 -O2 -DCALLGRIND_IMPL='"test.cpp"'  callgrind_bench.cpp -lbenchmark -lpthread -o bench_v1
+//   g++ -std=c++17 -O2 -DCALLGRIND_IMPL='"test2.cpp"' callgrind_bench.cpp -lbenchmark -lpthread -o bench_v2
+//   ./bench_v1 --benchmark_out=v1.json && ./bench_v2 --benchmark_out=v2.json
+
+#ifndef CALLGRIND_IMPL
+#define CALLGRIND_IMPL "test2.cpp"
+#endif
+
+#include CALLGRIND_IMPL
+#include "synthetic_workload.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+
+// Grants the benchmarks access to the private branch classification path
+struct CallgrindBenchAccess {
+    static BranchType detect(CallgrindGenerator& gen, uint64_t from_pc, uint64_t to_pc,
+                             int dest_reg, bool is_sequential) {
+        return gen.detectBranchType(from_pc, to_pc, dest_reg, is_sequential);
+    }
+
+    static void handle(CallgrindGenerator& gen, uint64_t from_pc, uint64_t to_pc,
+                       BranchType type, bool is_sequential) {
+        gen.handleBranch(from_pc, to_pc, type, is_sequential);
+    }
+};
+
+namespace {
+
+// A workload image plus a pre-generated stream, so generation is not timed
+struct PreparedTrace {
+    SyntheticWorkload workload;
+    std::vector<TraceRecord> stream;
+
+    PreparedTrace(const SyntheticWorkloadConfig& cfg, uint64_t instructions)
+        : workload(cfg), stream(workload.generate(instructions)) {}
+};
+
+// One control transfer after a branch instruction, classified in stream order
+struct Transfer {
+    uint64_t from_pc;
+    uint64_t to_pc;
+    int dest_reg;
+    bool is_sequential;
+    BranchType type;
+};
+
+std::vector<Transfer> classifyTransfers(const PreparedTrace& trace) {
+    CallgrindGenerator gen("/dev/null");
+    trace.workload.load(gen);
+
+    // Branch instructions in the synthetic image are never compressed
+    std::vector<Transfer> transfers;
+    for (size_t i = 0; i + 1 < trace.stream.size(); ++i) {
+        const TraceRecord& r = trace.stream[i];
+        if (r.is_branch) {
+            uint64_t to_pc = trace.stream[i + 1].pc;
+            bool seq = (to_pc == r.pc + 4);
+            BranchType type = CallgrindBenchAccess::detect(gen, r.pc, to_pc, r.dest_reg, seq);
+            CallgrindBenchAccess::handle(gen, r.pc, to_pc, type, seq);
+            transfers.push_back({r.pc, to_pc, r.dest_reg, seq, type});
+        }
+    }
+    return transfers;
+}
+
+template <typename Generator = CallgrindGenerator>
+void runTrace(benchmark::State& state, const PreparedTrace& trace) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto gen = std::make_unique<Generator>("/dev/null");
+        trace.workload.load(*gen);
+        state.ResumeTiming();
+
+        for (const auto& r : trace.stream) {
+            gen->recordExecution(r.pc, EVENT_IR, 1, r.dest_reg, r.is_branch);
+        }
+        benchmark::ClobberMemory();
+
+        state.PauseTiming();
+        gen.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * trace.stream.size());
+}
+
+constexpr uint64_t TRACE_LENGTH = 1 << 20;
+
+void BM_RecordStraightLine(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig::straightLine(), TRACE_LENGTH);
+    runTrace(state, trace);
+}
+BENCHMARK(BM_RecordStraightLine)->Unit(benchmark::kMillisecond);
+
+void BM_RecordLoopHeavy(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig::loopHeavy(), TRACE_LENGTH);
+    runTrace(state, trace);
+}
+BENCHMARK(BM_RecordLoopHeavy)->Unit(benchmark::kMillisecond);
+
+void BM_RecordCallHeavy(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig::callHeavy(), TRACE_LENGTH);
+    runTrace(state, trace);
+}
+BENCHMARK(BM_RecordCallHeavy)->Unit(benchmark::kMillisecond);
+
+void BM_RecordIndirectHeavy(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig::indirectHeavy(), TRACE_LENGTH);
+    runTrace(state, trace);
+}
+BENCHMARK(BM_RecordIndirectHeavy)->Unit(benchmark::kMillisecond);
+
+void BM_RecordMixed(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig(), TRACE_LENGTH);
+    runTrace(state, trace);
+}
+BENCHMARK(BM_RecordMixed)->Unit(benchmark::kMillisecond);
+
+#ifdef CALLGRIND_GENERATOR_POLICIES
+void BM_RecordMixedCallGraph(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig(), TRACE_LENGTH);
+    runTrace<BasicCallgrindGenerator<CallGraphGeneratorPolicy>>(state, trace);
+}
+BENCHMARK(BM_RecordMixedCallGraph)->Unit(benchmark::kMillisecond);
+
+void BM_RecordMixedIrOnly(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig(), TRACE_LENGTH);
+    runTrace<BasicCallgrindGenerator<IrOnlyGeneratorPolicy>>(state, trace);
+}
+BENCHMARK(BM_RecordMixedIrOnly)->Unit(benchmark::kMillisecond);
+
+// Floor for IrOnly: a bare per-PC counter map with no profiler around it
+void BM_RecordMixedCounterMap(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig(), TRACE_LENGTH);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::unordered_map<uint64_t, uint64_t> counts;
+        for (const auto& r : trace.stream) counts[r.pc];
+        state.ResumeTiming();
+
+        for (const auto& r : trace.stream) {
+            ++counts[r.pc];
+        }
+        benchmark::DoNotOptimize(counts);
+    }
+    state.SetItemsProcessed(state.iterations() * trace.stream.size());
+}
+BENCHMARK(BM_RecordMixedCounterMap)->Unit(benchmark::kMillisecond);
+#endif
+
+void BM_DetectBranchType(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig(), 1 << 16);
+    static const std::vector<Transfer> transfers = classifyTransfers(trace);
+    CallgrindGenerator gen("/dev/null");
+    trace.workload.load(gen);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        const Transfer& t = transfers[i];
+        benchmark::DoNotOptimize(CallgrindBenchAccess::detect(gen, t.from_pc, t.to_pc, t.dest_reg, t.is_sequential));
+        if (++i == transfers.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DetectBranchType);
+
+// Replays pre-classified transfers so the call stack stays consistent
+void runHandleBranch(benchmark::State& state, const PreparedTrace& trace, const std::vector<Transfer>& transfers) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto gen = std::make_unique<CallgrindGenerator>("/dev/null");
+        trace.workload.load(*gen);
+        state.ResumeTiming();
+
+        for (const Transfer& t : transfers) {
+            CallgrindBenchAccess::handle(*gen, t.from_pc, t.to_pc, t.type, t.is_sequential);
+        }
+        benchmark::ClobberMemory();
+
+        state.PauseTiming();
+        gen.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * transfers.size());
+}
+
+void BM_HandleBranchLoopHeavy(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig::loopHeavy(), 1 << 18);
+    static const std::vector<Transfer> transfers = classifyTransfers(trace);
+    runHandleBranch(state, trace, transfers);
+}
+BENCHMARK(BM_HandleBranchLoopHeavy)->Unit(benchmark::kMicrosecond);
+
+void BM_HandleBranchCallHeavy(benchmark::State& state) {
+    static const PreparedTrace trace(SyntheticWorkloadConfig::callHeavy(), 1 << 18);
+    static const std::vector<Transfer> transfers = classifyTransfers(trace);
+    runHandleBranch(state, trace, transfers);
+}
+BENCHMARK(BM_HandleBranchCallHeavy)->Unit(benchmark::kMicrosecond);
+
+// Dump time for a profile touching state.range(0) distinct PCs
+void BM_WriteOutput(benchmark::State& state) {
+    const size_t num_pcs = static_cast<size_t>(state.range(0));
+    const std::string path = "/tmp/callgrind_bench.out";
+
+    CallgrindGenerator gen(path);
+    for (size_t i = 0; i < num_pcs; ++i) {
+        uint64_t pc = SyntheticWorkload::TEXT_BASE + i * 4;
+        gen.loadPCInfo(pc, "fn" + std::to_string(i / 64), "addi\ta0,a0,1", "dump.c",
+                       static_cast<uint32_t>(i % 4096 + 1));
+        gen.recordExecution(pc, EVENT_IR, 1 + i % 7);
+    }
+
+    // writeOutput reports to stdout; keep the benchmark table readable
+    std::streambuf* saved = std::cout.rdbuf(nullptr);
+    for (auto _ : state) {
+        gen.writeOutput();
+    }
+    std::cout.rdbuf(saved);
+    std::remove(path.c_str());
+    state.SetItemsProcessed(state.iterations() * num_pcs);
+}
+BENCHMARK(BM_WriteOutput)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_WriteOutput)->Arg(10000000)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
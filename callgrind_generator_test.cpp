@@ -0,0 +1,1124 @@
+#include "gmock/gmock.h"
+#include "test2.cpp"
+#include "synthetic_workload.hpp"
+#include "etrace_decoder.hpp"
+#include "retire_pipe.hpp"
+#include "verilator_profile.hpp"
+#include "live_profile.hpp"
+
+namespace {
+
+template <typename Generator>
+SyntheticWorkload::GroundTruth profile(Generator& gen, const SyntheticWorkloadConfig& cfg, uint64_t instructions) {
+	SyntheticWorkload workload(cfg);
+	workload.load(gen);
+	workload.run(instructions, [&gen](const TraceRecord& r) {
+		gen.recordExecution(r.pc, EVENT_IR, 1, r.dest_reg, r.is_branch);
+	});
+	return workload.truth();
+}
+
+template <typename Generator>
+std::map<std::string, uint64_t> selfIrByFunction(const Generator& gen, const SyntheticWorkloadConfig& cfg) {
+	std::map<std::string, uint64_t> self;
+	SyntheticWorkload workload(cfg);
+	for (const auto& [pc, func, assembly, file, line] : workload.objdump()) {
+		uint64_t ir = gen.pcEvent(pc, EVENT_IR);
+		if (ir) self[func] += ir;
+	}
+	return self;
+}
+
+// One instruction of a hand-written trace
+struct Step {
+	uint64_t pc;
+	int dest_reg;    // 1 = ra (a call), 0 = jump without link, -1 = none
+	bool is_branch;
+};
+
+void replay(CallgrindGenerator& gen, std::initializer_list<Step> steps) {
+	for (const Step& s : steps) gen.recordExecution(s.pc, EVENT_IR, 1, s.dest_reg, s.is_branch);
+}
+
+}  // namespace
+
+TEST(SyntheticWorkload, SameSeedSameStream) {
+	SyntheticWorkload a, b;
+	auto sa = a.generate(100000);
+	auto sb = b.generate(100000);
+	ASSERT_EQ(sa.size(), sb.size());
+	for (size_t i = 0; i < sa.size(); ++i) {
+		ASSERT_EQ(sa[i].pc, sb[i].pc);
+	}
+	EXPECT_EQ(a.truth().total_ir, sa.size());
+}
+
+TEST(CallgrindGenerator, SelfCostMatchesGroundTruth) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	auto truth = profile(gen, cfg, 200000);
+
+	EXPECT_EQ(truth.self_ir, selfIrByFunction(gen, cfg));
+}
+
+TEST(CallgrindGenerator, IrOnlyPolicyKeepsSelfCostWithoutCallGraph) {
+	SyntheticWorkloadConfig cfg;
+	BasicCallgrindGenerator<IrOnlyGeneratorPolicy> gen("/dev/null");
+	auto truth = profile(gen, cfg, 200000);
+
+	EXPECT_EQ(truth.self_ir, selfIrByFunction(gen, cfg));
+	ASSERT_FALSE(truth.edges.empty());
+	EXPECT_EQ(0u, gen.callEdge(truth.edges.front().site_pc, truth.edges.front().target_pc).count);
+}
+
+TEST(CallgrindGenerator, InclusiveCostMatchesGroundTruth) {
+	for (uint64_t seed = 1; seed <= 4; ++seed) {
+		SyntheticWorkloadConfig cfg;
+		cfg.seed = seed;
+		CallgrindGenerator gen("/dev/null");
+		auto truth = profile(gen, cfg, 200000);
+
+		ASSERT_FALSE(truth.edges.empty());
+		for (const auto& edge : truth.edges) {
+			CallEdgeCost recorded = gen.callEdge(edge.site_pc, edge.target_pc);
+			EXPECT_EQ(edge.calls, recorded.count) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+			EXPECT_EQ(edge.inclusive_ir, recorded.inclusive_events[EVENT_IR]) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+		}
+		EXPECT_EQ(0u, gen.getStats().resync_count);
+	}
+}
+
+TEST(CallgrindGenerator, DeferredInclusiveMatchesGroundTruth) {
+	for (uint64_t seed = 1; seed <= 4; ++seed) {
+		SyntheticWorkloadConfig cfg;
+		cfg.seed = seed;
+		CallgrindGenerator gen("/dev/null");
+		gen.setDeferredInclusive(true, 1000);
+		auto truth = profile(gen, cfg, 200000);
+		gen.foldCallLog();
+
+		EXPECT_GT(gen.getStats().call_log_folds, 1u);
+		for (const auto& edge : truth.edges) {
+			CallEdgeCost recorded = gen.callEdge(edge.site_pc, edge.target_pc);
+			EXPECT_EQ(edge.calls, recorded.count) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+			EXPECT_EQ(edge.inclusive_ir, recorded.inclusive_events[EVENT_IR]) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+		}
+	}
+}
+
+TEST(CallgrindGenerator, RecursiveCallIsACall) {
+	CallgrindGenerator gen("/dev/null");
+	gen.loadPCInfo(0x100, "main", "jal\tra,1000 <f>", "main.c", 1);
+	gen.loadPCInfo(0x104, "main", "nop", "main.c", 2);
+	gen.loadPCInfo(0x1000, "f", "bnez\ta0,1008 <f+0x8>", "f.c", 1);
+	gen.loadPCInfo(0x1004, "f", "ret", "f.c", 2);
+	gen.loadPCInfo(0x1008, "f", "jal\tra,1000 <f>", "f.c", 3);
+	gen.loadPCInfo(0x100c, "f", "ret", "f.c", 4);
+	replay(gen, {{0x100, 1, true}, {0x1000, -1, true}, {0x1008, 1, true},  // f calls itself
+	             {0x1000, -1, true}, {0x1004, 0, true}, {0x100c, 0, true}, {0x104, -1, false}});
+
+	CallEdgeCost inner = gen.callEdge(0x1008, 0x1000);
+	EXPECT_EQ(1u, inner.count);
+	EXPECT_EQ(2u, inner.inclusive_events[EVENT_IR]);
+	EXPECT_EQ(5u, gen.callEdge(0x100, 0x1000).inclusive_events[EVENT_IR]);
+	EXPECT_EQ(0u, gen.getStats().resync_count);
+}
+
+TEST(CallgrindGenerator, BranchInRecursiveCallIsNotAReturn) {
+	CallgrindGenerator gen("/dev/null");
+	gen.loadPCInfo(0x100, "main", "jal\tra,1000 <f>", "main.c", 1);
+	gen.loadPCInfo(0x104, "main", "nop", "main.c", 2);
+	gen.loadPCInfo(0x1000, "f", "bnez\ta0,1010 <f+0x10>", "f.c", 1);
+	gen.loadPCInfo(0x1004, "f", "addi\ta1,a1,-1", "f.c", 2);
+	gen.loadPCInfo(0x1008, "f", "bnez\ta1,1004 <f+0x4>", "f.c", 3);
+	gen.loadPCInfo(0x100c, "f", "ret", "f.c", 4);
+	gen.loadPCInfo(0x1010, "f", "jal\tra,1000 <f>", "f.c", 5);
+	gen.loadPCInfo(0x1014, "f", "ret", "f.c", 6);
+	// The inner f loops once: its back edge lands in f, the caller's function
+	replay(gen, {{0x100, 1, true}, {0x1000, -1, true}, {0x1010, 1, true},
+	             {0x1000, -1, true}, {0x1004, 11, false}, {0x1008, -1, true}, {0x1004, 11, false}, {0x1008, -1, true},
+	             {0x100c, 0, true}, {0x1014, 0, true}, {0x104, -1, false}});
+
+	CallEdgeCost inner = gen.callEdge(0x1010, 0x1000);
+	EXPECT_EQ(1u, inner.count);
+	EXPECT_EQ(6u, inner.inclusive_events[EVENT_IR]);
+	EXPECT_EQ(9u, gen.callEdge(0x100, 0x1000).inclusive_events[EVENT_IR]);
+	EXPECT_EQ(0u, gen.getStats().resync_count);
+}
+
+TEST(CallgrindGenerator, ReturnAfterTailCallReachesTheOriginalCaller) {
+	CallgrindGenerator gen("/dev/null");
+	gen.loadPCInfo(0x100, "main", "jal\tra,2000 <a>", "main.c", 1);
+	gen.loadPCInfo(0x104, "main", "nop", "main.c", 2);
+	gen.loadPCInfo(0x2000, "a", "nop", "a.c", 1);
+	gen.loadPCInfo(0x2004, "a", "j\t3000 <b>", "a.c", 2);
+	gen.loadPCInfo(0x3000, "b", "nop", "b.c", 1);
+	gen.loadPCInfo(0x3004, "b", "ret", "b.c", 2);
+	// b returns straight to main, past a
+	replay(gen, {{0x100, 1, true}, {0x2000, -1, false}, {0x2004, 0, true},
+	             {0x3000, -1, false}, {0x3004, 0, true}, {0x104, -1, false}});
+
+	EXPECT_EQ(4u, gen.callEdge(0x100, 0x2000).inclusive_events[EVENT_IR]);
+	EXPECT_EQ(2u, gen.callEdge(0x2004, 0x3000).inclusive_events[EVENT_IR]);
+	EXPECT_EQ(0u, gen.callEdge(0x3004, 0x104).count);  // Not a tail call into main
+	EXPECT_EQ(0u, gen.getStats().call_stack_depth);
+}
+
+TEST(CallgrindGenerator, SpilledEdgesMergeBackExactly) {
+	auto jump_lines = [](const std::string& path) {
+		std::multiset<std::string> lines;
+		std::ifstream in(path);
+		for (std::string line; std::getline(in, line);) {
+			if (line.compare(0, 5, "jump=") == 0) lines.insert(line);
+		}
+		return lines;
+	};
+	SyntheticWorkloadConfig cfg;
+	const std::string reference_path = testing::TempDir() + "spill_reference.callgrind";
+	const std::string path = testing::TempDir() + "spill.callgrind";
+	CallgrindGenerator reference(reference_path);
+	profile(reference, cfg, 200000);
+	reference.writeOutput();
+	const size_t unbounded = reference.getStats().edge_table_bytes;
+
+	for (bool deferred : {false, true}) {
+		CallgrindGenerator gen(path);
+		gen.setDeferredInclusive(deferred, 1000);
+		ASSERT_TRUE(gen.setMemoryBudget(unbounded / 4));
+		auto truth = profile(gen, cfg, 200000);
+		gen.foldCallLog();
+
+		GeneratorStats stats = gen.getStats();
+		EXPECT_GT(stats.spilled_edges, 0u);
+		EXPECT_LE(stats.edge_table_bytes, unbounded / 4);
+		for (const auto& edge : truth.edges) {
+			CallEdgeCost recorded = gen.callEdge(edge.site_pc, edge.target_pc);
+			EXPECT_EQ(edge.calls, recorded.count) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+			EXPECT_EQ(edge.inclusive_ir, recorded.inclusive_events[EVENT_IR]) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+		}
+		gen.writeOutput();
+		EXPECT_EQ(jump_lines(reference_path), jump_lines(path));
+		EXPECT_TRUE(std::ifstream(path + ".spill").is_open());
+	}
+	EXPECT_FALSE(std::ifstream(path + ".spill").is_open());  // Removed with the generator
+	std::remove(reference_path.c_str());
+	std::remove(path.c_str());
+}
+
+TEST(CallgrindGenerator, NewJumpSurvivesTheSpillItTriggers) {
+	const std::string path = testing::TempDir() + "new_jump.callgrind";
+	CallgrindGenerator gen(path);
+	gen.loadPCInfo(0x1000, "f", "j\t1100 <f+0x100>", "f.c", 1);
+	gen.loadPCInfo(0x1100, "f", "j\t1200 <f+0x200>", "f.c", 2);
+	gen.loadPCInfo(0x1200, "f", "ret", "f.c", 3);
+	ASSERT_TRUE(gen.setMemoryBudget(1));
+	gen.recordExecution(0x1000, EVENT_IR, 1, 0, true);
+	gen.recordExecution(0x1100, EVENT_IR, 1, 0, true);
+	EXPECT_GT(gen.getStats().edge_table_bytes, 0u);
+	gen.recordExecution(0x1200, EVENT_IR, 1, 0, true);
+	EXPECT_EQ(1u, gen.getStats().spilled_edges);  // The older jump went instead
+	EXPECT_GT(gen.getStats().edge_table_bytes, 0u);
+}
+
+TEST(CallgrindGenerator, FailedSpillMergeKeepsTheRuns) {
+	SyntheticWorkloadConfig cfg;
+	const std::string path = testing::TempDir() + "merge_fails.callgrind";
+	const std::string merged_path = path + ".spill.merge";
+	std::remove(merged_path.c_str());
+	ASSERT_EQ(0, symlink("/dev/full", merged_path.c_str()));  // Opens, but every write fails
+
+	CallgrindGenerator gen(path);
+	ASSERT_TRUE(gen.setMemoryBudget(1));
+	auto truth = profile(gen, cfg, 50000);
+	EXPECT_GT(gen.getStats().spilled_edges, 0u);
+	for (const auto& edge : truth.edges) {
+		CallEdgeCost recorded = gen.callEdge(edge.site_pc, edge.target_pc);
+		EXPECT_EQ(edge.calls, recorded.count) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+		EXPECT_EQ(edge.inclusive_ir, recorded.inclusive_events[EVENT_IR]) << std::hex << edge.site_pc << " -> " << edge.target_pc;
+	}
+	EXPECT_NE(0, access(merged_path.c_str(), F_OK));  // The failed merge cleaned up
+}
+
+TEST(CallgrindGenerator, ResetReleasesRunAndKeepsImage) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	profile(gen, cfg, 100000);
+	gen.reset();
+	EXPECT_EQ(0u, gen.getStats().call_edges);
+
+	SyntheticWorkload workload(cfg);
+	workload.run(100000, [&gen](const TraceRecord& r) {
+		gen.recordExecution(r.pc, EVENT_IR, 1, r.dest_reg, r.is_branch);
+	});
+	EXPECT_EQ(workload.truth().self_ir, selfIrByFunction(gen, cfg));
+}
+
+TEST(CallgrindGenerator, StatsLogWritesOneJsonObjectPerInterval) {
+	// Value of "key": in a flat JSON object of numbers
+	auto field = [](const std::string& line, const std::string& key) {
+		size_t at = line.find("\"" + key + "\":");
+		return at == std::string::npos ? -1.0 : std::stod(line.substr(at + key.size() + 3));
+	};
+	SyntheticWorkloadConfig cfg;
+	const std::string path = testing::TempDir() + "stats_log.callgrind";
+	const std::string log_path = testing::TempDir() + "stats_log.jsonl";
+	CallgrindGenerator gen(path);
+	ASSERT_TRUE(gen.enableStatsLog(log_path, 10000));
+	profile(gen, cfg, 100000);
+	ASSERT_TRUE(gen.writeOutput());
+
+	std::vector<std::string> lines;
+	std::ifstream in(log_path);
+	for (std::string line; std::getline(in, line);) lines.push_back(line);
+	ASSERT_EQ(11u, lines.size());  // One per interval, then one after the dump
+	for (size_t i = 0; i < lines.size(); ++i) {
+		const std::string& line = lines[i];
+		EXPECT_EQ('{', line.front()) << line;
+		EXPECT_EQ('}', line.back()) << line;
+		EXPECT_EQ(1, std::count(line.begin(), line.end(), '{')) << line;
+		if (i < 10) {
+			EXPECT_EQ((i + 1) * 10000.0, field(line, "instructions_recorded")) << line;
+		}
+		for (const char* key : {"ns_per_record", "pc_load_factor", "call_load_factor", "jump_load_factor",
+		                        "branch_load_factor", "bytes_written", "dump_wall_ms"}) {
+			EXPECT_GE(field(line, key), 0.0) << key << " in " << line;
+		}
+	}
+	EXPECT_GT(field(lines.front(), "pc_load_factor"), 0.0);
+	EXPECT_EQ(0.0, field(lines.front(), "bytes_written"));
+	EXPECT_GT(field(lines.back(), "bytes_written"), 0.0);
+
+	// Interval 0 closes the log; nothing more is appended
+	ASSERT_TRUE(gen.enableStatsLog(log_path + ".off", 0));
+	profile(gen, cfg, 20000);
+	EXPECT_FALSE(std::ifstream(log_path + ".off").is_open());
+	std::ifstream again(log_path);
+	size_t count = 0;
+	for (std::string line; std::getline(again, line);) ++count;
+	EXPECT_EQ(lines.size(), count);
+	std::remove(log_path.c_str());
+	std::remove(path.c_str());
+}
+
+TEST(CallgrindGenerator, LoopTripCountsMatchKernelCalls) {
+	SyntheticWorkloadConfig cfg = SyntheticWorkloadConfig::loopHeavy();
+	CallgrindGenerator gen("/dev/null");
+	gen.setLoopProfiling(true);
+	auto truth = profile(gen, cfg, 200000);
+
+	// Each kernel is "li; <body>; bnez <body>; ret": the loop header follows the entry
+	SyntheticWorkload workload(cfg);
+	std::map<std::string, uint64_t> kernel_entry;
+	for (const auto& [pc, func, assembly, file, line] : workload.objdump()) {
+		if (func.rfind("kernel_", 0) == 0 && !kernel_entry.count(func)) kernel_entry[func] = pc;
+	}
+
+	size_t kernel_loops = 0;
+	for (const LoopInfo& loop : gen.loopStats()) {
+		uint64_t entry = loop.header_pc - 4;
+		if (std::none_of(kernel_entry.begin(), kernel_entry.end(), [entry](const auto& k) { return k.second == entry; })) continue;
+		++kernel_loops;
+
+		uint64_t calls = 0;
+		for (const auto& edge : truth.edges) {
+			if (edge.target_pc == entry) calls += edge.calls;
+		}
+		EXPECT_EQ(calls, loop.entries) << std::hex << loop.header_pc;
+		EXPECT_EQ(gen.pcEvent(loop.header_pc, EVENT_IR), loop.iterations) << std::hex << loop.header_pc;
+		EXPECT_LE(loop.max_trips, cfg.max_trips + 1);
+	}
+	EXPECT_EQ(kernel_entry.size(), kernel_loops);
+}
+
+TEST(CallgrindGenerator, UnnamedCodeGetsNoLoops) {
+	CallgrindGenerator gen("/dev/null");
+	gen.setLoopProfiling(true);
+	gen.loadPCInfo(0x1000, "", "addi\ta0,a0,-1", "", 0);
+	gen.loadPCInfo(0x1004, "", "nop", "", 0);
+	gen.loadPCInfo(0x1008, "", "bnez\ta0,1000", "", 0);
+	for (int i = 0; i < 4; ++i) {
+		gen.recordExecution(0x1000, EVENT_IR, 1, 10, false);
+		gen.recordExecution(0x1004, EVENT_IR, 1, -1, false);
+		gen.recordExecution(0x1008, EVENT_IR, 1, 0, true);
+	}
+	EXPECT_TRUE(gen.loopStats().empty());
+
+	const std::string path = testing::TempDir() + "unnamed_loops.txt";
+	EXPECT_TRUE(gen.writeLoopReport(path));
+	std::remove(path.c_str());
+}
+
+TEST(CallgrindGenerator, LatencyHistogramsMatchPerCallInclusiveCost) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	ASSERT_TRUE(gen.enableLatencyHistograms("Ir"));
+	auto truth = profile(gen, cfg, 200000);
+
+	// Per callee: calls and summed inclusive Ir over every edge into it
+	SyntheticWorkload workload(cfg);
+	std::map<uint64_t, std::string> func_at;
+	for (const auto& [pc, func, assembly, file, line] : workload.objdump()) func_at[pc] = func;
+	std::map<std::string, std::pair<uint64_t, uint64_t>> expected;
+	for (const auto& edge : truth.edges) {
+		auto& e = expected[func_at.at(edge.target_pc)];
+		e.first += edge.calls;
+		e.second += edge.inclusive_ir;
+	}
+
+	std::vector<FunctionLatency> latencies = gen.functionLatencies();
+	ASSERT_FALSE(latencies.empty());
+	for (const auto& l : latencies) {
+		ASSERT_TRUE(expected.count(l.func)) << l.func;
+		EXPECT_EQ(expected[l.func].first, l.calls) << l.func;
+		EXPECT_DOUBLE_EQ(static_cast<double>(expected[l.func].second) / l.calls, l.mean) << l.func;
+		EXPECT_LE(l.min, l.p50);
+		EXPECT_LE(l.p50, l.p90);
+		EXPECT_LE(l.p99, l.max);
+		// A bucket is at most 1/8 of its values wide
+		EXPECT_LE(l.p50, l.min + std::max<uint64_t>(l.max - l.min, l.max / 8));
+	}
+	for (size_t i = 1; i < latencies.size(); ++i) EXPECT_GE(latencies[i - 1].p99, latencies[i].p99);
+}
+
+TEST(LatencyHistogram, BucketsBoundRelativeError) {
+	for (uint64_t v : {0ull, 7ull, 8ull, 9ull, 1000ull, 123456789ull, ~0ull}) {
+		size_t b = LatencyHistogram::bucketOf(v);
+		ASSERT_LT(b, LatencyHistogram::BUCKETS);
+		EXPECT_LE(LatencyHistogram::bucketLow(b), v);
+		EXPECT_GE(LatencyHistogram::bucketHigh(b), v);
+		EXPECT_LE(LatencyHistogram::bucketHigh(b) - LatencyHistogram::bucketLow(b), v / 8);
+	}
+
+	// One slow call in 101 shows up in max but not in p99
+	LatencyHistogram hist;
+	for (int i = 0; i < 100; ++i) hist.record(200);
+	hist.record(20000);
+	EXPECT_EQ(200u, hist.min);
+	EXPECT_GE(hist.percentile(0.99), 200u);
+	EXPECT_LE(hist.percentile(0.99), 200u + 200u / 8);
+	EXPECT_EQ(20000u, hist.percentile(1.0));
+
+	// Only the buckets from the shortest to the longest call are stored
+	hist.record(100);
+	EXPECT_EQ(LatencyHistogram::bucketOf(100), hist.first_bucket);
+	EXPECT_EQ(LatencyHistogram::bucketOf(20000) + 1, hist.endBucket());
+	EXPECT_EQ(100u, hist.count(LatencyHistogram::bucketOf(200)));
+	EXPECT_EQ(1u, hist.count(LatencyHistogram::bucketOf(100)));
+	EXPECT_EQ(0u, hist.count(0));
+	EXPECT_LE(hist.percentile(0.0), 100u + 100u / 8);
+}
+
+TEST(CallgrindGenerator, LcovReportsLinesFunctionsAndBranches) {
+	SyntheticWorkloadConfig cfg;
+	cfg.w_recurse = 0;  // fib never runs: its lines stay uncovered
+	CallgrindGenerator gen("/dev/null");
+	gen.setOptions(false, true, true);
+	profile(gen, cfg, 50000);
+	const std::string path = testing::TempDir() + "synthetic.info";
+	ASSERT_TRUE(gen.writeLcov(path, "synthetic"));
+
+	std::map<std::string, std::map<std::string, uint64_t>> by_file;  // file -> "DA:line" / "FNDA:fn" -> count
+	std::map<std::string, uint64_t> branch_sides;                      // "file:line" -> taken + fallthrough
+	std::ifstream in(path);
+	std::string line, file;
+	size_t records = 0;
+	while (std::getline(in, line)) {
+		if (line.rfind("SF:", 0) == 0) file = line.substr(3);
+		if (line == "end_of_record") ++records;
+		if (line.rfind("DA:", 0) == 0) {
+			size_t comma = line.find(',');
+			by_file[file]["DA:" + line.substr(3, comma - 3)] = std::stoull(line.substr(comma + 1));
+		}
+		if (line.rfind("FNDA:", 0) == 0) {
+			size_t comma = line.find(',');
+			by_file[file]["FNDA:" + line.substr(comma + 1)] = std::stoull(line.substr(5, comma - 5));
+		}
+		if (line.rfind("BRDA:", 0) == 0) {
+			size_t comma = line.find(',');
+			std::string count = line.substr(line.rfind(',') + 1);
+			branch_sides[file + ":" + line.substr(5, comma - 5)] += count == "-" ? 0 : std::stoull(count);
+		}
+	}
+	std::remove(path.c_str());
+
+	SyntheticWorkload workload(cfg);
+	EXPECT_GT(records, 1u);
+	for (const auto& [pc, func, assembly, src, src_line] : workload.objdump()) {
+		const uint64_t ir = gen.pcEvent(pc, EVENT_IR);
+		EXPECT_EQ(ir, by_file[src]["DA:" + std::to_string(src_line)]) << std::hex << pc;
+		if (assembly.rfind("b", 0) == 0) {
+			EXPECT_EQ(ir, branch_sides[src + ":" + std::to_string(src_line)]) << std::hex << pc;
+		}
+	}
+	EXPECT_EQ(0u, by_file["fib.c"]["FNDA:fib"]);
+	EXPECT_GT(by_file["kernel_0.c"]["FNDA:kernel_0"], 0u);
+}
+
+TEST(Objdump, ReadsFunctionsLinesAndInstructions) {
+	const std::string path = testing::TempDir() + "objdump.dis";
+	{
+		std::ofstream out(path);
+		out << "\nfirmware.elf:     file format elf64-littleriscv\n\n\n"
+		    << "Disassembly of section .text:\n\n"
+		    << "0000000080000000 <_start>:\n_start():\n/src/start.S:5\n"
+		    << "    80000000:\t00001117          \tauipc\tsp,0x1\n"
+		    << "/src/start.S:6\n"
+		    << "    80000004:\t008000ef          \tjal\t8000000c <main>\n\n"
+		    << "000000008000000c <main>:\nmain():\n/src/main.c:3 (discriminator 1)\n"
+		    << "    8000000c:\t4501                \tli\ta0,0\n"
+		    << "    8000000e:\t8082                \tret\n\n"
+		    << "0000000080000010 <memcpy>:\n"  // Library code without line info
+		    << "    80000010:\t8082                \tret\n";
+	}
+	std::vector<std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>> entries;
+	ASSERT_TRUE(readObjdump(path, entries));
+	std::remove(path.c_str());
+
+	ASSERT_EQ(5u, entries.size());
+	EXPECT_EQ(std::make_tuple(uint64_t{0x80000000}, std::string("_start"), std::string("auipc\tsp,0x1"),
+	                          std::string("/src/start.S"), uint32_t{5}), entries[0]);
+	EXPECT_EQ(6u, std::get<4>(entries[1]));
+	EXPECT_EQ(std::make_tuple(uint64_t{0x8000000e}, std::string("main"), std::string("ret"),
+	                          std::string("/src/main.c"), uint32_t{3}), entries[3]);
+	EXPECT_EQ(std::make_tuple(uint64_t{0x80000010}, std::string("memcpy"), std::string("ret"),
+	                          std::string("unknown"), uint32_t{0}), entries[4]);
+}
+
+TEST(OpClass, ClassifiesRiscvMnemonics) {
+	EXPECT_EQ(OpClass::ALU, classifyOpClass("addi\ta0,a0,1"));
+	EXPECT_EQ(OpClass::ALU, classifyOpClass("c.li\ta0,0"));
+	EXPECT_EQ(OpClass::MUL_DIV, classifyOpClass("divuw\ta0,a0,a1"));
+	EXPECT_EQ(OpClass::LOAD, classifyOpClass("c.lwsp\tra,12(sp)"));
+	EXPECT_EQ(OpClass::LOAD, classifyOpClass("fld\tfa0,8(a0)"));
+	EXPECT_EQ(OpClass::STORE, classifyOpClass("amoadd.w\ta0,a1,(a2)"));
+	EXPECT_EQ(OpClass::BRANCH, classifyOpClass("bnez\ta2,80000084 <kernel_0>"));
+	EXPECT_EQ(OpClass::BRANCH, classifyOpClass("ret"));
+	EXPECT_EQ(OpClass::CSR, classifyOpClass("csrr\ta0,mcycle"));
+	EXPECT_EQ(OpClass::FP, classifyOpClass("fmadd.d\tfa0,fa1,fa2,fa3"));
+	EXPECT_EQ(OpClass::VECTOR, classifyOpClass("vle32.v\tv8,(a0)"));
+	EXPECT_EQ(OpClass::OTHER, classifyOpClass("fence\tiorw,iorw"));
+	EXPECT_EQ(OpClass::OTHER, classifyOpClass(""));
+}
+
+TEST(CallgrindGenerator, InstructionMixCoversEveryInstruction) {
+	SyntheticWorkloadConfig cfg = SyntheticWorkloadConfig::loopHeavy();
+	CallgrindGenerator gen("/dev/null");
+	auto truth = profile(gen, cfg, 100000);
+
+	uint64_t total = 0;
+	for (const auto& [func, mix] : gen.instructionMixByFunction()) {
+		total += mix.total();
+		if (func.rfind("kernel_", 0) == 0) {
+			// One mul, load and store per loop iteration
+			EXPECT_EQ(mix.ir[size_t(OpClass::MUL_DIV)], mix.ir[size_t(OpClass::LOAD)]) << func;
+			EXPECT_EQ(mix.ir[size_t(OpClass::MUL_DIV)], mix.ir[size_t(OpClass::STORE)]) << func;
+			EXPECT_GT(mix.ir[size_t(OpClass::MUL_DIV)], 0u) << func;
+		}
+	}
+	EXPECT_EQ(truth.total_ir, total);
+}
+
+TEST(CallgrindGenerator, EnergyFollowsInstructionMix) {
+	SyntheticWorkloadConfig cfg;
+	const std::string path = testing::TempDir() + "energy.callgrind";
+	CallgrindGenerator gen(path);
+	EnergyModel model;
+	for (size_t c = 0; c < OP_CLASS_COUNT; ++c) model.op_class[c] = static_cast<double>(c + 1);
+	model.events.push_back({"Bcm", 100.0});
+	ASSERT_TRUE(gen.setEnergyModel(model));
+	profile(gen, cfg, 100000);
+
+	std::map<std::string, uint64_t> expected;
+	for (const auto& [func, mix] : gen.instructionMixByFunction()) {
+		for (size_t c = 0; c < OP_CLASS_COUNT; ++c) expected[func] += mix.ir[c] * (c + 1);
+	}
+	SyntheticWorkload workload(cfg);
+	for (const auto& [pc, func, assembly, file, line] : workload.objdump()) {
+		expected[func] += 100 * gen.pcEvent(pc, EVENT_BCM);
+	}
+	std::map<std::string, uint64_t> energy;
+	for (const auto& [func, joules] : gen.energyByFunction()) energy[func] = joules;
+	EXPECT_EQ(expected, energy);
+
+	model.events.push_back({"NoSuchEvent", 1.0});
+	EXPECT_FALSE(gen.setEnergyModel(model));
+
+	gen.writeOutput();
+	std::ifstream in(path);
+	std::string line;
+	bool has_column = false;
+	while (std::getline(in, line)) {
+		if (line.rfind("events:", 0) == 0) has_column = line.size() > 7 && line.substr(line.size() - 7) == " Energy";
+	}
+	EXPECT_TRUE(has_column);
+	std::remove(path.c_str());
+}
+
+TEST(CallgrindGenerator, BranchHistoryTracksHotSitesAfterWarmup) {
+	SyntheticWorkloadConfig cfg = SyntheticWorkloadConfig::loopHeavy();
+	CallgrindGenerator gen("/dev/null");
+	gen.enableBranchHistory(4, 20000, 8);
+	profile(gen, cfg, 200000);
+
+	auto sites = gen.branchPredictability();
+	ASSERT_EQ(4u, sites.size());
+	for (const auto& site : sites) {
+		EXPECT_GT(site.outcomes, 0u);
+		EXPECT_LT(site.outcomes, gen.pcEvent(site.pc, EVENT_BC));
+		// Conditioning on history can only help
+		EXPECT_GE(site.local_accuracy + 1e-12, site.static_accuracy);
+		EXPECT_LE(site.conditional_entropy, site.entropy + 1e-12);
+		// Kernel latches are mostly taken and only fall through on loop exit
+		EXPECT_GT(site.taken_rate, 0.5);
+	}
+
+	// A later, smaller selection must not leave the old sites pointing past it
+	gen.enableBranchHistory(1, 1000, 8);
+	SyntheticWorkload workload(cfg);
+	workload.run(20000, [&gen](const TraceRecord& r) {
+		gen.recordExecution(r.pc, EVENT_IR, 1, r.dest_reg, r.is_branch);
+	});
+	sites = gen.branchPredictability();
+	ASSERT_EQ(1u, sites.size());
+	EXPECT_GT(sites[0].outcomes, 0u);
+}
+
+TEST(CallgrindGenerator, LrScRetriesAreChargedToLockAndHart) {
+	CallgrindGenerator gen("/dev/null");
+	gen.registerEvent("ScFail");
+	gen.registerEvent("Spin");
+	gen.loadPCInfo(0x1000, "spin_lock", "lr.w.aq\ta5,(a0)", "lock.c", 10);
+	gen.loadPCInfo(0x1004, "spin_lock", "bnez\ta5,1000 <spin_lock>", "lock.c", 11);
+	gen.loadPCInfo(0x1008, "spin_lock", "sc.w\ta5,a4,(a0)", "lock.c", 12);
+	gen.loadPCInfo(0x100c, "spin_lock", "bnez\ta5,1000 <spin_lock>", "lock.c", 13);
+	gen.loadPCInfo(0x2000, "stats_inc", "amoadd.w\tzero,a1,(a0)", "stats.c", 5);
+	const uint64_t lock = 0x80001000, counter = 0x80002000;
+
+	gen.recordAtomicAccess(0, 0x1000, lock);
+	gen.recordAtomicAccess(1, 0x1000, lock);
+	gen.recordAtomicAccess(0, 0x1008, lock);
+	gen.recordAtomicAccess(1, 0x1008, lock, true);
+	gen.recordAtomicAccess(1, 0x1000, lock);  // Retry after the failed SC
+	gen.recordAtomicAccess(1, 0x1008, lock);
+	gen.recordAtomicAccess(0, 0x2000, counter);
+	gen.recordAtomicAccess(1, 0x2000, counter);
+
+	const uint32_t sc_fail = gen.eventId("ScFail"), spin = gen.eventId("Spin");
+	EXPECT_EQ(1u, gen.pcEvent(0x1008, sc_fail));
+	EXPECT_EQ(1u, gen.pcEvent(0x1000, spin));
+	EXPECT_EQ(0u, gen.pcEvent(0x2000, spin));
+
+	auto locks = gen.lockContention();
+	ASSERT_EQ(2u, locks.size());
+	EXPECT_EQ(lock, locks[0].address);
+	EXPECT_EQ(6u, locks[0].counts.accesses);
+	EXPECT_EQ(1u, locks[0].counts.sc_failures);
+	EXPECT_EQ(1u, locks[0].counts.spins);
+	EXPECT_EQ(3u, locks[0].hart_mask);
+	ASSERT_EQ(1u, locks[0].functions.size());
+	EXPECT_EQ("spin_lock", locks[0].functions[0].first);
+
+	auto sites = gen.atomicSites();
+	ASSERT_EQ(6u, sites.size());  // lr, sc and amoadd per hart
+	EXPECT_EQ(1u, sites[0].hart);
+	EXPECT_EQ(AtomicKind::LR, sites[0].kind);
+	EXPECT_EQ(1u, sites[1].hart);
+	EXPECT_EQ(AtomicKind::SC, sites[1].kind);
+	EXPECT_EQ(AtomicKind::NONE, classifyAtomic("lw\ta5,0(a0)"));
+}
+
+TEST(CallgrindGenerator, OnlyContendedAtomicRepeatsAreSpins) {
+	CallgrindGenerator gen("/dev/null");
+	gen.registerEvent("Spin");
+	gen.loadPCInfo(0x2000, "stats_inc", "amoadd.w\tzero,a1,(a0)", "stats.c", 5);
+	gen.loadPCInfo(0x3000, "try_lock", "amocas.w\ta5,a4,(a0)", "lock.c", 20);
+	const uint64_t counter = 0x80002000, lock = 0x80003000;
+	const uint32_t spin = gen.eventId("Spin");
+
+	// One hart bumping a private counter in a loop is not spinning
+	for (int i = 0; i < 4; ++i) gen.recordAtomicAccess(0, 0x2000, counter);
+	EXPECT_EQ(0u, gen.pcEvent(0x2000, spin));
+
+	// Another hart in between makes the repeat a spin
+	gen.recordAtomicAccess(1, 0x2000, counter);
+	gen.recordAtomicAccess(0, 0x2000, counter);
+	EXPECT_EQ(1u, gen.pcEvent(0x2000, spin));
+
+	// So does retrying a CAS whose compare missed
+	gen.recordAtomicAccess(0, 0x3000, lock, true);
+	gen.recordAtomicAccess(0, 0x3000, lock);
+	gen.recordAtomicAccess(0, 0x3000, lock);
+	EXPECT_EQ(1u, gen.pcEvent(0x3000, spin));
+	EXPECT_EQ(0u, gen.lockContention()[0].counts.sc_failures);
+}
+
+TEST(CallgrindGenerator, UnnamedLockCallersReportAsUnknown) {
+	CallgrindGenerator gen("/dev/null");
+	gen.loadPCInfo(0x1000, "", "amoswap.w.aq\ta5,a4,(a0)", "", 0);
+	gen.recordAtomicAccess(0, 0x1000, 0x80001000);
+	auto locks = gen.lockContention();
+	ASSERT_EQ(1u, locks.size());
+	ASSERT_EQ(1u, locks[0].functions.size());
+	EXPECT_EQ("unknown", locks[0].functions[0].first);
+}
+
+TEST(DerivedEvent, ParsesLinearAndRatioFormulas) {
+	const std::vector<std::string> names = {"Ir", "Cycle", "Bc", "Bcm"};
+	const uint64_t events[] = {200, 300, 40, 10};
+	DerivedEvent derived;
+	std::string error;
+
+	ASSERT_TRUE(parseEventFormula("Cycle / Ir", names, derived, error)) << error;
+	EXPECT_FALSE(derived.isCallgrindExpressible());
+	EXPECT_DOUBLE_EQ(1.5, derived.evaluate(events));
+
+	ASSERT_TRUE(parseEventFormula("(Bc - Bcm) / Bc", names, derived, error)) << error;
+	EXPECT_DOUBLE_EQ(0.75, derived.evaluate(events));
+
+	ASSERT_TRUE(parseEventFormula("Ir + 10*Bcm - Bc", names, derived, error)) << error;
+	EXPECT_TRUE(derived.isCallgrindExpressible());
+	EXPECT_EQ("Ir + 10 * Bcm - Bc", derived.callgrindFormula(names));
+	EXPECT_DOUBLE_EQ(260, derived.evaluate(events));
+
+	ASSERT_TRUE(parseEventFormula("0.5 Cycle", names, derived, error)) << error;
+	EXPECT_FALSE(derived.isCallgrindExpressible());
+
+	EXPECT_FALSE(parseEventFormula("Ir + Foo", names, derived, error));
+	EXPECT_FALSE(parseEventFormula("Cycle /", names, derived, error));
+	EXPECT_FALSE(parseEventFormula("Cycle Ir", names, derived, error));
+}
+
+TEST(CallgrindGenerator, WritesOnlyLinearDerivedEventsToCallgrind) {
+	const std::string path = testing::TempDir() + "derived.callgrind";
+	CallgrindGenerator gen(path);
+	gen.configureEvents({"Ir", "Cycle", "Bc", "Bcm"});
+	ASSERT_TRUE(gen.addDerivedEvent("CEst", "Ir + 10 * Bcm", "Cycle estimate"));
+	ASSERT_TRUE(gen.addDerivedEvent("CPI", "Cycle / Ir"));
+	gen.recordExecution(0x1000, EVENT_IR, 1);
+	gen.writeOutput();
+
+	std::ifstream in(path);
+	std::stringstream dump;
+	dump << in.rdbuf();
+	EXPECT_NE(std::string::npos, dump.str().find("event: CEst = Ir + 10 * Bcm : Cycle estimate\n"));
+	EXPECT_EQ(std::string::npos, dump.str().find("event: CPI"));
+	std::remove(path.c_str());
+}
+
+TEST(CallgrindGenerator, RegisteredStallEventsGetTheirOwnColumns) {
+	const std::string path = testing::TempDir() + "stalls.callgrind";
+	CallgrindGenerator gen(path);
+	std::vector<uint32_t> stalls;
+	for (const char* name : {"StallFrontend", "StallRaw", "StallStructural", "StallMemory", "StallFence", "StallCsr"}) {
+		stalls.push_back(gen.registerEvent(name));
+	}
+	EXPECT_EQ(6u, stalls.front());
+	EXPECT_EQ(11u, stalls.back());
+	EXPECT_EQ(stalls[1], gen.registerEvent("StallRaw"));
+
+	gen.loadPCInfo(0x1000, "f", "lw\ta0,0(a1)", "f.c", 1);
+	gen.loadPCInfo(0x1004, "f", "add\ta0,a0,a0", "f.c", 2);
+	gen.recordExecution(0x1000, EVENT_IR, 1);
+	gen.addEvent(0x1000, stalls[3], 40);
+	gen.recordExecution(0x1004, EVENT_IR, 1);
+	gen.addEvent(0x1004, stalls[1], 2);
+	EXPECT_EQ(40u, gen.pcEvent(0x1000, stalls[3]));
+	EXPECT_EQ(2u, gen.pcEvent(0x1004, stalls[1]));
+	EXPECT_EQ(0u, gen.pcEvent(0x1004, stalls[3]));
+	gen.writeOutput();
+
+	std::ifstream in(path);
+	std::stringstream dump;
+	dump << in.rdbuf();
+	EXPECT_NE(std::string::npos, dump.str().find("events: Ir Cycle Bc Bcm Bi Bim StallFrontend StallRaw StallStructural StallMemory StallFence StallCsr\n"));
+	EXPECT_NE(std::string::npos, dump.str().find("totals: 2 0 0 0 0 0 0 2 0 40 0 0\n"));
+	std::remove(path.c_str());
+}
+
+TEST(CallgrindGenerator, UnregisteredBranchEventsAreSkipped) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	gen.configureEvents({"Ir"});
+	auto truth = profile(gen, cfg, 50000);
+
+	EXPECT_EQ(EventRegistry::INVALID, gen.eventId("Bc"));
+	EXPECT_EQ(truth.self_ir, selfIrByFunction(gen, cfg));
+	EXPECT_EQ(1u, gen.callEdge(truth.edges[0].site_pc, truth.edges[0].target_pc).inclusive_events.size());
+}
+
+TEST(CallgrindGenerator, UnregisteredEventIdsAreNotCounted) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	gen.configureEvents({"Cycle", "Ir"});
+	const uint32_t ir = gen.eventId("Ir");
+	SyntheticWorkload workload(cfg);
+	workload.load(gen);
+	workload.run(20000, [&](const TraceRecord& r) {
+		gen.recordExecution(r.pc, ir, 1, r.dest_reg, r.is_branch);
+		gen.recordExecution(r.pc, EVENT_BC, 1);  // Not registered: stream only
+	});
+	const uint64_t pc = std::get<0>(workload.objdump().front());
+	EXPECT_FALSE(gen.addEvent(pc, 7, 1));
+	EXPECT_TRUE(gen.addEvent(pc, ir, 0));
+
+	// The instruction mix follows "Ir" wherever it is registered
+	uint64_t mix_total = 0;
+	for (const auto& [func, mix] : gen.instructionMixByFunction()) mix_total += mix.total();
+	EXPECT_EQ(gen.getStats().instructions_recorded / 2, mix_total);
+	gen.configureEvents({"Cycle"});
+	EXPECT_TRUE(gen.instructionMixByFunction().empty());
+
+	BasicSimulatorInterface<CallGraphGeneratorPolicy> sim("/dev/null");
+	sim.onInstruction(pc, EVENT_BC, 1);
+	EXPECT_FALSE(sim.onEvent(pc, EVENT_BIM, 1));
+	EXPECT_EQ(0u, sim.pcEvent(pc, EVENT_BC));
+}
+
+TEST(CallgrindGenerator, RetireTimestampsAttributeCycleDeltas) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	SyntheticWorkload workload(cfg);
+	workload.load(gen);
+
+	// PCs at 8 mod 16 delay the next retirement by 3 cycles
+	std::map<uint64_t, uint64_t> expected_cycles;
+	uint64_t timestamp = 100;
+	uint64_t prev_pc = 0;
+	bool first = true;
+	workload.run(50000, [&](const TraceRecord& r) {
+		uint64_t cycles = first ? 0 : 1 + (prev_pc % 16 == 8 ? 3 : 0);
+		timestamp += cycles;
+		expected_cycles[r.pc] += cycles;
+		gen.recordRetire(r.pc, timestamp, r.dest_reg, r.is_branch);
+		prev_pc = r.pc;
+		first = false;
+	});
+
+	EXPECT_EQ(workload.truth().self_ir, selfIrByFunction(gen, cfg));
+	uint64_t total = 0;
+	for (const auto& [pc, cycles] : expected_cycles) {
+		EXPECT_EQ(cycles, gen.pcEvent(pc, EVENT_CYCLE)) << std::hex << pc;
+		total += cycles;
+	}
+	EXPECT_EQ(timestamp - 100, total);
+}
+
+TEST(CallgrindGenerator, StallSplitChargesBlockingInstruction) {
+	CallgrindGenerator gen("/dev/null");
+	gen.setStallSplit(true);
+	gen.loadPCInfo(0x1000, "f", "lw\ta0,0(a1)", "f.c", 1);
+	gen.loadPCInfo(0x1004, "f", "add\ta0,a0,a0", "f.c", 2);
+	const RetireRecord batch[] = {
+		{0x1000, 10, 0, -1, 0},
+		{0x1004, 15, 0x1000, -1, 0},  // 4 stall cycles waiting on the load
+		{0x1000, 17, 0, -1, 0},
+	};
+	gen.recordRetireBatch(batch, 3);
+
+	EXPECT_EQ(2u, gen.pcEvent(0x1000, EVENT_IR));
+	EXPECT_EQ(4u + 2u, gen.pcEvent(0x1000, EVENT_CYCLE));
+	EXPECT_EQ(1u, gen.pcEvent(0x1004, EVENT_CYCLE));
+	EXPECT_EQ(4u, gen.getStats().stall_cycles_split);
+}
+
+TEST(CallgrindGenerator, VectorEventsMeasureLaneUtilization) {
+	CallgrindGenerator gen("/dev/null");
+	gen.enableVectorProfiling(256);
+	gen.loadPCInfo(0x1000, "saxpy", "vle32.v\tv8,(a1)", "saxpy.c", 4);
+	gen.loadPCInfo(0x1004, "saxpy", "vfmacc.vf\tv8,fa0,v16", "saxpy.c", 5);
+	const uint16_t e32m1 = 0x10, e32m2 = 0x11, e8mf2 = 0x07;
+	const RetireRecord batch[] = {
+		{0x1000, 1, 0, -1, 0, 1, e32m1, 8},   // Full: VLMAX = 256 / 32 = 8
+		{0x1000, 2, 0, -1, 0, 1, e32m1, 3},   // Strip-mined tail
+		{0x1004, 3, 0, -1, 0, 1, e32m2, 16},  // VLMAX = 2 * 8
+		{0x1004, 4, 0, -1, 0, 1, e8mf2, 4},   // VLMAX = 256 / 8 / 2 = 16
+	};
+	gen.recordRetireBatch(batch, 4);
+
+	const uint32_t vinst = gen.eventId("VInst"), elems = gen.eventId("VElemOps");
+	const uint32_t slots = gen.eventId("VLaneSlots"), lmul = gen.eventId("VLmulEighths");
+	EXPECT_EQ(2u, gen.pcEvent(0x1000, vinst));
+	EXPECT_EQ(11u, gen.pcEvent(0x1000, elems));
+	EXPECT_EQ(16u, gen.pcEvent(0x1000, slots));
+	EXPECT_EQ(16u, gen.pcEvent(0x1000, lmul));
+	EXPECT_EQ(20u, gen.pcEvent(0x1004, elems));
+	EXPECT_EQ(32u, gen.pcEvent(0x1004, slots));
+	EXPECT_EQ(16u + 4u, gen.pcEvent(0x1004, lmul));
+	EXPECT_EQ(4u, gen.pcEvent(0x1000, EVENT_IR) + gen.pcEvent(0x1004, EVENT_IR));
+}
+
+TEST(CallgrindGenerator, RunawayRecursionKeepsOutermostFrames) {
+	SyntheticWorkloadConfig cfg;
+	cfg.recursion_depth = 40;
+	cfg.w_straight = cfg.w_kernel = cfg.w_dispatch = cfg.w_tail = cfg.w_helper = 0;
+	CallgrindGenerator gen("/dev/null");
+	gen.setCallStackCapacity(16);
+	auto truth = profile(gen, cfg, 10000);
+
+	GeneratorStats stats = gen.getStats();
+	EXPECT_GT(stats.call_stack_overflows, 0u);
+	EXPECT_EQ(41u, stats.call_stack_max_depth);
+	EXPECT_EQ(0u, stats.resync_count);
+	EXPECT_EQ(truth.self_ir, selfIrByFunction(gen, cfg));
+
+	// main -> fib (called once per fib -> fib chain) is the outermost frame and stays exact
+	auto outermost = std::min_element(truth.edges.begin(), truth.edges.end(),
+		[](const auto& a, const auto& b) { return a.calls < b.calls; });
+	EXPECT_EQ(outermost->inclusive_ir, gen.callEdge(outermost->site_pc, outermost->target_pc).inclusive_events[EVENT_IR]);
+
+	auto hist = gen.callDepthHistogram();
+	ASSERT_EQ(17u, hist.size());
+	EXPECT_GT(hist[16], 0u);
+}
+
+TEST(CallgrindGenerator, ReturnsBeyondCapacityAreNotTailCalls) {
+	// main -> f0 -> ... -> f7, twice as deep as the stack, then back out
+	const int depth = 8;
+	CallgrindGenerator gen("/dev/null");
+	gen.setCallStackCapacity(4);
+	gen.loadPCInfo(0x100, "main", "jal\tra,f0", "main.c", 1);
+	gen.loadPCInfo(0x104, "main", "nop", "main.c", 2);
+	for (int i = 0; i < depth; ++i) {
+		const uint64_t base = 0x1000 * (i + 1);
+		const std::string fn = "f" + std::to_string(i);
+		gen.loadPCInfo(base, fn, "jal\tra,f" + std::to_string(i + 1), "f.c", 1);
+		gen.loadPCInfo(base + 4, fn, "ret", "f.c", 2);
+	}
+	gen.recordExecution(0x100, EVENT_IR, 1, 1, true);
+	for (int i = 0; i < depth; ++i) {
+		gen.recordExecution(0x1000 * (i + 1) + (i + 1 == depth ? 4 : 0), EVENT_IR, 1, i + 1 == depth ? 0 : 1, true);
+	}
+	for (int i = depth - 2; i >= 0; --i) gen.recordExecution(0x1000 * (i + 1) + 4, EVENT_IR, 1, 0, true);
+	gen.recordExecution(0x104, EVENT_IR, 1, -1, false);
+
+	GeneratorStats stats = gen.getStats();
+	EXPECT_GT(stats.call_stack_overflows, 0u);
+	EXPECT_EQ(0u, stats.resync_count);
+	EXPECT_EQ(1u, gen.callEdge(0x100, 0x1000).count);
+	EXPECT_EQ(0u, gen.callEdge(0x1000 * depth + 4, 0x1000 * (depth - 1) + 4).count);
+	EXPECT_EQ(uint64_t(2 * depth - 1), gen.callEdge(0x100, 0x1000).inclusive_events[EVENT_IR]);
+}
+
+TEST(ETraceDecoder, DecodedStreamMatchesSyntheticTrace) {
+	SyntheticWorkloadConfig cfg;
+	SyntheticWorkload workload(cfg);
+	const std::vector<TraceRecord> stream = workload.generate(100000);
+	ETraceImage image(workload.objdump());
+	ETraceEncoder encoder(image);
+	for (const TraceRecord& r : stream) encoder.retire(r.pc);
+	const std::vector<uint8_t> trace = encoder.finish();
+
+	std::vector<RetireRecord> decoded;
+	ETraceDecoder decoder(image);
+	ASSERT_TRUE(decoder.decode(trace, [&decoded](const RetireRecord* records, size_t count) {
+		decoded.insert(decoded.end(), records, records + count);
+	}, 1000)) << decoder.error();
+
+	ASSERT_EQ(stream.size(), decoded.size());
+	for (size_t i = 0; i < stream.size(); ++i) {
+		ASSERT_EQ(stream[i].pc, decoded[i].pc) << i;
+		ASSERT_EQ(stream[i].dest_reg, decoded[i].dest_reg) << std::hex << stream[i].pc;
+		ASSERT_EQ(stream[i].is_branch, decoded[i].is_branch != 0) << std::hex << stream[i].pc;
+	}
+	EXPECT_LT(trace.size(), stream.size() / 4);
+
+	// Same profile as the simulated stream
+	CallgrindGenerator gen("/dev/null");
+	workload.load(gen);
+	gen.recordRetireBatch(decoded.data(), decoded.size());
+	EXPECT_EQ(workload.truth().self_ir, selfIrByFunction(gen, cfg));
+	for (const auto& edge : workload.truth().edges) {
+		EXPECT_EQ(edge.inclusive_ir, gen.callEdge(edge.site_pc, edge.target_pc).inclusive_events[EVENT_IR]);
+	}
+}
+
+TEST(ETraceDecoder, RejectsTraceThatLeavesTheImage) {
+	ETraceImage image({{0x1000, "f", "addi\ta0,a0,1", "f.c", 1}, {0x1004, "f", "jr\ta5", "f.c", 2}});
+	ETraceEncoder encoder(image);
+	encoder.retire(0x1000);
+	encoder.retire(0x1004);
+	encoder.retire(0x2000);  // Not in the image
+	std::vector<uint8_t> trace = encoder.finish();
+
+	ETraceDecoder decoder(image);
+	EXPECT_FALSE(decoder.decode(trace, [](const RetireRecord*, size_t) {}));
+	EXPECT_NE(std::string::npos, decoder.error().find("left the image"));
+}
+
+TEST(RetirePipe, DeliversEveryRecordInOrder) {
+	SyntheticWorkloadConfig cfg;
+	SyntheticWorkload workload(cfg);
+	std::vector<RetireRecord> records;
+	uint64_t cycle = 0;
+	workload.run(100000, [&](const TraceRecord& r) {
+		RetireRecord record{};
+		record.pc = r.pc;
+		record.timestamp = cycle += 1 + r.pc % 3;
+		record.dest_reg = r.dest_reg;
+		record.is_branch = r.is_branch;
+		records.push_back(record);
+	});
+
+	CallgrindGenerator direct("/dev/null");
+	workload.load(direct);
+	direct.recordRetireBatch(records.data(), records.size());
+
+	CallgrindGenerator piped("/dev/null");
+	workload.load(piped);
+	std::vector<uint64_t> pcs;
+	{
+		RetirePipe pipe([&](const RetireRecord* batch, size_t count) {
+			for (size_t i = 0; i < count; ++i) pcs.push_back(batch[i].pc);
+			piped.recordRetireBatch(batch, count);
+		}, 2);
+		for (const RetireRecord& record : records) pipe.push(record);
+		pipe.close();
+	}
+
+	ASSERT_EQ(records.size(), pcs.size());
+	for (size_t i = 0; i < records.size(); ++i) ASSERT_EQ(records[i].pc, pcs[i]) << i;
+	EXPECT_EQ(selfIrByFunction(direct, cfg), selfIrByFunction(piped, cfg));
+	for (const auto& edge : workload.truth().edges) {
+		EXPECT_EQ(direct.callEdge(edge.site_pc, edge.target_pc).inclusive_events,
+		          piped.callEdge(edge.site_pc, edge.target_pc).inclusive_events);
+	}
+}
+
+TEST(ControlTransfer, DecodesJumpsBranchesAndCompressedForms) {
+	EXPECT_EQ(1, decodeControlTransfer(0x00c000ef, false).link_reg);  // jal ra
+	EXPECT_EQ(-1, decodeControlTransfer(0x0000006f, false).link_reg);  // j (jal x0)
+	EXPECT_TRUE(decodeControlTransfer(0x00b50463, false).is_transfer);  // beq a0,a1
+	EXPECT_TRUE(decodeControlTransfer(0x8082, false).is_transfer);      // c.jr ra (ret)
+	EXPECT_EQ(-1, decodeControlTransfer(0x8082, false).link_reg);
+	EXPECT_EQ(1, decodeControlTransfer(0x9782, false).link_reg);        // c.jalr a5
+	EXPECT_FALSE(decodeControlTransfer(0x2505, false).is_transfer);     // c.addiw a0,1 on RV64
+	EXPECT_TRUE(decodeControlTransfer(0x2505, true).is_transfer);       // c.jal on RV32
+	EXPECT_FALSE(decodeControlTransfer(0x00150513, false).is_transfer); // addi
+}
+
+TEST(VerilatorProfile, ParsesScopeModuleAndLineFromFunctionNames) {
+	EXPECT_EQ("_combo__TOP__core__2", verilatorCfuncKey("Vtop_core::_combo__TOP__core__2(Vtop__Syms*)"));
+	VerilatorCfunc prof = parseVerilatorCfunc("_sequent__TOP__core__alu__1__PROF__alu__l12");
+	EXPECT_EQ("TOP.core.alu", prof.scope);
+	EXPECT_EQ("alu", prof.module);
+	EXPECT_EQ(12u, prof.line);
+	VerilatorCfunc v5 = parseVerilatorCfunc("Vtop___024root___nba_sequent__TOP__0");
+	EXPECT_EQ("TOP", v5.scope);
+	EXPECT_TRUE(v5.module.empty());
+	EXPECT_TRUE(parseVerilatorCfunc("_eval").scope.empty());
+
+	// Instances inside a generate array keep their escaped path together
+	VerilatorCfunc lane = parseVerilatorCfunc("_sequent__TOP__core__DOT__gen_lane__BRA__2__KET____DOT__u_alu__1__PROF__alu__l12");
+	EXPECT_EQ("TOP.core.gen_lane[2].u_alu", lane.scope);
+	EXPECT_EQ("alu", lane.module);
+	EXPECT_EQ(12u, lane.line);
+	EXPECT_EQ("TOP.core.gen_lane[0]", parseVerilatorCfunc("_combo__TOP__core__DOT__gen_lane__BRA__0__KET____3").scope);
+}
+
+TEST(VerilatorProfile, WritesInstanceHierarchyWithInclusiveCosts) {
+	const std::string dir = testing::TempDir() + "verilator_";
+	{
+		std::ofstream(dir + "alu.v") << "// ALU\n\nmodule alu (\n";
+		std::ofstream(dir + "core.v") << "module core #(parameter W = 32) (\n";
+		std::ofstream(dir + "cfuncs.txt")
+		    << "Flat profile:\n\nEach sample counts as 0.01 seconds.\n"
+		    << "  %   cumulative   self              self     total           \n"
+		    << " time   seconds   seconds    calls  ms/call  ms/call  name    \n"
+		    << " 50.00      0.02     0.02     1000     0.02     0.02  Vtop_alu::_sequent__TOP__core__alu__1__PROF__alu__l12(Vtop__Syms*)\n"
+		    << " 25.00      0.03     0.01     1000     0.01     0.01  Vtop_core::_combo__TOP__core__2__PROF__core__l7(Vtop__Syms*, bool)\n"
+		    << " 25.00      0.04     0.01                             Vtop::_eval(Vtop__Syms*)\n\n"
+		    << " %         the percentage of the total running time\n";
+		std::ofstream(dir + "profile_exec.dat")
+		    << "VLPROF arg --prof-exec\nVLPROFTHREAD 0\nVLPROFEXEC EVAL_BEGIN 100\n"
+		    << "VLPROFEXEC MTASK_BEGIN 110 id 5 predictStart 0 cpu 1\n"
+		    << "VLPROFEXEC MTASK_END 410 id 5 predictCost 30\n"
+		    << "VLPROFTHREAD 1\n"
+		    << "VLPROFEXEC MTASK_BEGIN 120 id 6 predictStart 0 cpu 2\n"
+		    << "VLPROFEXEC MTASK_END 170 id 6 predictCost 30\n";
+		std::ofstream(dir + "model.cpp")
+		    << "void Vtop___024root____Vmtask__5(Vtop___024root* vlSelf) {\n"
+		    << "    vlSymsp->TOP__core__alu._sequent__TOP__core__alu__1__PROF__alu__l12(vlSymsp);\n"
+		    << "    vlSymsp->TOP__core._combo__TOP__core__2__PROF__core__l7(vlSymsp, true);\n"
+		    << "}\n";
+	}
+	VerilatorProfile profile;
+	ASSERT_TRUE(profile.readRtlSources({dir + "alu.v", dir + "core.v"}));
+	ASSERT_TRUE(profile.readGprof(dir + "cfuncs.txt"));
+	ASSERT_TRUE(profile.readExecProfile(dir + "profile_exec.dat"));
+	ASSERT_TRUE(profile.readModelSources({dir + "model.cpp"}));
+	profile.writeCallgrind(dir + "callgrind.out");
+
+	std::ifstream in(dir + "callgrind.out");
+	std::stringstream text;
+	text << in.rdbuf();
+	const std::string out = text.str();
+	for (const char* name : {"alu.v", "core.v", "cfuncs.txt", "profile_exec.dat", "model.cpp", "callgrind.out"}) {
+		std::remove((dir + name).c_str());
+	}
+
+	// Mtask 5 (300 ticks) splits 2:1 by gprof time; mtask 6 has no body.
+	// Without instruction addresses positions are " line".
+	EXPECT_THAT(out, testing::HasSubstr("events: Ns CfuncCalls Ticks\n"));
+	EXPECT_THAT(out, testing::HasSubstr("fn=TOP.core.alu\nfl=" + dir + "alu.v\n 12 20000000 1000 200\n"));
+	EXPECT_THAT(out, testing::HasSubstr("fn=TOP.core\nfl=" + dir + "core.v\n 1 0 0 0\n"
+	                                    "cfn=TOP.core.alu\ncfl=" + dir + "alu.v\ncalls=1  3\n 1 20000000 1000 200\n"
+	                                    " 7 10000000 1000 100\n"));
+	EXPECT_THAT(out, testing::HasSubstr("fn=TOP\nfl=unknown\n 0 0 0 0\n"
+	                                    "cfn=TOP.core\ncfl=" + dir + "core.v\ncalls=1  1\n 0 30000000 2000 300\n"));
+	EXPECT_THAT(out, testing::HasSubstr("fn=_eval\nfl=unknown\n 0 10000000 0 0\n"));
+	EXPECT_THAT(out, testing::HasSubstr("fn=mtask 6\n 0 0 0 50\n"));
+	EXPECT_THAT(out, testing::HasSubstr("totals: 40000000 2000 350\n"));
+}
+
+TEST(LiveProfile, DeltasAddUpToPublishedSelfCosts) {
+	SyntheticWorkloadConfig cfg;
+	CallgrindGenerator gen("/dev/null");
+	const std::string path = testing::TempDir() + "live_profile.sock";
+	LiveProfileServer server(path);
+	ASSERT_TRUE(server.start());
+	server.attach(gen, 10000);
+	LiveProfileClient client;
+	ASSERT_TRUE(client.connect(path));
+	ASSERT_TRUE(client.update());
+	EXPECT_EQ(0u, client.sequence());  // Nothing published yet
+
+	auto totalsByFunction = [&client]() {
+		std::map<std::string, uint64_t> ir;
+		for (size_t fn = 0; fn < client.functions().size(); ++fn) {
+			if (client.total(fn, EVENT_IR)) ir[client.functions()[fn]] += client.total(fn, EVENT_IR);
+		}
+		return ir;
+	};
+
+	SyntheticWorkload workload(cfg);
+	workload.load(gen);
+	auto record = [&gen](const TraceRecord& r) { gen.recordExecution(r.pc, EVENT_IR, 1, r.dest_reg, r.is_branch); };
+	workload.run(50000, record);
+	ASSERT_TRUE(client.update());
+	EXPECT_EQ(5u, client.sequence());   // Published every 10000 records
+	EXPECT_EQ(50000u, client.instructions());
+
+	gen.publishSnapshot();
+	ASSERT_TRUE(client.update());
+	EXPECT_EQ(gen.getStats().instructions_recorded, client.instructions());
+	EXPECT_EQ(selfIrByFunction(gen, cfg), totalsByFunction());
+
+	const uint64_t before = client.instructions();
+	workload.run(25000, record);
+	gen.publishSnapshot();
+	ASSERT_TRUE(client.update());
+	EXPECT_EQ(selfIrByFunction(gen, cfg), totalsByFunction());
+	uint64_t delta = 0;
+	for (size_t fn = 0; fn < client.functions().size(); ++fn) delta += client.delta(fn, EVENT_IR);
+	EXPECT_EQ(client.instructions() - before, delta);
+
+	// After a reset the viewer starts over from a full frame
+	gen.reset();
+	workload.run(10000, record);
+	gen.publishSnapshot();
+	ASSERT_TRUE(client.update());
+	EXPECT_EQ(selfIrByFunction(gen, cfg), totalsByFunction());
+
+	server.stop();
+	EXPECT_FALSE(client.update());
+}
@@ -0,0 +1,460 @@
+// etrace_decoder.hpp - RISC-V E-Trace (te_inst) branch-trace front-end for CallgrindGenerator
+//
+// Rebuilds the retired instruction stream from te_inst packets and the
+// static image (the objdump entries also given to loadPCInfo) and hands it
+// to recordRetireBatch / SimulatorInterface::onRetireBatch, so hardware
+// traces and simulations share one profile pipeline.
+//
+// Supported te_inst subset (instruction delta trace, no options):
+//   format 3, subformat 0 (sync)  format:2 subformat:2 branch:1 privilege:2 address
+//   format 2 (address only)       format:2 address
+//   format 1 (branch map)         format:2 branches:5 branch_map:N [address]
+// Fields are packed LSB first. The address is the last field and is
+// sign-extended from the final payload bit, so redundant high bits are not
+// sent. Formats 1 and 2 carry it relative to the previous address
+// (differential mode); all addresses drop bit 0 (iaddress_lsb = 1). Each
+// packet is framed by one byte holding its payload length. There is no
+// return address stack, jump target cache, exception, context or timestamp
+// support, and notify/updiscon are not sent.
+//
+// A packet is sent for the first instruction (sync), whenever 31 branches
+// are pending (format 1 with branches = 0: full map, no address), for the
+// first instruction after an uninferable jump (indirect jumps and returns),
+// and for the last instruction when the trace stops. E-Trace has no
+// per-instruction timing, so decoded records count Ir only.
+#ifndef ETRACE_DECODER_HPP
+#define ETRACE_DECODER_HPP
+
+#include "test2.cpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Static control flow of one instruction
+struct ETraceInstruction {
+    enum Kind : uint8_t {
+        PLAIN,      // Falls through
+        BRANCH,     // Conditional, direct target
+        JUMP,       // Unconditional, direct target (inferable)
+        INDIRECT    // Register target or return (uninferable)
+    };
+    Kind kind = PLAIN;
+    uint32_t size = 4;
+    uint64_t target = 0;
+    int dest_reg = -1;      // Link register for jumps (0 = x0), -1 otherwise
+};
+
+// Instruction image built from objdump output
+class ETraceImage {
+public:
+    using ObjdumpEntry = std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>;
+
+private:
+    std::unordered_map<uint64_t, ETraceInstruction> instructions;
+
+public:
+    explicit ETraceImage(const std::vector<ObjdumpEntry>& objdump) {
+        std::vector<std::pair<uint64_t, const std::string*>> sorted;
+        sorted.reserve(objdump.size());
+        for (const auto& entry : objdump) sorted.emplace_back(std::get<0>(entry), &std::get<2>(entry));
+        std::sort(sorted.begin(), sorted.end());
+
+        instructions.reserve(sorted.size());
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            ETraceInstruction ins = decode(*sorted[i].second);
+            // objdump drops the c. prefix unless asked not to; a 2-byte gap gives it away
+            if (i + 1 < sorted.size() && sorted[i + 1].first - sorted[i].first == 2) ins.size = 2;
+            instructions[sorted[i].first] = ins;
+        }
+    }
+
+    const ETraceInstruction* find(uint64_t pc) const {
+        auto it = instructions.find(pc);
+        return it != instructions.end() ? &it->second : nullptr;
+    }
+
+    // Classify one "mnemonic\toperands <symbol>" line
+    static ETraceInstruction decode(std::string_view assembly) {
+        ETraceInstruction ins;
+        const size_t split = assembly.find_first_of(" \t");
+        std::string_view op = assembly.substr(0, split);
+        if (op.substr(0, 2) == "c.") {
+            op.remove_prefix(2);
+            ins.size = 2;
+        }
+
+        std::vector<std::string_view> operands;
+        if (split != std::string_view::npos) {
+            std::string_view rest = assembly.substr(split + 1);
+            rest = rest.substr(0, rest.find_first_of("<#"));
+            while (!rest.empty()) {
+                const size_t comma = rest.find(',');
+                std::string_view operand = rest.substr(0, comma);
+                while (!operand.empty() && std::isspace(static_cast<unsigned char>(operand.front()))) operand.remove_prefix(1);
+                while (!operand.empty() && std::isspace(static_cast<unsigned char>(operand.back()))) operand.remove_suffix(1);
+                if (!operand.empty()) operands.push_back(operand);
+                if (comma == std::string_view::npos) break;
+                rest.remove_prefix(comma + 1);
+            }
+        }
+        auto target = [&operands]() {
+            return operands.empty() ? 0 : std::strtoull(std::string(operands.back()).c_str(), nullptr, 16);
+        };
+        auto any_of = [op](std::initializer_list<std::string_view> names) {
+            return std::find(names.begin(), names.end(), op) != names.end();
+        };
+
+        if (any_of({"beq", "bne", "blt", "bge", "bltu", "bgeu", "beqz", "bnez", "blez", "bgez",
+                    "bltz", "bgtz", "bgt", "ble", "bgtu", "bleu"})) {
+            ins.kind = ETraceInstruction::BRANCH;
+            ins.target = target();
+        } else if (any_of({"j", "tail"})) {
+            ins.kind = ETraceInstruction::JUMP;
+            ins.target = target();
+            ins.dest_reg = 0;
+        } else if (any_of({"jal", "call"})) {
+            ins.kind = ETraceInstruction::JUMP;
+            ins.target = target();
+            ins.dest_reg = operands.size() >= 2 ? registerNumber(operands[0]) : 1;
+        } else if (any_of({"jr", "ret", "mret", "sret", "uret", "dret"})) {
+            ins.kind = ETraceInstruction::INDIRECT;
+            ins.dest_reg = 0;
+        } else if (op == "jalr") {
+            ins.kind = ETraceInstruction::INDIRECT;
+            ins.dest_reg = operands.size() >= 2 ? registerNumber(operands[0]) : 1;
+        }
+        return ins;
+    }
+
+    // ABI or xN register name to its number (-1 if unknown)
+    static int registerNumber(std::string_view name) {
+        static const char* const ABI_NAMES[32] = {
+            "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+            "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+        };
+        for (int r = 0; r < 32; ++r) {
+            if (name == ABI_NAMES[r]) return r;
+        }
+        if (name == "fp") return 8;
+        if (name.size() >= 2 && name[0] == 'x') {
+            int r = std::atoi(std::string(name.substr(1)).c_str());
+            if (r >= 0 && r < 32) return r;
+        }
+        return -1;
+    }
+};
+
+namespace etrace {
+
+constexpr unsigned IADDRESS_LSB = 1;
+constexpr uint32_t FULL_BRANCH_MAP = 31;
+
+// Branch map width for a branch count (spec table; 0 = full 31-bit map)
+inline unsigned branchMapWidth(uint32_t branches) {
+    if (branches == 0) return FULL_BRANCH_MAP;
+    if (branches == 1) return 1;
+    if (branches <= 3) return 3;
+    if (branches <= 7) return 7;
+    if (branches <= 15) return 15;
+    return 31;
+}
+
+class PacketWriter {
+private:
+    std::vector<uint8_t> payload;
+    unsigned bits = 0;
+
+public:
+    void put(uint64_t value, unsigned width) {
+        for (unsigned i = 0; i < width; ++i, ++bits) {
+            if (bits % 8 == 0) payload.push_back(0);
+            payload.back() |= static_cast<uint8_t>(((value >> i) & 1) << (bits % 8));
+        }
+    }
+
+    // Last field: only the bits needed to sign-extend back to value
+    void putAddress(int64_t value) {
+        unsigned width = 1;
+        while (width < 64 && (value >> (width - 1)) != 0 && (value >> (width - 1)) != -1) ++width;
+        put(static_cast<uint64_t>(value), width);
+        const uint64_t sign = value < 0 ? 1 : 0;
+        while (bits % 8 != 0) put(sign, 1);
+    }
+
+    void appendTo(std::vector<uint8_t>& out) const {
+        out.push_back(static_cast<uint8_t>(payload.size()));
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+};
+
+class PacketReader {
+private:
+    const uint8_t* payload;
+    unsigned size_bits;
+    unsigned bits = 0;
+
+public:
+    PacketReader(const uint8_t* data, size_t size)
+        : payload(data), size_bits(static_cast<unsigned>(size * 8)) {}
+
+    uint64_t get(unsigned width) {
+        uint64_t value = 0;
+        for (unsigned i = 0; i < width && bits < size_bits; ++i, ++bits) {
+            value |= uint64_t((payload[bits / 8] >> (bits % 8)) & 1) << i;
+        }
+        return value;
+    }
+
+    // Remaining bits, sign-extended from the final one
+    int64_t getAddress() {
+        const unsigned width = std::min(size_bits - bits, 64u);
+        if (width == 0) return 0;
+        uint64_t value = get(width);
+        if (width < 64 && (value >> (width - 1)) & 1) value |= ~uint64_t(0) << width;
+        return static_cast<int64_t>(value);
+    }
+};
+
+}  // namespace etrace
+
+// Packet encoder over a known-good instruction stream (for synthetic tests)
+class ETraceEncoder {
+private:
+    const ETraceImage& image;
+    std::vector<uint8_t> packets;
+    bool have_prev = false;
+    bool sync_pending = false;
+    uint64_t prev_pc = 0;
+    uint64_t last_address = 0;
+    uint32_t branch_map = 0;
+    uint32_t branches = 0;
+
+    void sendSync(uint64_t pc, bool taken_branch) {
+        etrace::PacketWriter packet;
+        packet.put(3, 2);
+        packet.put(0, 2);
+        packet.put(taken_branch ? 0 : 1, 1);
+        packet.put(3, 2);  // Machine mode
+        packet.putAddress(static_cast<int64_t>(pc >> etrace::IADDRESS_LSB));
+        packet.appendTo(packets);
+        last_address = pc;
+    }
+
+    void sendAddress(uint64_t pc) {
+        etrace::PacketWriter packet;
+        if (branches) {
+            packet.put(1, 2);
+            packet.put(branches, 5);
+            packet.put(branch_map, etrace::branchMapWidth(branches));
+        } else {
+            packet.put(2, 2);
+        }
+        packet.putAddress(static_cast<int64_t>(pc - last_address) >> etrace::IADDRESS_LSB);
+        packet.appendTo(packets);
+        last_address = pc;
+        branch_map = branches = 0;
+    }
+
+    void addBranch(bool taken) {
+        branch_map |= uint32_t(taken ? 0 : 1) << branches;
+        if (++branches == etrace::FULL_BRANCH_MAP) {
+            etrace::PacketWriter packet;
+            packet.put(1, 2);
+            packet.put(0, 5);
+            packet.put(branch_map, etrace::FULL_BRANCH_MAP);
+            packet.appendTo(packets);
+            branch_map = branches = 0;
+        }
+    }
+
+public:
+    explicit ETraceEncoder(const ETraceImage& img) : image(img) {}
+
+    void retire(uint64_t pc) {
+        if (!have_prev) {
+            have_prev = sync_pending = true;
+            prev_pc = pc;
+            return;
+        }
+
+        // The previous instruction's outcome is known now
+        static const ETraceInstruction plain;
+        const ETraceInstruction* ins = image.find(prev_pc);
+        if (!ins) ins = &plain;
+        const bool is_branch = ins->kind == ETraceInstruction::BRANCH;
+        const bool taken = pc != prev_pc + ins->size;
+        if (sync_pending) {
+            sendSync(prev_pc, is_branch && taken);
+            sync_pending = false;
+        } else if (is_branch) {
+            addBranch(taken);
+        }
+        if (ins->kind == ETraceInstruction::INDIRECT) {
+            sendAddress(pc);
+        }
+        prev_pc = pc;
+    }
+
+    // Stop the trace: reports the last instruction and returns every packet
+    std::vector<uint8_t> finish() {
+        if (have_prev) {
+            if (sync_pending) {
+                sendSync(prev_pc, false);
+            } else {
+                sendAddress(prev_pc);
+            }
+        }
+        have_prev = sync_pending = false;
+        return std::move(packets);
+    }
+};
+
+// Rebuilds the instruction stream of one complete trace
+class ETraceDecoder {
+public:
+    static constexpr size_t DEFAULT_BATCH = 4096;
+    static constexpr uint64_t MAX_INFERRED_RUN = uint64_t(1) << 28;  // Instructions between packets
+
+private:
+    const ETraceImage& image;
+    std::string error_message;
+    uint64_t packets_decoded = 0;
+    uint64_t instructions_decoded = 0;
+
+    bool fail(const std::string& message, uint64_t pc) {
+        std::ostringstream out;
+        out << "E-Trace packet " << packets_decoded << ": " << message << " at 0x" << std::hex << pc;
+        error_message = out.str();
+        return false;
+    }
+
+public:
+    explicit ETraceDecoder(const ETraceImage& img) : image(img) {}
+
+    // sink(const RetireRecord* records, size_t count) receives the stream in
+    // order. Returns false on a malformed trace; error() says where.
+    template <typename Sink>
+    bool decode(const uint8_t* data, size_t size, Sink&& sink, size_t batch_size = DEFAULT_BATCH) {
+        std::vector<RetireRecord> batch;
+        batch.reserve(batch_size);
+        auto emit = [&](uint64_t pc, const ETraceInstruction& ins) {
+            const bool transfers = ins.kind != ETraceInstruction::PLAIN;
+            batch.push_back({pc, 0, 0, ins.dest_reg, static_cast<uint8_t>(transfers), 0, 0, 0});
+            ++instructions_decoded;
+            if (batch.size() == batch_size) {
+                sink(batch.data(), batch.size());
+                batch.clear();
+            }
+        };
+
+        error_message.clear();
+        std::vector<uint8_t> outcomes;   // Pending branch map bits (1 = not taken)
+        size_t next_outcome = 0;
+        bool synced = false;
+        uint64_t pc = 0;
+        uint64_t last_address = 0;
+
+        size_t pos = 0;
+        while (pos < size) {
+            const size_t length = data[pos];
+            if (length == 0 || pos + 1 + length > size) return fail("truncated packet", pc);
+            etrace::PacketReader packet(data + pos + 1, length);
+            pos += 1 + length;
+            const bool final_packet = pos == size;
+            ++packets_decoded;
+
+            const uint64_t format = packet.get(2);
+            if (format == 3) {
+                if (packet.get(2) != 0) return fail("unsupported sync subformat", pc);
+                const bool taken_branch = packet.get(1) == 0;
+                packet.get(2);  // Privilege
+                pc = last_address = static_cast<uint64_t>(packet.getAddress()) << etrace::IADDRESS_LSB;
+                const ETraceInstruction* ins = image.find(pc);
+                if (!ins) return fail("sync address not in image", pc);
+                emit(pc, *ins);
+                outcomes.clear();
+                next_outcome = 0;
+                if (ins->kind == ETraceInstruction::BRANCH) outcomes.push_back(taken_branch ? 0 : 1);
+                synced = true;
+                continue;
+            }
+            if (!synced) return fail("no sync before trace data", pc);
+            if (format == 0) return fail("unsupported extension packet", pc);
+
+            if (format == 1) {
+                const uint32_t branches = static_cast<uint32_t>(packet.get(5));
+                const uint64_t map = packet.get(etrace::branchMapWidth(branches));
+                const uint32_t count = branches ? branches : etrace::FULL_BRANCH_MAP;
+                for (uint32_t b = 0; b < count; ++b) outcomes.push_back((map >> b) & 1);
+                if (branches == 0) continue;  // Full map: no address
+            }
+            const uint64_t address = last_address +
+                (static_cast<uint64_t>(packet.getAddress()) << etrace::IADDRESS_LSB);
+            last_address = address;
+
+            // Follow static control flow: up to the uninferable jump this
+            // packet resolves, or for the final packet up to its address
+            for (uint64_t steps = 0;; ++steps) {
+                if (final_packet && pc == address && next_outcome == outcomes.size()) break;
+                if (steps == MAX_INFERRED_RUN) return fail("no packet for too long", pc);
+                const ETraceInstruction* ins = image.find(pc);
+                if (!ins) return fail("execution left the image", pc);
+
+                uint64_t next = pc + ins->size;
+                bool resolved = false;
+                switch (ins->kind) {
+                    case ETraceInstruction::PLAIN:
+                        break;
+                    case ETraceInstruction::JUMP:
+                        next = ins->target;
+                        break;
+                    case ETraceInstruction::BRANCH:
+                        if (next_outcome == outcomes.size()) return fail("branch map exhausted", pc);
+                        if (outcomes[next_outcome++] == 0) next = ins->target;
+                        break;
+                    case ETraceInstruction::INDIRECT:
+                        if (final_packet) return fail("trace stopped beyond an uninferable jump", pc);
+                        if (next_outcome != outcomes.size()) return fail("uninferable jump with branches pending", pc);
+                        next = address;
+                        resolved = true;
+                        break;
+                }
+
+                const ETraceInstruction* next_ins = image.find(next);
+                if (!next_ins) return fail("execution left the image", next);
+                pc = next;
+                emit(pc, *next_ins);
+                if (resolved) break;
+            }
+            outcomes.erase(outcomes.begin(), outcomes.begin() + next_outcome);
+            next_outcome = 0;
+        }
+
+        if (!batch.empty()) sink(batch.data(), batch.size());
+        return true;
+    }
+
+    template <typename Sink>
+    bool decode(const std::vector<uint8_t>& trace, Sink&& sink, size_t batch_size = DEFAULT_BATCH) {
+        return decode(trace.data(), trace.size(), std::forward<Sink>(sink), batch_size);
+    }
+
+    // Feed a whole trace through the simulator interface's batched retire path
+    template <typename Policy>
+    bool decode(const std::vector<uint8_t>& trace, BasicSimulatorInterface<Policy>& sim) {
+        return decode(trace.data(), trace.size(), [&sim](const RetireRecord* records, size_t count) {
+            sim.onRetireBatch(records, count);
+        });
+    }
+
+    const std::string& error() const { return error_message; }
+    uint64_t packetsDecoded() const { return packets_decoded; }
+    uint64_t instructionsDecoded() const { return instructions_decoded; }
+};
+
+#endif // ETRACE_DECODER_HPP
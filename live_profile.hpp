@@ -0,0 +1,443 @@
+// live_profile.hpp - Live per-function profiles over a Unix domain socket
+//
+// LiveProfileServer takes the generator's periodic snapshots (see
+// CallgrindGenerator::setSnapshotSink) and answers viewers such as prof_top
+// on a local socket while the run goes on. Snapshots are triple-buffered:
+// the recording thread swaps its filled buffer into the ready slot and the
+// server thread swaps the ready slot into its own, each under a lock held
+// for the swap only, so recording never waits for a viewer. The recorder
+// only copies its per-PC cost columns; the server thread folds them into
+// functions.
+//
+//   LiveProfileServer live("/tmp/sim.prof");
+//   live.start();
+//   live.attach(generator, 1000000);   // Publish every 1M records
+//
+// Protocol: a viewer sends one byte per request and gets one frame with
+// the per-function self costs that changed since its previous request.
+// After the little-endian u32 frame length, every field is a LEB128 varint
+// except magic, version and flags:
+//   u32 magic "CGLV", u8 version, u8 flags (FULL: drop previous state)
+//   sequence, instructions
+//   event count, first new event, then each new name (length, bytes)
+//   function count, first new function, then each new name
+//   changed rows, then per row: fn_id - (previous fn_id + 1) and one cost
+//   delta per event
+// Frames are FULL on a viewer's first request, after reset() and after the
+// events change; names and costs then start from zero.
+#ifndef LIVE_PROFILE_HPP
+#define LIVE_PROFILE_HPP
+
+#include "test2.cpp"
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace live_profile {
+
+constexpr uint32_t MAGIC = 0x564c4743;  // "CGLV"
+constexpr uint8_t VERSION = 1;
+constexpr uint8_t FULL = 1;
+constexpr uint32_t MAX_FRAME = 1u << 30;
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline void putU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+inline void putName(std::vector<uint8_t>& out, const std::string& name) {
+    putVarint(out, name.size());
+    out.insert(out.end(), name.begin(), name.end());
+}
+
+// Bounds-checked reader over one frame
+class FrameReader {
+private:
+    const uint8_t* pos;
+    const uint8_t* end;
+
+public:
+    FrameReader(const uint8_t* data, size_t size) : pos(data), end(data + size) {}
+
+    bool byte(uint8_t& value) {
+        if (pos == end) return false;
+        value = *pos++;
+        return true;
+    }
+
+    bool u32(uint32_t& value) {
+        if (end - pos < 4) return false;
+        value = 0;
+        for (int shift = 0; shift < 32; shift += 8) value |= uint32_t(*pos++) << shift;
+        return true;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos != end; shift += 7) {
+            const uint8_t b = *pos++;
+            value |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool name(std::string& value) {
+        uint64_t size = 0;
+        if (!varint(size) || size > uint64_t(end - pos)) return false;
+        value.assign(reinterpret_cast<const char*>(pos), size);
+        pos += size;
+        return true;
+    }
+
+    bool done() const {
+        return pos == end;
+    }
+};
+
+inline bool writeAll(int fd, const uint8_t* data, size_t size) {
+    while (size) {
+        const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool readAll(int fd, uint8_t* data, size_t size) {
+    while (size) {
+        const ssize_t n = ::recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool socketAddress(const std::string& path, sockaddr_un& addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Bad socket path: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+}  // namespace live_profile
+
+class LiveProfileServer {
+private:
+    // What one viewer has been sent
+    struct Viewer {
+        int fd = -1;
+        bool synced = false;
+        uint64_t run = 0;
+        std::shared_ptr<const std::vector<std::string>> events;
+        size_t functions_sent = 0;
+        std::vector<uint64_t> sent;     // Costs as of the last frame, per fn_id row
+    };
+
+    std::string socket_path;
+    int listen_fd;
+    int wake_fds[2];
+    std::thread server;
+
+    std::mutex ready_mutex;
+    ProfileSnapshot ready;              // Latest published, guarded by ready_mutex
+    bool have_ready;
+    ProfileSnapshot current;            // Server thread only
+
+    std::vector<Viewer> viewers;
+    std::vector<uint8_t> frame;
+    std::vector<uint8_t> rows;
+
+    void takeReady() {
+        {
+            std::lock_guard<std::mutex> lock(ready_mutex);
+            if (!have_ready) return;
+            std::swap(current, ready);
+            have_ready = false;
+        }
+        current.fold();  // Per-PC columns to per-function rows, off the recording thread
+    }
+
+    void encode(Viewer& viewer) {
+        using namespace live_profile;
+        frame.clear();
+        putU32(frame, 0);
+        putU32(frame, MAGIC);
+        const bool have = current.events && current.functions;
+        const bool full = have && (!viewer.synced || viewer.run != current.run ||
+                                   *viewer.events != *current.events);
+        frame.push_back(VERSION);
+        frame.push_back(full ? FULL : 0);
+        putVarint(frame, current.sequence);
+        putVarint(frame, current.instructions);
+        if (!have) {
+            for (int i = 0; i < 5; ++i) putVarint(frame, 0);  // No snapshot yet
+        } else {
+            if (full) {
+                viewer.synced = true;
+                viewer.run = current.run;
+                viewer.events = current.events;
+                viewer.functions_sent = 0;
+                viewer.sent.clear();
+            }
+            const std::vector<std::string>& events = *current.events;
+            const std::vector<std::string>& functions = *current.functions;
+            putVarint(frame, events.size());
+            putVarint(frame, full ? 0 : events.size());
+            if (full) {
+                for (const std::string& name : events) putName(frame, name);
+            }
+            putVarint(frame, functions.size());
+            putVarint(frame, viewer.functions_sent);
+            for (size_t f = viewer.functions_sent; f < functions.size(); ++f) putName(frame, functions[f]);
+            viewer.functions_sent = functions.size();
+
+            const size_t stride = events.size();
+            viewer.sent.resize(current.costs.size(), 0);
+            uint64_t changed = 0;
+            uint64_t next_row = 0;
+            rows.clear();
+            for (size_t row = 0; stride != 0 && row < functions.size(); ++row) {
+                const uint64_t* now = current.costs.data() + row * stride;
+                uint64_t* sent = viewer.sent.data() + row * stride;
+                if (std::equal(now, now + stride, sent)) continue;
+                putVarint(rows, row - next_row);
+                for (size_t i = 0; i < stride; ++i) putVarint(rows, now[i] - sent[i]);
+                std::copy(now, now + stride, sent);
+                next_row = row + 1;
+                ++changed;
+            }
+            putVarint(frame, changed);
+            frame.insert(frame.end(), rows.begin(), rows.end());
+        }
+        const uint32_t length = static_cast<uint32_t>(frame.size() - 4);
+        for (int shift = 0; shift < 32; shift += 8) frame[shift / 8] = static_cast<uint8_t>(length >> shift);
+    }
+
+    void serve() {
+        std::vector<pollfd> fds;
+        for (;;) {
+            fds.assign({{wake_fds[0], POLLIN, 0}, {listen_fd, POLLIN, 0}});
+            for (const Viewer& viewer : viewers) fds.push_back({viewer.fd, POLLIN, 0});
+            if (::poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Live profile poll failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            if (fds[0].revents) return;
+            if (fds[1].revents & POLLIN) {
+                const int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd >= 0) {
+                    viewers.emplace_back();
+                    viewers.back().fd = fd;
+                }
+            }
+            // Viewers polled this round; accepted ones are after them
+            for (size_t v = fds.size() - 2; v-- > 0;) {
+                if (!fds[v + 2].revents) continue;
+                uint8_t requests[64];
+                const ssize_t n = ::recv(viewers[v].fd, requests, sizeof(requests), 0);
+                bool alive = n > 0;
+                for (ssize_t r = 0; r < n && alive; ++r) {
+                    takeReady();
+                    encode(viewers[v]);
+                    alive = live_profile::writeAll(viewers[v].fd, frame.data(), frame.size());
+                }
+                if (!alive) {
+                    ::close(viewers[v].fd);
+                    viewers.erase(viewers.begin() + v);
+                }
+            }
+        }
+    }
+
+public:
+    explicit LiveProfileServer(const std::string& path)
+        : socket_path(path), listen_fd(-1), wake_fds{-1, -1}, have_ready(false) {}
+
+    ~LiveProfileServer() {
+        stop();
+    }
+
+    LiveProfileServer(const LiveProfileServer&) = delete;
+    LiveProfileServer& operator=(const LiveProfileServer&) = delete;
+
+    // Listen on the socket path (an existing socket file is replaced)
+    bool start() {
+        if (server.joinable()) return true;
+        sockaddr_un addr;
+        if (!live_profile::socketAddress(socket_path, addr)) return false;
+        ::unlink(socket_path.c_str());
+        listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listen_fd, 8) != 0 || ::pipe(wake_fds) != 0) {
+            std::cerr << "Failed to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+            stop();
+            return false;
+        }
+        server = std::thread(&LiveProfileServer::serve, this);
+        return true;
+    }
+
+    // Close every connection and remove the socket file
+    void stop() {
+        if (server.joinable()) {
+            const uint8_t wake = 0;
+            while (::write(wake_fds[1], &wake, 1) < 0 && errno == EINTR) {}
+            server.join();
+        }
+        for (const Viewer& viewer : viewers) ::close(viewer.fd);
+        viewers.clear();
+        for (int* fd : {&listen_fd, &wake_fds[0], &wake_fds[1]}) {
+            if (*fd >= 0) ::close(*fd);
+            *fd = -1;
+        }
+        ::unlink(socket_path.c_str());
+    }
+
+    // Snapshot sink: swap the filled buffer in, hand back the previous one
+    void publish(ProfileSnapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(ready_mutex);
+        std::swap(ready, snapshot);
+        have_ready = true;
+    }
+
+    template <typename Generator>
+    void attach(Generator& generator, uint64_t interval_instructions) {
+        generator.setSnapshotSink([this](ProfileSnapshot& snapshot) { publish(snapshot); }, interval_instructions);
+    }
+};
+
+// Viewer side: per-function totals kept up to date from delta frames
+class LiveProfileClient {
+private:
+    int fd;
+    uint64_t sequence_;
+    uint64_t instructions_;
+    std::vector<std::string> event_names;
+    std::vector<std::string> function_names;
+    std::vector<uint64_t> totals_;
+    std::vector<uint64_t> deltas_;   // Change in the last update, same layout
+    std::vector<uint8_t> frame;
+
+    bool apply() {
+        using namespace live_profile;
+        FrameReader in(frame.data(), frame.size());
+        uint32_t magic = 0;
+        uint8_t version = 0, flags = 0;
+        uint64_t event_count = 0, first_event = 0, function_count = 0, first_function = 0, rows = 0;
+        if (!in.u32(magic) || magic != MAGIC || !in.byte(version) || version != VERSION || !in.byte(flags) ||
+            !in.varint(sequence_) || !in.varint(instructions_) ||
+            !in.varint(event_count) || !in.varint(first_event) || first_event > event_count) return false;
+        if (flags & FULL) {
+            event_names.clear();
+            function_names.clear();
+            totals_.clear();
+        }
+        if (first_event != event_names.size() && first_event != event_count) return false;
+        event_names.resize(first_event);
+        for (uint64_t e = first_event; e < event_count; ++e) {
+            event_names.emplace_back();
+            if (!in.name(event_names.back())) return false;
+        }
+        if (!in.varint(function_count) || !in.varint(first_function) ||
+            first_function != function_names.size() || function_count < first_function) return false;
+        for (uint64_t f = first_function; f < function_count; ++f) {
+            function_names.emplace_back();
+            if (!in.name(function_names.back())) return false;
+        }
+        const size_t stride = event_names.size();
+        totals_.resize(function_names.size() * stride, 0);
+        deltas_.assign(totals_.size(), 0);
+        if (!in.varint(rows)) return false;
+        uint64_t row = 0;
+        for (uint64_t r = 0; r < rows; ++r) {
+            uint64_t gap = 0;
+            if (!in.varint(gap) || gap >= function_names.size() - row) return false;
+            row += gap;
+            for (size_t i = 0; i < stride; ++i) {
+                uint64_t delta = 0;
+                if (!in.varint(delta)) return false;
+                deltas_[row * stride + i] = delta;
+                totals_[row * stride + i] += delta;
+            }
+            ++row;
+        }
+        return in.done();
+    }
+
+public:
+    LiveProfileClient() : fd(-1), sequence_(0), instructions_(0) {}
+
+    ~LiveProfileClient() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    LiveProfileClient(const LiveProfileClient&) = delete;
+    LiveProfileClient& operator=(const LiveProfileClient&) = delete;
+
+    bool connect(const std::string& path) {
+        sockaddr_un addr;
+        if (!live_profile::socketAddress(path, addr)) return false;
+        if (fd >= 0) ::close(fd);
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "Failed to connect to " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Request the changes since the previous update; false once the server is gone
+    bool update() {
+        const uint8_t request = 'd';
+        uint8_t header[4];
+        if (fd < 0 || !live_profile::writeAll(fd, &request, 1) || !live_profile::readAll(fd, header, 4)) return false;
+        const uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | uint32_t(header[3]) << 24;
+        if (length > live_profile::MAX_FRAME) return false;
+        frame.resize(length);
+        if (!live_profile::readAll(fd, frame.data(), length)) return false;
+        if (!apply()) {
+            std::cerr << "Malformed live profile frame" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t sequence() const { return sequence_; }
+    uint64_t instructions() const { return instructions_; }
+    const std::vector<std::string>& events() const { return event_names; }
+    const std::vector<std::string>& functions() const { return function_names; }
+
+    // Costs of function row fn (fn_id) for event ID event
+    uint64_t total(size_t fn, size_t event) const {
+        return totals_[fn * event_names.size() + event];
+    }
+
+    uint64_t delta(size_t fn, size_t event) const {
+        return deltas_[fn * event_names.size() + event];
+    }
+};
+
+#endif // LIVE_PROFILE_HPP
@@ -0,0 +1,105 @@
+// prof_top.cpp - top-like viewer of a live profile (see live_profile.hpp)
+//
+//   g++ -std=c++17 -O2 prof_top.cpp -o prof_top -lpthread
+//   ./prof_top /tmp/sim.prof [-e Cycle] [-n 20] [-i 1.0] [-b]
+//
+// Every interval the functions are ranked by the event's growth since the
+// previous refresh; totals are cumulative. -b (batch) prints refreshes one
+// after another instead of redrawing the terminal.
+
+#include "live_profile.hpp"
+
+#include <iomanip>
+
+namespace {
+
+void usage() {
+    std::cerr << "usage: prof_top <socket> [-e event] [-n rows] [-i seconds] [-b]" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    const std::string path = argv[1];
+    std::string event_name = "Ir";
+    size_t top_n = 20;
+    double interval_s = 1.0;
+    bool batch = false;
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "-b") {
+            batch = true;
+        } else if (i + 1 < argc && arg == "-e") {
+            event_name = argv[++i];
+        } else if (i + 1 < argc && arg == "-n") {
+            top_n = std::strtoul(argv[++i], nullptr, 10);
+        } else if (i + 1 < argc && arg == "-i") {
+            interval_s = std::max(std::strtod(argv[++i], nullptr), 0.05);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    LiveProfileClient client;
+    if (!client.connect(path)) return 1;
+
+    // The first update is the baseline for the first interval's rates
+    if (!client.update()) return 1;
+    uint64_t last_instructions = client.instructions();
+    auto last_time = std::chrono::steady_clock::now();
+    std::vector<size_t> order;
+    std::this_thread::sleep_for(std::chrono::duration<double>(interval_s));
+    while (client.update()) {
+        const auto now = std::chrono::steady_clock::now();
+        const double elapsed_s = std::chrono::duration<double>(now - last_time).count();
+        last_time = now;
+
+        const auto& events = client.events();
+        const auto found = std::find(events.begin(), events.end(), event_name);
+        const size_t event = found - events.begin();
+        if (!batch) std::cout << "\033[H\033[2J";
+        std::cout << path << "  snapshot " << client.sequence() << "  " << client.instructions() << " instructions";
+        if (client.instructions() >= last_instructions && elapsed_s > 0) {
+            std::cout << "  " << std::fixed << std::setprecision(2)
+                      << (client.instructions() - last_instructions) / elapsed_s / 1e6 << " M/s";
+        }
+        std::cout << "\n";
+        last_instructions = client.instructions();
+
+        if (found == events.end()) {
+            std::cout << "waiting for event " << event_name << "\n";
+        } else {
+            uint64_t total = 0, delta = 0;
+            order.clear();
+            for (size_t fn = 0; fn < client.functions().size(); ++fn) {
+                total += client.total(fn, event);
+                delta += client.delta(fn, event);
+                if (client.total(fn, event)) order.push_back(fn);
+            }
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                if (client.delta(a, event) != client.delta(b, event)) return client.delta(a, event) > client.delta(b, event);
+                return client.total(a, event) > client.total(b, event);
+            });
+            if (order.size() > top_n) order.resize(top_n);
+
+            std::cout << "\n" << std::setw(14) << (event_name + "/s") << std::setw(8) << "%"
+                      << std::setw(18) << event_name << std::setw(8) << "tot%" << "  function\n";
+            for (size_t fn : order) {
+                std::cout << std::setw(14) << std::setprecision(0) << client.delta(fn, event) / std::max(elapsed_s, 1e-9)
+                          << std::setw(7) << std::setprecision(1) << (delta ? 100.0 * client.delta(fn, event) / delta : 0.0) << "%"
+                          << std::setw(18) << client.total(fn, event)
+                          << std::setw(7) << (total ? 100.0 * client.total(fn, event) / total : 0.0) << "%"
+                          << "  " << client.functions()[fn] << "\n";
+            }
+        }
+        std::cout << std::flush;
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval_s));
+    }
+    std::cout << "connection closed" << std::endl;
+    return 0;
+}
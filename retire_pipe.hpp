@@ -0,0 +1,134 @@
+// retire_pipe.hpp - Hand-off of retire records from a simulation thread to a profiling thread
+//
+// The simulation side fills fixed-size chunks in place and publishes each
+// one when it is full, so the shared indices and the wakeup are touched
+// once per CHUNK_RECORDS records. A host thread passes every chunk to the
+// sink (e.g. SimulatorInterface::onRetireBatch) in order. When all chunks
+// are in flight the producer waits: records are never dropped.
+
+#ifndef RETIRE_PIPE_HPP
+#define RETIRE_PIPE_HPP
+
+#include "test2.cpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class RetirePipe {
+public:
+    using Sink = std::function<void(const RetireRecord*, size_t)>;
+    static constexpr size_t CHUNK_RECORDS = 1024;
+    static constexpr size_t DEFAULT_CHUNKS = 64;
+
+private:
+    struct Chunk {
+        RetireRecord records[CHUNK_RECORDS];
+        size_t count = 0;
+    };
+
+    Sink sink;
+    std::vector<Chunk> chunks;
+    std::atomic<uint64_t> published;   // Chunks handed to the host thread
+    std::atomic<uint64_t> consumed;    // Chunks the sink has finished
+    std::atomic<bool> closing;
+    Chunk* current;                    // Producer's chunk being filled (null = none claimed)
+    uint64_t producer_waits;
+
+    std::mutex mutex;
+    std::condition_variable ready;     // Host thread: a chunk was published or closing
+    std::condition_variable space;     // Producer: a chunk was consumed
+    std::thread host;
+
+    void drain() {
+        uint64_t next = 0;
+        for (;;) {
+            if (next == published.load(std::memory_order_acquire)) {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] {
+                    return next != published.load(std::memory_order_acquire) ||
+                           closing.load(std::memory_order_acquire);
+                });
+                if (next == published.load(std::memory_order_acquire)) return;  // Closed and drained
+            }
+            const Chunk& chunk = chunks[next % chunks.size()];
+            sink(chunk.records, chunk.count);
+            consumed.store(++next, std::memory_order_release);
+            std::lock_guard<std::mutex> lock(mutex);
+            space.notify_one();
+        }
+    }
+
+    // Claim the next free chunk, waiting for the host thread if all are in flight
+    void claim() {
+        const uint64_t index = published.load(std::memory_order_relaxed);
+        if (index - consumed.load(std::memory_order_acquire) == chunks.size()) {
+            ++producer_waits;
+            std::unique_lock<std::mutex> lock(mutex);
+            space.wait(lock, [&] {
+                return index - consumed.load(std::memory_order_acquire) < chunks.size();
+            });
+        }
+        current = &chunks[index % chunks.size()];
+        current->count = 0;
+    }
+
+    void publish() {
+        published.fetch_add(1, std::memory_order_release);
+        current = nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.notify_one();
+    }
+
+public:
+    explicit RetirePipe(Sink chunk_sink, size_t num_chunks = DEFAULT_CHUNKS)
+        : sink(std::move(chunk_sink)),
+          chunks(std::max<size_t>(num_chunks, 2)),
+          published(0),
+          consumed(0),
+          closing(false),
+          current(nullptr),
+          producer_waits(0),
+          host(&RetirePipe::drain, this) {}
+
+    ~RetirePipe() {
+        close();
+    }
+
+    RetirePipe(const RetirePipe&) = delete;
+    RetirePipe& operator=(const RetirePipe&) = delete;
+
+    // Simulation thread only
+    inline void push(const RetireRecord& record) {
+        if (!current) claim();
+        current->records[current->count++] = record;
+        if (current->count == CHUNK_RECORDS) publish();
+    }
+
+    // Publish a partly filled chunk (e.g. before a checkpoint)
+    void flush() {
+        if (current && current->count) publish();
+    }
+
+    // Flush, wait until the sink has seen every record and stop the host
+    // thread. The sink's target may be read once this returns.
+    void close() {
+        if (!host.joinable()) return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing.store(true, std::memory_order_release);
+        }
+        ready.notify_one();
+        host.join();
+    }
+
+    // Times the simulation waited for the host thread (sink too slow)
+    uint64_t producerWaits() const {
+        return producer_waits;
+    }
+};
+
+#endif // RETIRE_PIPE_HPP
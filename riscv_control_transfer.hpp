@@ -0,0 +1,39 @@
+// riscv_control_transfer.hpp - Control transfers from RISC-V instruction words
+//
+// Shared by the front-ends that see encodings rather than objdump text:
+// the SystemC sampler (through test2.cpp) and the DPI-C monitor, which
+// builds without the generator.
+
+#ifndef RISCV_CONTROL_TRANSFER_HPP
+#define RISCV_CONTROL_TRANSFER_HPP
+
+#include <cstdint>
+
+// Control transfer in a RISC-V instruction word (compressed ones in the low
+// half). link_reg is the register a jal/jalr writes (-1 for none and for
+// branches). c.jal exists on RV32 only; on RV64 the same encoding is c.addiw.
+struct ControlTransfer {
+    bool is_transfer;
+    int link_reg;
+};
+
+inline ControlTransfer decodeControlTransfer(uint32_t insn, bool rv32) {
+    if ((insn & 3) == 3) {
+        const uint32_t opcode = insn & 0x7f;
+        const int rd = static_cast<int>((insn >> 7) & 0x1f);
+        if (opcode == 0x6f || opcode == 0x67) return {true, rd ? rd : -1};  // JAL, JALR
+        return {opcode == 0x63, -1};                                        // BRANCH
+    }
+    const uint32_t quadrant = insn & 3;
+    const uint32_t funct3 = (insn >> 13) & 7;
+    if (quadrant == 1) {
+        if (funct3 == 1 && rv32) return {true, 1};                          // c.jal (c.addiw on RV64)
+        return {funct3 == 5 || funct3 == 6 || funct3 == 7, -1};             // c.j, c.beqz, c.bnez
+    }
+    if (quadrant == 2 && funct3 == 4 && ((insn >> 2) & 0x1f) == 0 && ((insn >> 7) & 0x1f) != 0) {
+        return {true, (insn >> 12) & 1 ? 1 : -1};                           // c.jalr, c.jr
+    }
+    return {false, -1};
+}
+
+#endif // RISCV_CONTROL_TRANSFER_HPP
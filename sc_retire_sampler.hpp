@@ -0,0 +1,97 @@
+// sc_retire_sampler.hpp - SystemC sampler feeding a Verilated core's retire port to the profiler
+//
+// Alternative to the DPI bridge (simprof_dpi.sv) that leaves the RTL
+// untouched: bind the ports to the core's retire signals in sc_main, as in
+// tb_counter.cpp.
+//
+//   RetireSampler<sc_dt::sc_uint<64>> sampler("sampler", "callgrind.out.rtl", "firmware.dis");
+//   sampler.clk(clk);
+//   sampler.rst_n(rst_n);
+//   sampler.retire_valid(dut->retire_valid);
+//   sampler.retire_pc(dut->retire_pc);
+//   sampler.retire_insn(dut->retire_insn);
+//
+// Sampling is an SC_METHOD on the rising clock edge, so there is no thread
+// context switch per cycle; it stores the record into a RetirePipe chunk
+// and a host thread runs the profiler on full chunks in parallel with the
+// simulation. The profile is written at end of simulation.
+
+#ifndef SC_RETIRE_SAMPLER_HPP
+#define SC_RETIRE_SAMPLER_HPP
+
+#include <systemc.h>
+
+#include "test2.cpp"
+#include "retire_pipe.hpp"
+
+// PcT/InsnT match the Verilated port types (sc_uint<N> or plain integers
+// with --pins-sc-uint-bool, verilate_rtl.sh's default, or without)
+template <typename PcT = sc_dt::sc_uint<64>, typename InsnT = sc_dt::sc_uint<32>,
+          typename Policy = DefaultGeneratorPolicy>
+class RetireSampler : public sc_core::sc_module {
+public:
+    sc_core::sc_in<bool> clk;
+    sc_core::sc_in<bool> rst_n;
+    sc_core::sc_in<bool> retire_valid;
+    sc_core::sc_in<PcT> retire_pc;
+    sc_core::sc_in<InsnT> retire_insn;    // Compressed instructions in the low half
+
+    SC_HAS_PROCESS(RetireSampler);
+
+    RetireSampler(sc_core::sc_module_name name, const std::string& output_file,
+                  const std::string& objdump_file, bool rv32 = false)
+        : sc_core::sc_module(name),
+          sim(output_file),
+          pipe([this](const RetireRecord* records, size_t count) { sim.onRetireBatch(records, count); }),
+          rv32(rv32),
+          cycle(0) {
+        if (!sim.loadObjdumpFile(objdump_file)) {
+            SC_REPORT_WARNING("RetireSampler", "no firmware image, samples go to \"unknown\"");
+        }
+        SC_METHOD(sample);
+        sensitive << clk.pos();
+        dont_initialize();
+    }
+
+    // Cycles sampled so far (since the last reset)
+    uint64_t cycles() const {
+        return cycle;
+    }
+
+    // Times sampling waited for the profiler thread; nonzero means the
+    // profiler, not the simulation, set the pace
+    uint64_t profilerStalls() const {
+        return pipe.producerWaits();
+    }
+
+protected:
+    void end_of_simulation() override {
+        pipe.close();
+        sim.finalize();
+    }
+
+private:
+    BasicSimulatorInterface<Policy> sim;  // Touched by the pipe's host thread until it is closed
+    RetirePipe pipe;
+    bool rv32;
+    uint64_t cycle;
+
+    void sample() {
+        if (!rst_n.read()) {
+            cycle = 0;
+            return;
+        }
+        ++cycle;
+        if (!retire_valid.read()) return;
+
+        const ControlTransfer transfer = decodeControlTransfer(static_cast<uint32_t>(retire_insn.read()), rv32);
+        RetireRecord record{};
+        record.pc = static_cast<uint64_t>(retire_pc.read());
+        record.timestamp = cycle;
+        record.dest_reg = transfer.link_reg;
+        record.is_branch = transfer.is_transfer;
+        pipe.push(record);
+    }
+};
+
+#endif // SC_RETIRE_SAMPLER_HPP
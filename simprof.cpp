@@ -0,0 +1,300 @@
+// simprof.cpp - C ABI of simprof.h over BasicSimulatorInterface
+//
+//   g++ -std=c++17 -O2 -fPIC -shared -fvisibility=hidden -Wl,--version-script=simprof.map simprof.cpp -o libsimprof.so
+
+#include "simprof.h"
+#include "test2.cpp"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+static_assert(sizeof(simprof_retire_record) == sizeof(RetireRecord), "simprof_retire_record must mirror RetireRecord");
+static_assert(offsetof(simprof_retire_record, timestamp) == offsetof(RetireRecord, timestamp), "simprof_retire_record layout");
+static_assert(offsetof(simprof_retire_record, blocking_pc) == offsetof(RetireRecord, blocking_pc), "simprof_retire_record layout");
+static_assert(offsetof(simprof_retire_record, dest_reg) == offsetof(RetireRecord, dest_reg), "simprof_retire_record layout");
+static_assert(offsetof(simprof_retire_record, is_branch) == offsetof(RetireRecord, is_branch), "simprof_retire_record layout");
+static_assert(offsetof(simprof_retire_record, is_vector) == offsetof(RetireRecord, is_vector), "simprof_retire_record layout");
+static_assert(offsetof(simprof_retire_record, vtype) == offsetof(RetireRecord, vtype), "simprof_retire_record layout");
+static_assert(offsetof(simprof_retire_record, vl) == offsetof(RetireRecord, vl), "simprof_retire_record layout");
+static_assert(EventRegistry::INVALID == SIMPROF_INVALID_EVENT, "invalid event IDs must match");
+
+// The handle hides which policy the interface was compiled for; dispatch
+// is one virtual call per batch
+struct simprof {
+    virtual ~simprof() = default;
+
+    virtual void loadImage(const simprof_image_entry* entries, size_t count) = 0;
+    virtual bool loadObjdumpFile(const std::string& path) = 0;
+    virtual uint32_t registerEvent(const std::string& name, const std::string& long_name) = 0;
+    virtual uint32_t eventId(const std::string& name) const = 0;
+    virtual bool setMemoryBudget(size_t budget_bytes, const std::string& spill_path) = 0;
+    virtual void enableVectorProfiling(uint32_t vlen_bits) = 0;
+
+    virtual bool record(const simprof_instruction_record* records, size_t count) = 0;
+    virtual bool addEvents(const simprof_event_record* records, size_t count) = 0;
+    virtual void retire(const simprof_retire_record* records, size_t count) = 0;
+
+    virtual bool dump() = 0;
+    virtual bool writeReport(const std::string& path, size_t top_n) = 0;
+    virtual bool writeLcov(const std::string& path, const std::string& test_name) = 0;
+    virtual void reset() = 0;
+
+    virtual uint64_t pcEvent(uint64_t pc, uint32_t event) const = 0;
+    virtual CallEdgeCost callEdge(uint64_t from_pc, uint64_t to_pc) const = 0;
+    virtual GeneratorStats stats() const = 0;
+};
+
+namespace {
+
+template <typename Policy>
+class Profiler final : public simprof {
+private:
+    BasicSimulatorInterface<Policy> sim;
+
+public:
+    explicit Profiler(const std::string& output_file) : sim(output_file) {}
+
+    void loadImage(const simprof_image_entry* entries, size_t count) override {
+        std::vector<std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>> image;
+        image.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            const simprof_image_entry& e = entries[i];
+            image.emplace_back(e.pc, e.function ? e.function : "", e.assembly ? e.assembly : "",
+                               e.file ? e.file : "", e.line);
+        }
+        sim.loadObjdumpData(image);
+    }
+
+    bool loadObjdumpFile(const std::string& path) override {
+        return sim.loadObjdumpFile(path);
+    }
+
+    uint32_t registerEvent(const std::string& name, const std::string& long_name) override {
+        return sim.registerEvent(name, long_name);
+    }
+
+    uint32_t eventId(const std::string& name) const override {
+        return sim.eventId(name);
+    }
+
+    bool setMemoryBudget(size_t budget_bytes, const std::string& spill_path) override {
+        return sim.setMemoryBudget(budget_bytes, spill_path);
+    }
+
+    void enableVectorProfiling(uint32_t vlen_bits) override {
+        sim.enableVectorProfiling(vlen_bits);
+    }
+
+    // A batch with an unregistered event ID is rejected before anything
+    // is counted
+    template <typename Record>
+    bool eventsRegistered(const char* what, const Record* records, size_t count) const {
+        const size_t events = sim.eventRegistry().size();
+        for (size_t i = 0; i < count; ++i) {
+            if (records[i].event >= events) {
+                std::cerr << "simprof: " << what << ": record " << i << " has unregistered event "
+                          << records[i].event << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool record(const simprof_instruction_record* records, size_t count) override {
+        if (!eventsRegistered("record", records, count)) return false;
+        for (size_t i = 0; i < count; ++i) {
+            const simprof_instruction_record& r = records[i];
+            sim.onInstruction(r.pc, r.event, r.count, r.dest_reg, r.is_branch != 0);
+        }
+        return true;
+    }
+
+    bool addEvents(const simprof_event_record* records, size_t count) override {
+        if (!eventsRegistered("add_events", records, count)) return false;
+        for (size_t i = 0; i < count; ++i) {
+            sim.onEvent(records[i].pc, records[i].event, records[i].count);
+        }
+        return true;
+    }
+
+    void retire(const simprof_retire_record* records, size_t count) override {
+        sim.onRetireBatch(reinterpret_cast<const RetireRecord*>(records), count);
+    }
+
+    bool dump() override { return sim.finalize(); }
+
+    bool writeReport(const std::string& path, size_t top_n) override {
+        return sim.writeReport(path, top_n);
+    }
+
+    bool writeLcov(const std::string& path, const std::string& test_name) override {
+        return sim.writeLcov(path, test_name);
+    }
+
+    void reset() override { sim.reset(); }
+
+    uint64_t pcEvent(uint64_t pc, uint32_t event) const override {
+        return sim.pcEvent(pc, event);
+    }
+
+    CallEdgeCost callEdge(uint64_t from_pc, uint64_t to_pc) const override {
+        return sim.callEdge(from_pc, to_pc);
+    }
+
+    GeneratorStats stats() const override { return sim.stats(); }
+};
+
+// Run fn, turning exceptions (allocation failures, mostly) into -1
+template <typename Fn>
+int guarded(const char* what, Fn&& fn) {
+    try {
+        return fn() ? 0 : -1;
+    } catch (const std::exception& e) {
+        std::cerr << "simprof: " << what << ": " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "simprof: " << what << ": unknown error" << std::endl;
+    }
+    return -1;
+}
+
+std::string str(const char* s) {
+    return s ? s : "";
+}
+
+}  // namespace
+
+extern "C" {
+
+uint32_t simprof_abi_version(void) {
+    return SIMPROF_ABI_VERSION;
+}
+
+simprof* simprof_create(const char* output_file, simprof_mode mode) {
+    const std::string path = output_file ? output_file : "callgrind.out.sim";
+    try {
+        switch (mode) {
+            case SIMPROF_MODE_FULL: return new Profiler<DefaultGeneratorPolicy>(path);
+            case SIMPROF_MODE_CALL_GRAPH: return new Profiler<CallGraphGeneratorPolicy>(path);
+            case SIMPROF_MODE_IR_ONLY: return new Profiler<IrOnlyGeneratorPolicy>(path);
+        }
+        std::cerr << "simprof: unknown mode " << static_cast<int>(mode) << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "simprof: create: " << e.what() << std::endl;
+    }
+    return nullptr;
+}
+
+void simprof_destroy(simprof* prof) {
+    delete prof;
+}
+
+int simprof_load_image(simprof* prof, const simprof_image_entry* entries, size_t count) {
+    if (!prof || (!entries && count)) return -1;
+    return guarded("load_image", [&] { prof->loadImage(entries, count); return true; });
+}
+
+int simprof_load_objdump(simprof* prof, const char* objdump_path) {
+    if (!prof || !objdump_path) return -1;
+    return guarded("load_objdump", [&] { return prof->loadObjdumpFile(objdump_path); });
+}
+
+uint32_t simprof_register_event(simprof* prof, const char* name, const char* long_name) {
+    if (!prof || !name) return SIMPROF_INVALID_EVENT;
+    uint32_t id = SIMPROF_INVALID_EVENT;
+    guarded("register_event", [&] { id = prof->registerEvent(name, str(long_name)); return true; });
+    return id;
+}
+
+uint32_t simprof_event_id(const simprof* prof, const char* name) {
+    if (!prof || !name) return SIMPROF_INVALID_EVENT;
+    return prof->eventId(name);
+}
+
+int simprof_set_memory_budget(simprof* prof, size_t budget_bytes, const char* spill_path) {
+    if (!prof) return -1;
+    return guarded("set_memory_budget", [&] {
+        return prof->setMemoryBudget(budget_bytes, spill_path ? spill_path : "");
+    });
+}
+
+int simprof_enable_vector_profiling(simprof* prof, uint32_t vlen_bits) {
+    if (!prof) return -1;
+    return guarded("enable_vector_profiling", [&] { prof->enableVectorProfiling(vlen_bits); return true; });
+}
+
+int simprof_record(simprof* prof, const simprof_instruction_record* records, size_t count) {
+    if (!prof || (!records && count)) return -1;
+    return guarded("record", [&] { return prof->record(records, count); });
+}
+
+int simprof_add_events(simprof* prof, const simprof_event_record* records, size_t count) {
+    if (!prof || (!records && count)) return -1;
+    return guarded("add_events", [&] { return prof->addEvents(records, count); });
+}
+
+int simprof_retire(simprof* prof, const simprof_retire_record* records, size_t count) {
+    if (!prof || (!records && count)) return -1;
+    return guarded("retire", [&] { prof->retire(records, count); return true; });
+}
+
+int simprof_dump(simprof* prof) {
+    if (!prof) return -1;
+    return guarded("dump", [&] { return prof->dump(); });
+}
+
+int simprof_write_report(simprof* prof, const char* path, size_t top_n) {
+    if (!prof || !path) return -1;
+    return guarded("write_report", [&] { return prof->writeReport(path, top_n); });
+}
+
+int simprof_write_lcov(simprof* prof, const char* path, const char* test_name) {
+    if (!prof || !path) return -1;
+    return guarded("write_lcov", [&] { return prof->writeLcov(path, str(test_name)); });
+}
+
+int simprof_reset(simprof* prof) {
+    if (!prof) return -1;
+    return guarded("reset", [&] { prof->reset(); return true; });
+}
+
+uint64_t simprof_pc_event(const simprof* prof, uint64_t pc, uint32_t event) {
+    return prof ? prof->pcEvent(pc, event) : 0;
+}
+
+int simprof_call_edge(const simprof* prof, uint64_t from_pc, uint64_t to_pc,
+                      uint64_t* calls, uint64_t* inclusive, size_t n_events) {
+    if (!prof || (!inclusive && n_events)) return -1;
+    return guarded("call_edge", [&] {
+        CallEdgeCost cost = prof->callEdge(from_pc, to_pc);
+        if (calls) *calls = cost.count;
+        for (size_t i = 0; i < n_events; ++i) {
+            inclusive[i] = i < cost.inclusive_events.size() ? cost.inclusive_events[i] : 0;
+        }
+        return true;
+    });
+}
+
+int simprof_get_stats(const simprof* prof, simprof_stats* stats) {
+    if (!prof || !stats || stats->struct_size < offsetof(simprof_stats, instructions_recorded)) return -1;
+    return guarded("get_stats", [&] {
+        const GeneratorStats s = prof->stats();
+        simprof_stats out{};
+        out.struct_size = stats->struct_size;
+        out.instructions_recorded = s.instructions_recorded;
+        out.ns_per_record = s.ns_per_record;
+        out.pc_entries = s.pc_entries;
+        out.call_edges = s.call_edges;
+        out.jump_edges = s.jump_edges;
+        out.resync_count = s.resync_count;
+        out.edge_table_bytes = s.edge_table_bytes;
+        out.spilled_edges = s.spilled_edges;
+        out.bytes_written = s.bytes_written;
+        out.dump_wall_ms = s.dump_wall_ms;
+        // An older caller's struct only gets the fields it knows about
+        std::memcpy(stats, &out, std::min<size_t>(stats->struct_size, sizeof(out)));
+        return true;
+    });
+}
+
+}  // extern "C"
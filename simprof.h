@@ -0,0 +1,141 @@
+/* simprof.h - Stable C ABI around SimulatorInterface (libsimprof.so)
+ *
+ * For C simulators, Verilator DPI code and ctypes harnesses that cannot
+ * compile test2.cpp with matching flags:
+ *   g++ -std=c++17 -O2 -fPIC -shared -fvisibility=hidden -Wl,--version-script=simprof.map \
+ *       simprof.cpp -o libsimprof.so
+ *
+ * The version script exports the simprof_* functions only; -fvisibility
+ * alone still leaves the standard library's inline instantiations visible.
+ *
+ * Profilers are opaque handles. Records cross the boundary in caller-owned
+ * arrays of the POD structs below, so one call covers a whole batch; the
+ * retire batch is passed through without copying. Calls returning int give
+ * 0 on success and -1 on failure (details go to stderr), and no C++
+ * exception crosses the boundary. A handle is not thread safe.
+ *
+ * Structs only grow at the end; simprof_stats carries its own size so
+ * older callers keep working. SIMPROF_ABI_VERSION changes on any
+ * incompatible change.
+ */
+#ifndef SIMPROF_H
+#define SIMPROF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIMPROF_ABI_VERSION 1
+
+#if defined(__GNUC__)
+#define SIMPROF_API __attribute__((visibility("default")))
+#else
+#define SIMPROF_API
+#endif
+
+#define SIMPROF_INVALID_EVENT 0xffffffffu
+
+typedef struct simprof simprof;
+
+/* Collection level, fixed at creation (see ProfileMode) */
+typedef enum simprof_mode {
+    SIMPROF_MODE_FULL = 0,
+    SIMPROF_MODE_CALL_GRAPH = 1,
+    SIMPROF_MODE_IR_ONLY = 2
+} simprof_mode;
+
+/* One objdump line of the program image */
+typedef struct simprof_image_entry {
+    uint64_t pc;
+    const char* function;
+    const char* assembly;
+    const char* file;
+    uint32_t line;
+} simprof_image_entry;
+
+/* count of event at pc, advancing the instruction stream (onInstruction) */
+typedef struct simprof_instruction_record {
+    uint64_t pc;
+    uint64_t count;
+    uint32_t event;
+    int32_t dest_reg;        /* Written register (-1 = none) */
+    uint8_t is_branch;
+    uint8_t reserved[7];
+} simprof_instruction_record;
+
+/* count of event at pc without advancing the stream (onEvent) */
+typedef struct simprof_event_record {
+    uint64_t pc;
+    uint64_t count;
+    uint32_t event;
+    uint32_t reserved;
+} simprof_event_record;
+
+/* One retired instruction; same layout as RetireRecord (onRetireBatch) */
+typedef struct simprof_retire_record {
+    uint64_t pc;
+    uint64_t timestamp;      /* Core cycle counter at retirement */
+    uint64_t blocking_pc;    /* Instruction this one waited on (0 = none) */
+    int32_t dest_reg;        /* Written register (-1 = none) */
+    uint8_t is_branch;
+    uint8_t is_vector;       /* vl/vtype below are valid */
+    uint16_t vtype;
+    uint32_t vl;
+} simprof_retire_record;
+
+/* Subset of GeneratorStats; set struct_size = sizeof(simprof_stats) */
+typedef struct simprof_stats {
+    uint32_t struct_size;
+    uint32_t reserved;
+    uint64_t instructions_recorded;
+    double ns_per_record;
+    uint64_t pc_entries;
+    uint64_t call_edges;
+    uint64_t jump_edges;
+    uint64_t resync_count;
+    uint64_t edge_table_bytes;
+    uint64_t spilled_edges;
+    uint64_t bytes_written;
+    double dump_wall_ms;
+} simprof_stats;
+
+SIMPROF_API uint32_t simprof_abi_version(void);
+
+/* NULL on failure. Events are Ir, Cycle and, with branch collection, Bc/Bcm/Bi/Bim. */
+SIMPROF_API simprof* simprof_create(const char* output_file, simprof_mode mode);
+SIMPROF_API void simprof_destroy(simprof* prof);
+
+/* Setup, before recording starts */
+SIMPROF_API int simprof_load_image(simprof* prof, const simprof_image_entry* entries, size_t count);
+SIMPROF_API int simprof_load_objdump(simprof* prof, const char* objdump_path);  /* objdump -d -l listing */
+SIMPROF_API uint32_t simprof_register_event(simprof* prof, const char* name, const char* long_name);
+SIMPROF_API uint32_t simprof_event_id(const simprof* prof, const char* name);
+SIMPROF_API int simprof_set_memory_budget(simprof* prof, size_t budget_bytes, const char* spill_path);  /* NULL spill_path: output path + ".spill" */
+SIMPROF_API int simprof_enable_vector_profiling(simprof* prof, uint32_t vlen_bits);
+
+/* Batched recording. A batch holding an unregistered event ID fails (-1)
+ * without counting any of its records. */
+SIMPROF_API int simprof_record(simprof* prof, const simprof_instruction_record* records, size_t count);
+SIMPROF_API int simprof_add_events(simprof* prof, const simprof_event_record* records, size_t count);
+SIMPROF_API int simprof_retire(simprof* prof, const simprof_retire_record* records, size_t count);
+
+/* Output. simprof_dump fails if the profile cannot be opened or written. */
+SIMPROF_API int simprof_dump(simprof* prof);
+SIMPROF_API int simprof_write_report(simprof* prof, const char* path, size_t top_n);
+SIMPROF_API int simprof_write_lcov(simprof* prof, const char* path, const char* test_name);
+SIMPROF_API int simprof_reset(simprof* prof);
+
+/* Queries. simprof_call_edge fills up to n_events inclusive costs. */
+SIMPROF_API uint64_t simprof_pc_event(const simprof* prof, uint64_t pc, uint32_t event);
+SIMPROF_API int simprof_call_edge(const simprof* prof, uint64_t from_pc, uint64_t to_pc,
+                                  uint64_t* calls, uint64_t* inclusive, size_t n_events);
+SIMPROF_API int simprof_get_stats(const simprof* prof, simprof_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPROF_H */
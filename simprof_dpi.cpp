@@ -0,0 +1,68 @@
+// simprof_dpi.cpp - C side of simprof_dpi.sv
+//
+// Retire calls from the monitor land in a per-handle buffer that is passed
+// to simprof_retire whole, so the profiler sees one batch per
+// BATCH_RECORDS instructions instead of one call per retirement.
+
+#include "simprof.h"
+#include "riscv_control_transfer.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr size_t BATCH_RECORDS = 4096;
+
+struct DpiProfiler {
+    simprof* prof;
+    bool rv32;
+    std::vector<simprof_retire_record> batch;
+};
+
+void flush(DpiProfiler& dpi) {
+    if (dpi.batch.empty()) return;
+    if (simprof_retire(dpi.prof, dpi.batch.data(), dpi.batch.size()) != 0) {
+        std::fprintf(stderr, "simprof: dropped %zu retire records\n", dpi.batch.size());
+    }
+    dpi.batch.clear();
+}
+
+}  // namespace
+
+extern "C" {
+
+SIMPROF_API void* simprof_dpi_open(const char* output_file, const char* objdump_file, int32_t xlen) {
+    simprof* prof = simprof_create(output_file, SIMPROF_MODE_FULL);
+    if (!prof) return nullptr;
+    if (simprof_load_objdump(prof, objdump_file) != 0) {
+        simprof_destroy(prof);
+        return nullptr;
+    }
+    DpiProfiler* dpi = new DpiProfiler{prof, xlen == 32, {}};
+    dpi->batch.reserve(BATCH_RECORDS);
+    return dpi;
+}
+
+SIMPROF_API void simprof_dpi_retire(void* handle, uint64_t pc, uint32_t insn, uint8_t rd, uint64_t cycle) {
+    DpiProfiler& dpi = *static_cast<DpiProfiler*>(handle);
+    simprof_retire_record record{};
+    record.pc = pc;
+    record.timestamp = cycle;
+    record.dest_reg = rd ? rd : -1;
+    record.is_branch = decodeControlTransfer(insn, dpi.rv32).is_transfer;  // Resolved at the next retire
+    dpi.batch.push_back(record);
+    if (dpi.batch.size() == BATCH_RECORDS) flush(dpi);
+}
+
+SIMPROF_API int32_t simprof_dpi_close(void* handle) {
+    DpiProfiler* dpi = static_cast<DpiProfiler*>(handle);
+    flush(*dpi);
+    const int32_t result = simprof_dump(dpi->prof);
+    simprof_destroy(dpi->prof);
+    delete dpi;
+    return result;
+}
+
+}  // extern "C"
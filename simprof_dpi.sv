@@ -0,0 +1,77 @@
+// simprof_dpi.sv - DPI-C bridge from an RTL core's retire port to libsimprof
+//
+// Bind or instantiate simprof_retire_monitor next to the core and hook it
+// to the retirement signals; simprof_dpi.cpp buffers the records and hands
+// them to the profiler in batches. Under Verilator (verilate_rtl.sh) add
+// this file to the RTL list and simprof_dpi.cpp plus simprof.cpp to the
+// C++ sources (PROFILER_DPI=1 in verilate_rtl.sh does both).
+
+package simprof_dpi_pkg;
+
+    // Open a profiler writing output_file, with the firmware image from an
+    // `objdump -d -l` listing; xlen picks the compressed encoding (c.jal is
+    // RV32 only). Null on failure.
+    import "DPI-C" function chandle simprof_dpi_open(input string output_file,
+                                                     input string objdump_file,
+                                                     input int xlen);
+
+    // One retired instruction: rd = 0 means no register was written
+    import "DPI-C" function void simprof_dpi_retire(input chandle handle,
+                                                    input longint unsigned pc,
+                                                    input int unsigned insn,
+                                                    input byte unsigned rd,
+                                                    input longint unsigned cycle);
+
+    // Flush buffered records and write the callgrind profile; 0 on
+    // success, -1 if the profile could not be written
+    import "DPI-C" function int simprof_dpi_close(input chandle handle);
+
+endpackage
+
+module simprof_retire_monitor #(
+    parameter string OUTPUT_FILE  = "callgrind.out.rtl",
+    parameter string OBJDUMP_FILE = "firmware.dis",
+    parameter int    XLEN         = 64,
+    parameter int    RETIRE_WIDTH = 1     // Instructions retired per cycle, lane 0 oldest
+) (
+    input logic                         clk,
+    input logic                         rst_n,
+    input logic [RETIRE_WIDTH-1:0]      retire_valid,
+    input logic [RETIRE_WIDTH*XLEN-1:0] retire_pc,
+    input logic [RETIRE_WIDTH*32-1:0]   retire_insn,   // Compressed instructions in the low half
+    input logic [RETIRE_WIDTH*5-1:0]    retire_rd      // Destination register, 0 if none
+);
+    import simprof_dpi_pkg::*;
+
+    chandle           handle;
+    longint unsigned  cycle;
+
+    initial begin
+        handle = simprof_dpi_open(OUTPUT_FILE, OBJDUMP_FILE, XLEN);
+        if (handle == null) $error("simprof: profiler disabled, see stderr");
+    end
+
+    always_ff @(posedge clk) begin
+        if (!rst_n) begin
+            cycle <= 0;
+        end else begin
+            cycle <= cycle + 1;
+            if (handle != null) begin
+                for (int lane = 0; lane < RETIRE_WIDTH; lane++) begin
+                    if (retire_valid[lane]) begin
+                        simprof_dpi_retire(handle,
+                                           64'(retire_pc[lane*XLEN +: XLEN]),
+                                           retire_insn[lane*32 +: 32],
+                                           8'(retire_rd[lane*5 +: 5]),
+                                           cycle);
+                    end
+                end
+            end
+        end
+    end
+
+    final begin
+        if (handle != null && simprof_dpi_close(handle) != 0) $error("simprof: profile not written, see stderr");
+    end
+
+endmodule
@@ -0,0 +1,59 @@
+// simprof_dpi_test.cpp - calls the DPI-C functions the way simprof_dpi.sv does
+//
+//   g++ -std=c++17 main.cpp simprof_dpi_test.cpp simprof_dpi.cpp -L. -lsimprof -lgmock -lgtest -lpthread -o simprof_dpi_test
+
+#include "gmock/gmock.h"
+#include "simprof.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Imported by simprof_dpi.sv; Verilator generates the same prototypes
+extern "C" {
+void* simprof_dpi_open(const char* output_file, const char* objdump_file, int32_t xlen);
+void simprof_dpi_retire(void* handle, uint64_t pc, uint32_t insn, uint8_t rd, uint64_t cycle);
+int32_t simprof_dpi_close(void* handle);
+}
+
+TEST(SimprofDpi, OpenFailsWithoutTheImage) {
+	EXPECT_EQ(nullptr, simprof_dpi_open("/dev/null", "/nonexistent/firmware.dis", 64));
+}
+
+TEST(SimprofDpi, RetiredCallsAndReturnsReachTheProfile) {
+	const std::string dis = testing::TempDir() + "dpi_firmware.dis";
+	const std::string out = testing::TempDir() + "dpi.callgrind";
+	{
+		std::ofstream listing(dis);
+		listing << "0000000080000000 <main>:\n"
+		        << "    80000000:\t008000ef          \tjal\t80000008 <f>\n"
+		        << "    80000004:\tffdff06f          \tj\t80000000 <main>\n\n"
+		        << "0000000080000008 <f>:\n"
+		        << "    80000008:\t4501                \tli\ta0,0\n"
+		        << "    8000000a:\t8082                \tret\n";
+	}
+	void* handle = simprof_dpi_open(out.c_str(), dis.c_str(), 64);
+	ASSERT_NE(nullptr, handle);
+
+	// More iterations than one retire batch holds, so flushes happen mid-run
+	const int iterations = 3000;
+	uint64_t cycle = 0;
+	for (int i = 0; i < iterations; ++i) {
+		simprof_dpi_retire(handle, 0x80000000, 0x008000ef, 1, cycle++);   // jal ra,f
+		simprof_dpi_retire(handle, 0x80000008, 0x4501, 10, cycle++);      // c.li a0,0
+		simprof_dpi_retire(handle, 0x8000000a, 0x8082, 0, cycle++);       // c.ret
+		simprof_dpi_retire(handle, 0x80000004, 0xffdff06f, 0, cycle++);   // j main
+	}
+	EXPECT_EQ(0, simprof_dpi_close(handle));
+	std::remove(dis.c_str());
+
+	std::ifstream in(out);
+	ASSERT_TRUE(in.is_open());
+	std::stringstream profile;
+	profile << in.rdbuf();
+	std::remove(out.c_str());
+	const std::string text = profile.str();
+	EXPECT_NE(std::string::npos, text.find("calls=" + std::to_string(iterations) + " 0x80000008")) << text;
+	EXPECT_NE(std::string::npos, text.find("totals: " + std::to_string(4 * iterations) + " ")) << text;
+}
@@ -0,0 +1,167 @@
+// simprof_test.cpp - drives libsimprof through its C functions only
+//
+//   g++ -std=c++17 main.cpp simprof_test.cpp -L. -lsimprof -lgmock -lgtest -lpthread -o simprof_test
+
+#include "gmock/gmock.h"
+#include "simprof.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace {
+
+const simprof_image_entry image[] = {
+	{0x100, "main", "jal\tra,200 <f>", "main.c", 3},
+	{0x104, "main", "nop", "main.c", 4},
+	{0x200, "f", "add\ta0,a0,a1", "f.c", 10},
+	{0x204, "f", "ret", "f.c", 11},
+};
+
+simprof_instruction_record instruction(uint64_t pc, int32_t dest_reg, bool is_branch) {
+	simprof_instruction_record r{};
+	r.pc = pc;
+	r.count = 1;
+	r.event = 0;  // Ir
+	r.dest_reg = dest_reg;
+	r.is_branch = is_branch;
+	return r;
+}
+
+}  // namespace
+
+TEST(SimprofAbi, CreateRejectsUnknownMode) {
+	EXPECT_EQ(SIMPROF_ABI_VERSION, simprof_abi_version());
+	EXPECT_EQ(nullptr, simprof_create("/dev/null", static_cast<simprof_mode>(7)));
+	simprof_destroy(nullptr);  // Allowed, like free(NULL)
+}
+
+TEST(SimprofAbi, RecordsRetiresAndQueries) {
+	const std::string path = testing::TempDir() + "simprof_abi.callgrind";
+	simprof* prof = simprof_create(path.c_str(), SIMPROF_MODE_FULL);
+	ASSERT_NE(nullptr, prof);
+	ASSERT_EQ(0, simprof_load_image(prof, image, 4));
+	const uint32_t ir = simprof_event_id(prof, "Ir");
+	const uint32_t cycle = simprof_event_id(prof, "Cycle");
+	ASSERT_EQ(0u, ir);
+	const uint32_t stall = simprof_register_event(prof, "Stall", "Stall cycles");
+	ASSERT_NE(SIMPROF_INVALID_EVENT, stall);
+	EXPECT_EQ(stall, simprof_register_event(prof, "Stall", nullptr));
+	EXPECT_EQ(SIMPROF_INVALID_EVENT, simprof_event_id(prof, "NoSuchEvent"));
+
+	// main calls f, f returns
+	const simprof_instruction_record run[] = {
+		instruction(0x100, 1, true),
+		instruction(0x200, -1, false),
+		instruction(0x204, 0, true),
+		instruction(0x104, -1, false),
+	};
+	ASSERT_EQ(0, simprof_record(prof, run, 4));
+	simprof_event_record stalls[] = {{0x200, 5, stall, 0}};
+	ASSERT_EQ(0, simprof_add_events(prof, stalls, 1));
+
+	EXPECT_EQ(1u, simprof_pc_event(prof, 0x200, ir));
+	EXPECT_EQ(5u, simprof_pc_event(prof, 0x200, stall));
+	uint64_t calls = 0;
+	uint64_t inclusive[3] = {};
+	ASSERT_EQ(0, simprof_call_edge(prof, 0x100, 0x200, &calls, inclusive, 3));
+	EXPECT_EQ(1u, calls);
+	EXPECT_EQ(2u, inclusive[ir]);
+
+	// Retire timestamps charge cycle deltas to the retiring instruction
+	simprof_retire_record retired[2] = {};
+	retired[0].pc = 0x104;
+	retired[0].timestamp = 100;
+	retired[0].dest_reg = -1;
+	retired[1].pc = 0x104;
+	retired[1].timestamp = 103;
+	retired[1].dest_reg = -1;
+	ASSERT_EQ(0, simprof_retire(prof, retired, 2));
+	EXPECT_EQ(3u, simprof_pc_event(prof, 0x104, ir));
+	EXPECT_EQ(3u, simprof_pc_event(prof, 0x104, cycle));
+
+	simprof_stats stats{};
+	stats.struct_size = sizeof(stats);
+	ASSERT_EQ(0, simprof_get_stats(prof, &stats));
+	EXPECT_EQ(sizeof(stats), stats.struct_size);
+	EXPECT_EQ(6u, stats.instructions_recorded);
+	EXPECT_EQ(4u, stats.pc_entries);
+	EXPECT_EQ(1u, stats.call_edges);
+
+	ASSERT_EQ(0, simprof_dump(prof));
+	EXPECT_TRUE(std::ifstream(path).is_open());
+	ASSERT_EQ(0, simprof_reset(prof));
+	EXPECT_EQ(0u, simprof_pc_event(prof, 0x200, ir));
+	simprof_destroy(prof);
+	std::remove(path.c_str());
+}
+
+TEST(SimprofAbi, DumpFailsWhenTheProfileIsNotWritten) {
+	for (const char* path : {"/nonexistent-dir/out.callgrind", "/dev/full"}) {
+		simprof* prof = simprof_create(path, SIMPROF_MODE_IR_ONLY);
+		ASSERT_NE(nullptr, prof);
+		ASSERT_EQ(0, simprof_load_image(prof, image, 4));
+		EXPECT_EQ(-1, simprof_dump(prof)) << path;
+		simprof_destroy(prof);
+	}
+}
+
+TEST(SimprofAbi, OlderStatsStructGetsOnlyItsFields) {
+	simprof* prof = simprof_create("/dev/null", SIMPROF_MODE_IR_ONLY);
+	ASSERT_NE(nullptr, prof);
+	ASSERT_EQ(0, simprof_load_image(prof, image, 4));
+	const simprof_instruction_record run[] = {instruction(0x104, -1, false)};
+	ASSERT_EQ(0, simprof_record(prof, run, 1));
+
+	// A caller built when the struct ended at pc_entries
+	const size_t old_size = offsetof(simprof_stats, call_edges);
+	simprof_stats stats;
+	std::memset(&stats, 0xab, sizeof(stats));
+	stats.struct_size = static_cast<uint32_t>(old_size);
+	ASSERT_EQ(0, simprof_get_stats(prof, &stats));
+	EXPECT_EQ(old_size, stats.struct_size);
+	EXPECT_EQ(1u, stats.instructions_recorded);
+	EXPECT_EQ(4u, stats.pc_entries);
+	EXPECT_EQ(0xababababababababull, stats.call_edges);  // Past its struct: untouched
+
+	stats.struct_size = 4;  // Not even the header
+	EXPECT_EQ(-1, simprof_get_stats(prof, &stats));
+	simprof_destroy(prof);
+}
+
+TEST(SimprofAbi, InvalidArgumentsFailWithoutSideEffects) {
+	const simprof_instruction_record run[] = {instruction(0x104, -1, false)};
+	const simprof_event_record events[] = {{0x104, 1, 0, 0}};
+	simprof_stats stats{};
+	stats.struct_size = sizeof(stats);
+	EXPECT_EQ(-1, simprof_load_image(nullptr, image, 4));
+	EXPECT_EQ(-1, simprof_record(nullptr, run, 1));
+	EXPECT_EQ(-1, simprof_add_events(nullptr, events, 1));
+	EXPECT_EQ(-1, simprof_dump(nullptr));
+	EXPECT_EQ(-1, simprof_get_stats(nullptr, &stats));
+	EXPECT_EQ(0u, simprof_pc_event(nullptr, 0x104, 0));
+
+	simprof* prof = simprof_create("/dev/null", SIMPROF_MODE_CALL_GRAPH);
+	ASSERT_NE(nullptr, prof);
+	ASSERT_EQ(0, simprof_load_image(prof, image, 4));
+	EXPECT_EQ(-1, simprof_load_image(prof, nullptr, 4));
+	EXPECT_EQ(-1, simprof_record(prof, nullptr, 1));
+	EXPECT_EQ(0, simprof_record(prof, nullptr, 0));
+	EXPECT_EQ(-1, simprof_get_stats(prof, nullptr));
+	EXPECT_EQ(-1, simprof_call_edge(prof, 0x100, 0x200, nullptr, nullptr, 1));
+	EXPECT_EQ(-1, simprof_load_objdump(prof, nullptr));
+	EXPECT_EQ(-1, simprof_write_report(prof, nullptr, 10));
+
+	// One unregistered event rejects the whole batch
+	simprof_instruction_record bad_run[] = {instruction(0x104, -1, false), instruction(0x104, -1, false)};
+	bad_run[1].event = 1000;
+	EXPECT_EQ(-1, simprof_record(prof, bad_run, 2));
+	simprof_event_record bad_events[] = {{0x104, 1, 0, 0}, {0x104, 1, SIMPROF_INVALID_EVENT, 0}};
+	EXPECT_EQ(-1, simprof_add_events(prof, bad_events, 2));
+	EXPECT_EQ(0u, simprof_pc_event(prof, 0x104, 0));
+	ASSERT_EQ(0, simprof_get_stats(prof, &stats));
+	EXPECT_EQ(0u, stats.instructions_recorded);
+	simprof_destroy(prof);
+}
@@ -0,0 +1,527 @@
+// synthetic_workload.hpp - Deterministic synthetic RISC-V workloads for CallgrindGenerator
+#ifndef SYNTHETIC_WORKLOAD_HPP
+#define SYNTHETIC_WORKLOAD_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// One retired instruction as passed to SimulatorInterface::onInstruction
+struct TraceRecord {
+    uint64_t pc;
+    int dest_reg;     // -1 = none, 0 = x0 (jump/tail call/return), >0 = link register
+    bool is_branch;   // Instruction can change control flow
+};
+
+// Shape of the generated program and of the dynamic instruction mix
+struct SyntheticWorkloadConfig {
+    uint64_t seed = 1;
+
+    uint32_t straight_length = 64;    // Instructions in main's straight-line block
+    uint32_t num_kernels = 8;         // Leaf functions with one inner loop
+    uint32_t kernel_body = 6;         // Instructions per kernel loop iteration
+    uint32_t max_trips = 32;          // Kernel trip count is uniform in [1, max_trips]
+    uint32_t dispatch_handlers = 8;   // Indirect jump targets in dispatch()
+    uint32_t dispatch_length = 16;    // Indirect jumps per dispatch() call
+    uint32_t recursion_depth = 6;     // fib() recursion depth per call
+
+    // Relative weights of what main does on each iteration
+    uint32_t w_straight = 1;
+    uint32_t w_kernel = 4;
+    uint32_t w_dispatch = 2;
+    uint32_t w_recurse = 1;
+    uint32_t w_tail = 1;
+    uint32_t w_helper = 1;
+
+    static SyntheticWorkloadConfig straightLine() {
+        SyntheticWorkloadConfig c;
+        c.straight_length = 1024;
+        c.w_kernel = c.w_dispatch = c.w_recurse = c.w_tail = c.w_helper = 0;
+        return c;
+    }
+
+    static SyntheticWorkloadConfig loopHeavy() {
+        SyntheticWorkloadConfig c;
+        c.max_trips = 256;
+        c.w_straight = c.w_dispatch = c.w_recurse = c.w_tail = c.w_helper = 0;
+        return c;
+    }
+
+    static SyntheticWorkloadConfig callHeavy() {
+        SyntheticWorkloadConfig c;
+        c.max_trips = 1;
+        c.kernel_body = 2;
+        c.w_straight = c.w_dispatch = 0;
+        c.w_kernel = c.w_recurse = c.w_tail = c.w_helper = 1;
+        return c;
+    }
+
+    static SyntheticWorkloadConfig indirectHeavy() {
+        SyntheticWorkloadConfig c;
+        c.dispatch_length = 256;
+        c.w_straight = c.w_kernel = c.w_recurse = c.w_tail = c.w_helper = 0;
+        return c;
+    }
+};
+
+// Builds a fake objdump image (functions, loops, recursion, tail calls,
+// __riscv_save/__riscv_restore helpers, indirect jumps) and emits the
+// matching instruction stream together with its ground-truth costs.
+//
+// Ground truth follows the generator's cost model: an edge's inclusive Ir
+// is every instruction after the call up to and including the matching
+// return; a tail call is closed by the same return as the frame it
+// replaces; tail calls into __riscv_restore are epilogues of the calling
+// frame and carry no inclusive cost of their own.
+class SyntheticWorkload {
+public:
+    using ObjdumpEntry = std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>;
+
+    struct EdgeTruth {
+        uint64_t site_pc;
+        uint64_t target_pc;
+        uint64_t calls;
+        uint64_t inclusive_ir;
+    };
+
+    struct GroundTruth {
+        uint64_t total_ir = 0;
+        std::map<std::string, uint64_t> self_ir;   // Per function
+        std::vector<EdgeTruth> edges;              // Executed call edges only
+    };
+
+    static constexpr uint64_t TEXT_BASE = 0x80000000;
+
+private:
+    enum Reg { ZERO = 0, RA = 1, T0 = 5 };
+
+    struct Edge {
+        uint64_t site_pc;
+        uint64_t target_pc;
+    };
+
+    struct Frame {
+        uint32_t edge;
+        uint64_t ir_at_call;
+        bool is_tail_call;
+    };
+
+    // Fixed program points, resolved while building the image
+    struct Kernel {
+        uint32_t fn;
+        uint64_t entry, body, latch, ret;
+        uint32_t main_edge;            // main -> kernel
+    };
+
+    SyntheticWorkloadConfig cfg;
+    std::vector<ObjdumpEntry> image;
+    std::vector<std::string> fn_names;
+    std::vector<Edge> edges;
+    uint64_t next_pc;
+
+    uint32_t fn_main, fn_dispatch, fn_fib, fn_tail_a, fn_tail_b, fn_saver, fn_save, fn_restore;
+    uint64_t main_head, main_select, main_straight_jump;
+    std::vector<uint64_t> main_straight;
+    std::vector<Kernel> kernels;
+    std::vector<uint64_t> main_blocks;   // Block entry per action, in action order
+    uint32_t edge_dispatch, edge_fib, edge_tail_a, edge_saver;
+    uint64_t dispatch_head, dispatch_load, dispatch_jr, dispatch_exit;
+    std::vector<uint64_t> dispatch_handler;
+    uint64_t fib_entry, fib_test, fib_dec, fib_call, fib_after, fib_ret, fib_base, fib_base_ret;
+    uint32_t edge_fib_self;
+    uint64_t tail_a_entry, tail_a_jump, tail_b_entry;
+    uint32_t edge_tail_b;
+    uint64_t saver_entry, saver_body, saver_call, saver_after, saver_tail;
+    uint32_t edge_save, edge_saver_kernel, edge_restore;
+    uint64_t save_entry, restore_entry;
+
+    // Dynamic state
+    uint64_t rng_state;
+    uint64_t ir;
+    std::vector<uint64_t> fn_self;
+    std::vector<uint64_t> edge_calls;
+    std::vector<uint64_t> edge_inclusive;
+    std::vector<Frame> shadow_stack;
+
+    static std::string hex(uint64_t v) {
+        static const char digits[] = "0123456789abcdef";
+        std::string s;
+        do {
+            s.insert(s.begin(), digits[v & 0xf]);
+            v >>= 4;
+        } while (v);
+        return s;
+    }
+
+    uint32_t addFunction(const std::string& name) {
+        // Functions start on 64-byte boundaries like typical -falign-functions output
+        next_pc = (next_pc + 63) & ~uint64_t(63);
+        fn_names.push_back(name);
+        return static_cast<uint32_t>(fn_names.size() - 1);
+    }
+
+    uint64_t put(uint32_t fn, const std::string& assembly, uint32_t size = 4) {
+        uint64_t pc = next_pc;
+        uint32_t line = 0;
+        for (auto it = image.rbegin(); it != image.rend(); ++it) {
+            if (std::get<1>(*it) == fn_names[fn]) {
+                line = std::get<4>(*it);
+                break;
+            }
+        }
+        image.emplace_back(pc, fn_names[fn], assembly, fn_names[fn] + ".c", line + 1);
+        next_pc += size;
+        return pc;
+    }
+
+    // Patch the assembly text once a forward target is known
+    void patch(uint64_t pc, const std::string& assembly) {
+        for (auto& entry : image) {
+            if (std::get<0>(entry) == pc) {
+                std::get<2>(entry) = assembly;
+                return;
+            }
+        }
+    }
+
+    std::string target(uint64_t pc, uint32_t fn) const {
+        return hex(pc) + " <" + fn_names[fn] + ">";
+    }
+
+    uint32_t addEdge(uint64_t site_pc, uint64_t target_pc) {
+        edges.push_back({site_pc, target_pc});
+        return static_cast<uint32_t>(edges.size() - 1);
+    }
+
+    void build() {
+        static const char* const kernel_ops[] = {
+            "add\ta0,a0,a1", "mul\ta4,a4,a5", "lw\ta5,0(a1)", "sw\ta5,4(a1)", "addi\ta1,a1,4", "xor\ta3,a3,a4"
+        };
+
+        // Callees first so call sites can name their targets
+        fn_save = addFunction("__riscv_save_0");
+        save_entry = put(fn_save, "addi\tsp,sp,-16");
+        put(fn_save, "sw\tra,12(sp)");
+        put(fn_save, "jr\tt0");
+
+        fn_restore = addFunction("__riscv_restore_0");
+        restore_entry = put(fn_restore, "lw\tra,12(sp)");
+        put(fn_restore, "addi\tsp,sp,16");
+        put(fn_restore, "ret");
+
+        for (uint32_t k = 0; k < cfg.num_kernels; ++k) {
+            Kernel kern;
+            kern.fn = addFunction("kernel_" + std::to_string(k));
+            kern.entry = put(kern.fn, "li\ta2," + std::to_string(cfg.max_trips));
+            kern.body = next_pc;
+            for (uint32_t i = 0; i < cfg.kernel_body; ++i) {
+                put(kern.fn, kernel_ops[i % 6]);
+            }
+            kern.latch = put(kern.fn, "bnez\ta2," + target(kern.body, kern.fn));
+            kern.ret = put(kern.fn, "ret");
+            kernels.push_back(kern);
+        }
+
+        fn_dispatch = addFunction("dispatch");
+        dispatch_head = put(fn_dispatch, "");
+        dispatch_load = put(fn_dispatch, "lw\ta5,0(a0)");
+        dispatch_jr = put(fn_dispatch, "jr\ta5");
+        for (uint32_t h = 0; h < cfg.dispatch_handlers; ++h) {
+            dispatch_handler.push_back(put(fn_dispatch, "addi\ta0,a0,4"));
+            put(fn_dispatch, "j\t" + target(dispatch_head, fn_dispatch));
+        }
+        dispatch_exit = put(fn_dispatch, "ret");
+        patch(dispatch_head, "beqz\ta3," + target(dispatch_exit, fn_dispatch));
+
+        fn_fib = addFunction("fib");
+        fib_entry = put(fn_fib, "addi\tsp,sp,-16");
+        fib_test = put(fn_fib, "");
+        fib_dec = put(fn_fib, "addi\ta0,a0,-1");
+        fib_call = put(fn_fib, "jal\tra," + target(fib_entry, fn_fib));
+        fib_after = put(fn_fib, "addi\tsp,sp,16");
+        fib_ret = put(fn_fib, "ret");
+        fib_base = put(fn_fib, "li\ta0,1");
+        fib_base_ret = put(fn_fib, "ret");
+        patch(fib_test, "beqz\ta0," + target(fib_base, fn_fib));
+        edge_fib_self = addEdge(fib_call, fib_entry);
+
+        fn_tail_b = addFunction("tail_b");
+        tail_b_entry = put(fn_tail_b, "addi\ta0,a0,1");
+        put(fn_tail_b, "c.addi\ta0,1", 2);
+        put(fn_tail_b, "slli\ta0,a0,1");
+        put(fn_tail_b, "ret");
+
+        fn_tail_a = addFunction("tail_a");
+        tail_a_entry = put(fn_tail_a, "addi\ta0,a0,2");
+        put(fn_tail_a, "mv\ta1,a0");
+        tail_a_jump = put(fn_tail_a, "j\t" + target(tail_b_entry, fn_tail_b));
+        edge_tail_b = addEdge(tail_a_jump, tail_b_entry);
+
+        fn_saver = addFunction("saver");
+        saver_entry = put(fn_saver, "jal\tt0," + target(save_entry, fn_save));
+        saver_body = put(fn_saver, "mv\ts0,a0");
+        saver_call = put(fn_saver, "jal\tra," + target(kernels.empty() ? saver_body : kernels[0].entry,
+                                                       kernels.empty() ? fn_saver : kernels[0].fn));
+        saver_after = put(fn_saver, "add\ta0,a0,s0");
+        saver_tail = put(fn_saver, "j\t" + target(restore_entry, fn_restore));
+        edge_save = addEdge(saver_entry, save_entry);
+        edge_saver_kernel = kernels.empty() ? 0 : addEdge(saver_call, kernels[0].entry);
+        edge_restore = addEdge(saver_tail, restore_entry);
+
+        // main: loop head selects a block through an indirect jump; every block jumps back
+        fn_main = addFunction("main");
+        main_head = put(fn_main, "lw\ta5,0(s1)");
+        main_select = put(fn_main, "jr\ta5");
+
+        main_blocks.push_back(next_pc);
+        for (uint32_t i = 0; i < cfg.straight_length; ++i) {
+            bool compressed = (i % 3) == 1;
+            main_straight.push_back(put(fn_main, compressed ? "c.addi\ta0,1" : "addi\ta1,a1,1", compressed ? 2 : 4));
+        }
+        main_straight_jump = put(fn_main, "j\t" + target(main_head, fn_main));
+
+        auto call_block = [&](uint64_t callee, uint32_t callee_fn) {
+            main_blocks.push_back(next_pc);
+            uint64_t site = put(fn_main, "jal\tra," + target(callee, callee_fn));
+            put(fn_main, "mv\ts2,a0");
+            put(fn_main, "j\t" + target(main_head, fn_main));
+            return addEdge(site, callee);
+        };
+        for (auto& kern : kernels) {
+            kern.main_edge = call_block(kern.entry, kern.fn);
+        }
+        edge_dispatch = call_block(dispatch_head, fn_dispatch);
+        edge_fib = call_block(fib_entry, fn_fib);
+        edge_tail_a = call_block(tail_a_entry, fn_tail_a);
+        edge_saver = call_block(saver_entry, fn_saver);
+    }
+
+    uint64_t nextRandom() {
+        // xorshift64*
+        rng_state ^= rng_state >> 12;
+        rng_state ^= rng_state << 25;
+        rng_state ^= rng_state >> 27;
+        return rng_state * 0x2545F4914F6CDD1DULL;
+    }
+
+    uint32_t uniform(uint32_t n) {
+        return static_cast<uint32_t>((nextRandom() >> 32) % n);
+    }
+
+    template <typename Sink>
+    inline void emit(Sink& sink, uint64_t pc, uint32_t fn, int dest_reg = -1, bool is_branch = false) {
+        sink(TraceRecord{pc, dest_reg, is_branch});
+        ++fn_self[fn];
+        ++ir;
+    }
+
+    // Call instruction already emitted; frame covers everything up to the return
+    void enter(uint32_t edge, bool is_tail_call = false) {
+        ++edge_calls[edge];
+        shadow_stack.push_back({edge, ir, is_tail_call});
+    }
+
+    // Return instruction already emitted; closes the frame and any tail calls into it
+    void leave() {
+        bool was_tail_call;
+        do {
+            const Frame frame = shadow_stack.back();
+            shadow_stack.pop_back();
+            edge_inclusive[frame.edge] += ir - frame.ir_at_call;
+            was_tail_call = frame.is_tail_call;
+        } while (was_tail_call && !shadow_stack.empty());
+    }
+
+    template <typename Sink>
+    void runKernel(Sink& sink, const Kernel& kern) {
+        emit(sink, kern.entry, kern.fn);
+        uint32_t trips = 1 + uniform(cfg.max_trips);
+        for (uint32_t t = 0; t < trips; ++t) {
+            for (uint32_t i = 0; i < cfg.kernel_body; ++i) {
+                emit(sink, kern.body + i * 4, kern.fn);
+            }
+            emit(sink, kern.latch, kern.fn, -1, true);
+        }
+        emit(sink, kern.ret, kern.fn, ZERO, true);
+        leave();
+    }
+
+    template <typename Sink>
+    void runDispatch(Sink& sink) {
+        for (uint32_t i = 0; i < cfg.dispatch_length; ++i) {
+            emit(sink, dispatch_head, fn_dispatch, -1, true);
+            emit(sink, dispatch_load, fn_dispatch);
+            emit(sink, dispatch_jr, fn_dispatch, ZERO, true);
+            uint64_t handler = dispatch_handler[uniform(cfg.dispatch_handlers)];
+            emit(sink, handler, fn_dispatch);
+            emit(sink, handler + 4, fn_dispatch, ZERO, true);
+        }
+        emit(sink, dispatch_head, fn_dispatch, -1, true);
+        emit(sink, dispatch_exit, fn_dispatch, ZERO, true);
+        leave();
+    }
+
+    template <typename Sink>
+    void runFib(Sink& sink, uint32_t depth) {
+        emit(sink, fib_entry, fn_fib);
+        emit(sink, fib_test, fn_fib, -1, true);
+        if (depth == 0) {
+            emit(sink, fib_base, fn_fib);
+            emit(sink, fib_base_ret, fn_fib, ZERO, true);
+        } else {
+            emit(sink, fib_dec, fn_fib);
+            emit(sink, fib_call, fn_fib, RA, true);
+            enter(edge_fib_self);
+            runFib(sink, depth - 1);
+            emit(sink, fib_after, fn_fib);
+            emit(sink, fib_ret, fn_fib, ZERO, true);
+        }
+        leave();
+    }
+
+    template <typename Sink>
+    void runTail(Sink& sink) {
+        emit(sink, tail_a_entry, fn_tail_a);
+        emit(sink, tail_a_entry + 4, fn_tail_a);
+        emit(sink, tail_a_jump, fn_tail_a, ZERO, true);
+        enter(edge_tail_b, true);
+        emit(sink, tail_b_entry, fn_tail_b);
+        emit(sink, tail_b_entry + 4, fn_tail_b);
+        emit(sink, tail_b_entry + 6, fn_tail_b);
+        emit(sink, tail_b_entry + 10, fn_tail_b, ZERO, true);
+        leave();
+    }
+
+    template <typename Sink>
+    void runSaver(Sink& sink) {
+        emit(sink, saver_entry, fn_saver, T0, true);
+        enter(edge_save);
+        emit(sink, save_entry, fn_save);
+        emit(sink, save_entry + 4, fn_save);
+        emit(sink, save_entry + 8, fn_save, ZERO, true);
+        leave();
+        emit(sink, saver_body, fn_saver);
+        if (!kernels.empty()) {
+            emit(sink, saver_call, fn_saver, RA, true);
+            enter(edge_saver_kernel);
+            runKernel(sink, kernels[0]);
+        }
+        emit(sink, saver_after, fn_saver);
+        emit(sink, saver_tail, fn_saver, ZERO, true);
+        ++edge_calls[edge_restore];   // Epilogue: stays in the saver frame
+        emit(sink, restore_entry, fn_restore);
+        emit(sink, restore_entry + 4, fn_restore);
+        emit(sink, restore_entry + 8, fn_restore, ZERO, true);
+        leave();
+    }
+
+    // Emit a main-block call site and run the callee
+    template <typename Sink, typename Body>
+    void runCallBlock(Sink& sink, size_t block, uint32_t edge, Body&& body) {
+        uint64_t site = main_blocks[block];
+        emit(sink, site, fn_main, RA, true);
+        enter(edge);
+        body();
+        emit(sink, site + 4, fn_main);
+        emit(sink, site + 8, fn_main, ZERO, true);
+    }
+
+public:
+    explicit SyntheticWorkload(const SyntheticWorkloadConfig& config = SyntheticWorkloadConfig())
+        : cfg(config),
+          next_pc(TEXT_BASE),
+          rng_state(config.seed ? config.seed : 1),
+          ir(0) {
+        build();
+        fn_self.assign(fn_names.size(), 0);
+        edge_calls.assign(edges.size(), 0);
+        edge_inclusive.assign(edges.size(), 0);
+    }
+
+    const std::vector<ObjdumpEntry>& objdump() const {
+        return image;
+    }
+
+    // Load the image into anything with CallgrindGenerator::loadPCInfo
+    template <typename Generator>
+    void load(Generator& gen) const {
+        for (const auto& [pc, func, assembly, file, line] : image) {
+            gen.loadPCInfo(pc, func, assembly, file, line);
+        }
+    }
+
+    // Emit at least min_instructions records to sink(const TraceRecord&).
+    // Runs whole main iterations, so the stream always ends back in main.
+    template <typename Sink>
+    void run(uint64_t min_instructions, Sink&& sink) {
+        const uint32_t weights[] = {cfg.w_straight, cfg.w_kernel, cfg.w_dispatch,
+                                    cfg.w_recurse, cfg.w_tail, cfg.w_helper};
+        uint32_t total_weight = 0;
+        for (uint32_t w : weights) total_weight += w;
+        if (total_weight == 0 || (kernels.empty() && total_weight == cfg.w_kernel)) return;
+
+        const uint64_t end = ir + min_instructions;
+        while (ir < end) {
+            emit(sink, main_head, fn_main);
+            emit(sink, main_select, fn_main, ZERO, true);
+
+            uint32_t pick = uniform(total_weight);
+            size_t action = 0;
+            while (pick >= weights[action]) pick -= weights[action++];
+
+            const size_t kernel_blocks = kernels.size();
+            switch (action) {
+                case 0: {
+                    for (uint64_t pc : main_straight) emit(sink, pc, fn_main);
+                    emit(sink, main_straight_jump, fn_main, ZERO, true);
+                    break;
+                }
+                case 1: {
+                    if (kernels.empty()) break;
+                    size_t k = uniform(static_cast<uint32_t>(kernel_blocks));
+                    runCallBlock(sink, 1 + k, kernels[k].main_edge, [&] { runKernel(sink, kernels[k]); });
+                    break;
+                }
+                case 2:
+                    runCallBlock(sink, 1 + kernel_blocks, edge_dispatch, [&] { runDispatch(sink); });
+                    break;
+                case 3:
+                    runCallBlock(sink, 2 + kernel_blocks, edge_fib, [&] { runFib(sink, cfg.recursion_depth); });
+                    break;
+                case 4:
+                    runCallBlock(sink, 3 + kernel_blocks, edge_tail_a, [&] { runTail(sink); });
+                    break;
+                default:
+                    runCallBlock(sink, 4 + kernel_blocks, edge_saver, [&] { runSaver(sink); });
+                    break;
+            }
+        }
+    }
+
+    std::vector<TraceRecord> generate(uint64_t min_instructions) {
+        std::vector<TraceRecord> stream;
+        stream.reserve(min_instructions + 1024);
+        run(min_instructions, [&stream](const TraceRecord& r) { stream.push_back(r); });
+        return stream;
+    }
+
+    // Costs of everything emitted so far
+    GroundTruth truth() const {
+        GroundTruth t;
+        t.total_ir = ir;
+        for (size_t fn = 0; fn < fn_names.size(); ++fn) {
+            if (fn_self[fn]) t.self_ir[fn_names[fn]] = fn_self[fn];
+        }
+        for (size_t e = 0; e < edges.size(); ++e) {
+            if (edge_calls[e]) {
+                t.edges.push_back({edges[e].site_pc, edges[e].target_pc, edge_calls[e], edge_inclusive[e]});
+            }
+        }
+        return t;
+    }
+};
+
+#endif // SYNTHETIC_WORKLOAD_HPP
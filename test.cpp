@@ -95,6 +95,9 @@ struct CallStackEntry {
 };
 
 class CallgrindGenerator {
+    // Benchmarks drive detectBranchType/handleBranch directly
+    friend struct CallgrindBenchAccess;
+    
 private:
     // Main data structure
     std::unordered_map<uint64_t, PCInfo> info;
@@ -365,7 +368,8 @@ private:
                                                     branch_site.targets.end(),
                             [to_pc](const JumpTarget& t) { return t.target_pc == to_pc; });
                         
-                        if (jump_it != branch_site.targets.end()) {
+                        const bool known_target = (jump_it != branch_site.targets.end());
+                        if (known_target) {
                             jump_it->executed++;
                             if (!is_sequential) {  // Taken only if not sequential
                                 jump_it->taken++;
@@ -381,7 +385,8 @@ private:
                         // Update branch statistics
                         info[from_pc].event[EVENT_BC]++;
                         // Simple misprediction model - if pattern changes
-                        if (jump_it != branch_site.targets.end() &&
+                        // (push_back above may have invalidated jump_it)
+                        if (known_target &&
                             jump_it->taken != 0 && jump_it->taken != jump_it->executed) {
                             info[from_pc].event[EVENT_BCM]++;
                         }
@@ -9,15 +9,27 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <stack>
+#include <memory>
+#include <memory_resource>
 #include <cstdint>
+#include <cstddef>
 #include <unistd.h>
 #include <string_view>
+#include <initializer_list>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <functional>
 
-// Maximum number of events to track
-constexpr size_t MAX_EVENTS = 10;
+#include "riscv_control_transfer.hpp"
 
-// Event types
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Built-in event IDs (the first six events of EventRegistry::builtin())
 enum EventType {
     EVENT_IR = 0,      // Instruction count
     EVENT_CYCLE = 1,   // Cycle count
@@ -27,6 +39,47 @@ enum EventType {
     EVENT_BIM = 5,     // Indirect branch mispredictions
 };
 
+// Named events with dense IDs in registration order. The generator sizes
+// its per-event storage to size(), so events nobody registered cost no
+// memory or bandwidth. Simulators add their own (stall reasons, cache
+// levels, ...) at startup and record with the returned IDs.
+class EventRegistry {
+private:
+    std::vector<std::string> event_names;
+    std::vector<std::string> long_names;
+    
+public:
+    static constexpr uint32_t INVALID = UINT32_MAX;
+    
+    // Ir, Cycle, Bc, Bcm, Bi, Bim at their EventType IDs
+    static EventRegistry builtin() {
+        EventRegistry registry;
+        for (const char* name : {"Ir", "Cycle", "Bc", "Bcm", "Bi", "Bim"}) {
+            registry.registerEvent(name);
+        }
+        return registry;
+    }
+    
+    // Returns the existing ID if the name is already registered
+    uint32_t registerEvent(const std::string& name, const std::string& long_name = "") {
+        uint32_t id = find(name);
+        if (id != INVALID) return id;
+        event_names.push_back(name);
+        long_names.push_back(long_name);
+        return static_cast<uint32_t>(event_names.size() - 1);
+    }
+    
+    uint32_t find(const std::string& name) const {
+        auto it = std::find(event_names.begin(), event_names.end(), name);
+        return it != event_names.end() ? static_cast<uint32_t>(it - event_names.begin()) : INVALID;
+    }
+    
+    size_t size() const { return event_names.size(); }
+    const std::string& name(uint32_t id) const { return event_names[id]; }
+    const std::string& longName(uint32_t id) const { return long_names[id]; }
+    const std::vector<std::string>& names() const { return event_names; }
+};
+
 // Branch types
 enum class BranchType {
     NONE,
@@ -45,6 +98,99 @@ enum class FunctionType {
     RESTORE_HELPER
 };
 
+// Opcode class of an instruction, resolved once per PC at load
+enum class OpClass : uint8_t {
+    ALU,
+    MUL_DIV,
+    LOAD,
+    STORE,
+    BRANCH,     // Branches, jumps, calls and returns
+    CSR,
+    FP,
+    VECTOR,
+    OTHER       // System instructions, fences, unknown PCs
+};
+
+constexpr size_t OP_CLASS_COUNT = static_cast<size_t>(OpClass::OTHER) + 1;
+constexpr const char* OP_CLASS_NAMES[OP_CLASS_COUNT] = {
+    "alu", "mul_div", "load", "store", "branch", "csr", "fp", "vector", "other"
+};
+
+// Classify a RISC-V objdump instruction ("mnemonic\toperands") by its mnemonic.
+// Compressed forms count as their base instruction; LR/SC/AMO count as memory.
+inline OpClass classifyOpClass(std::string_view assembly) {
+    std::string_view op = assembly.substr(0, assembly.find_first_of(" \t"));
+    if (op.substr(0, 2) == "c.") op.remove_prefix(2);
+    if (op.empty()) return OpClass::OTHER;
+    
+    auto starts = [op](std::string_view prefix) { return op.substr(0, prefix.size()) == prefix; };
+    auto any_of = [op](std::initializer_list<std::string_view> names) {
+        return std::find(names.begin(), names.end(), op) != names.end();
+    };
+    
+    if (any_of({"lb", "lh", "lw", "ld", "lbu", "lhu", "lwu", "lwsp", "ldsp",
+                "flw", "fld", "flh", "flq", "flwsp", "fldsp"}) || starts("lr.")) {
+        return OpClass::LOAD;
+    }
+    if (any_of({"sb", "sh", "sw", "sd", "swsp", "sdsp",
+                "fsw", "fsd", "fsh", "fsq", "fswsp", "fsdsp"}) || starts("sc.") || starts("amo")) {
+        return OpClass::STORE;
+    }
+    if (any_of({"beq", "bne", "blt", "bge", "bltu", "bgeu", "beqz", "bnez", "blez", "bgez",
+                "bltz", "bgtz", "bgt", "ble", "bgtu", "bleu",
+                "j", "jal", "jr", "jalr", "ret", "call", "tail"})) {
+        return OpClass::BRANCH;
+    }
+    if (starts("csr") || any_of({"rdcycle", "rdtime", "rdinstret", "rdcycleh", "rdtimeh", "rdinstreth",
+                                  "frcsr", "fscsr", "frrm", "fsrm", "frflags", "fsflags"})) {
+        return OpClass::CSR;
+    }
+    if (starts("fence") || any_of({"ecall", "ebreak", "wfi", "mret", "sret", "uret", "unimp"})) {
+        return OpClass::OTHER;
+    }
+    if (starts("mul") || starts("div") || starts("rem")) return OpClass::MUL_DIV;
+    if (op[0] == 'f') return OpClass::FP;
+    if (op[0] == 'v') return OpClass::VECTOR;
+    return OpClass::ALU;
+}
+
+// Atomic memory operations, for contention profiling (see recordAtomicAccess)
+enum class AtomicKind : uint8_t {
+    NONE,
+    LR,         // Load-reserved: opens a reservation
+    SC,         // Store-conditional: may fail
+    AMO         // Read-modify-write in one instruction
+};
+
+inline AtomicKind classifyAtomic(std::string_view assembly) {
+    std::string_view op = assembly.substr(0, assembly.find_first_of(" \t"));
+    if (op.substr(0, 3) == "lr.") return AtomicKind::LR;
+    if (op.substr(0, 3) == "sc.") return AtomicKind::SC;
+    if (op.substr(0, 3) == "amo") return AtomicKind::AMO;
+    return AtomicKind::NONE;
+}
+
+// Dynamic instruction counts per opcode class
+struct InstructionMix {
+    uint64_t ir[OP_CLASS_COUNT] = {};
+    
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (uint64_t count : ir) sum += count;
+        return sum;
+    }
+};
+
+// Energy cost model (see CallgrindGenerator::setEnergyModel), all in one
+// unit: energy per instruction of each opcode class, per count of a named
+// event (e.g. a cache miss or mispredict) and leakage per Cycle
+struct EnergyModel {
+    std::string unit = "pJ";
+    double op_class[OP_CLASS_COUNT] = {};
+    std::vector<std::pair<std::string, double>> events;
+    double leakage_per_cycle = 0.0;
+};
+
 // Per-PC information from objdump
 struct PCInfo {
     uint64_t pc;
@@ -52,22 +198,30 @@ struct PCInfo {
     std::string assembly;
     std::string file;
     uint32_t line;
-    uint64_t event[MAX_EVENTS];
+    uint32_t index;          // Dense PC index into the per-event cost columns
     FunctionType func_type;  // Cache function type
+    uint32_t fn_id;          // Interned func (see CallgrindGenerator::getFnId)
+    uint32_t loop_id;        // Loop headed at this PC, if profiled (0 = none)
+    OpClass op_class;
+    AtomicKind atomic;
     
-    PCInfo() : pc(0), line(0), func_type(FunctionType::NORMAL) {
-        std::fill(std::begin(event), std::end(event), 0);
-    }
+    PCInfo() : pc(0), line(0), index(0), func_type(FunctionType::NORMAL), fn_id(0), loop_id(0),
+               op_class(OpClass::OTHER), atomic(AtomicKind::NONE) {}
 };
 
-// Target information for calls (includes inclusive costs)
+// Target information for calls; inclusive costs live in the generator's
+// edge cost table, one row of registered events per edge_id
 struct CallTargetInfo {
     uint64_t count;
-    uint64_t inclusive_events[MAX_EVENTS];
+    uint32_t edge_id;    // Dense, assigned when the edge is first taken
     
-    CallTargetInfo() : count(0) {
-        std::fill(std::begin(inclusive_events), std::end(inclusive_events), 0);
-    }
+    CallTargetInfo() : count(0), edge_id(0) {}
+};
+
+// Call count and inclusive costs of one call edge (see CallgrindGenerator::callEdge)
+struct CallEdgeCost {
+    uint64_t count = 0;
+    std::vector<uint64_t> inclusive_events;   // Indexed by event ID
 };
 
 // Branch information for conditional branches (always exactly 2 targets)
@@ -77,80 +231,1649 @@ struct BranchInfo {
     uint64_t taken_count;
     uint64_t fallthrough_target;
     uint64_t fallthrough_count;
+    uint32_t history_slot;  // Index + 1 into the branch history recorder (0 = not tracked)
     
     BranchInfo() : total_executed(0), taken_target(0), taken_count(0), 
-                   fallthrough_target(0), fallthrough_count(0) {}
+                   fallthrough_target(0), fallthrough_count(0), history_slot(0) {}
+};
+
+// Outcome history of one hot conditional branch (see enableBranchHistory).
+// The ring keeps the latest outcomes; the counters cover every outcome
+// since the branch was selected. Per-pattern counts for its local history
+// live in the generator's flat pattern table.
+struct BranchHistory {
+    static constexpr size_t RING_WORDS = 16;  // Last 1024 outcomes
+    uint64_t pc;
+    uint64_t ring[RING_WORDS];
+    uint64_t outcomes;
+    uint64_t taken;
+    uint64_t transitions;     // Outcome differs from the previous one
+    uint64_t bimodal_correct; // Alias-free 2-bit counter predictions
+    uint32_t local_history;   // Latest outcomes, newest in bit 0
+    uint8_t counter;          // 2-bit saturating counter state
+    
+    explicit BranchHistory(uint64_t branch_pc)
+        : pc(branch_pc), outcomes(0), taken(0), transitions(0), bimodal_correct(0),
+          local_history(0), counter(2) {
+        std::fill(std::begin(ring), std::end(ring), 0);
+    }
+    
+    // patterns: taken/total count pairs indexed by local history
+    inline void record(bool is_taken, uint32_t* patterns, uint32_t history_mask) {
+        uint32_t* pattern = patterns + 2 * (local_history & history_mask);
+        pattern[0] += is_taken;
+        ++pattern[1];
+        
+        bimodal_correct += (counter >= 2) == is_taken;
+        if (is_taken) {
+            counter += counter < 3;
+        } else {
+            counter -= counter > 0;
+        }
+        
+        transitions += outcomes != 0 && (local_history & 1) != uint32_t(is_taken);
+        local_history = (local_history << 1) | uint32_t(is_taken);
+        
+        const size_t bit = outcomes % (RING_WORDS * 64);
+        ring[bit / 64] = (ring[bit / 64] & ~(uint64_t(1) << (bit % 64))) | (uint64_t(is_taken) << (bit % 64));
+        ++outcomes;
+        taken += is_taken;
+    }
+};
+
+// Predictability of one branch site over its recorded outcomes
+struct BranchPredictability {
+    uint64_t pc;
+    std::string func;
+    uint64_t outcomes;
+    double taken_rate;
+    double entropy;               // Bits per outcome, ignoring history
+    double conditional_entropy;   // Bits per outcome given the local history
+    double transition_rate;
+    double static_accuracy;       // Always predict the majority direction
+    double bimodal_accuracy;      // Per-site 2-bit counter (no aliasing)
+    double local_accuracy;        // Best predictor keyed by the local history
+    double modeled_mispredict_rate;  // Bcm/Bc from the generator's own model
+    uint64_t recent;              // Latest 64 outcomes, newest in bit 0
+};
+
+// Loop found from observed back-edges: the header is the back-edge target
+// and the body spans [header_pc, end_pc] up to the furthest latch seen.
+// This matches the natural loop for the usual layout (body contiguous after
+// the header); recursion re-entering an open loop shares its activation.
+constexpr size_t LOOP_TRIP_BUCKETS = 32;
+
+struct LoopInfo {
+    uint64_t header_pc;
+    uint64_t end_pc;
+    uint32_t fn_id;
+    uint64_t entries;         // Activations entered from outside the body
+    uint64_t iterations;      // Trips summed over closed activations
+    uint64_t max_trips;
+    uint64_t trip_histogram[LOOP_TRIP_BUCKETS];  // Bucket k: trips in [2^k, 2^(k+1))
+    uint64_t current_trips;   // Trips of the open activation (0 = none)
+    
+    LoopInfo(uint64_t header, uint64_t end, uint32_t fn)
+        : header_pc(header), end_pc(end), fn_id(fn), entries(0), iterations(0),
+          max_trips(0), current_trips(0) {
+        std::fill(std::begin(trip_histogram), std::end(trip_histogram), 0);
+    }
+    
+    void closeActivation() {
+        if (current_trips == 0) return;
+        iterations += current_trips;
+        max_trips = std::max(max_trips, current_trips);
+        size_t bucket = 63 - __builtin_clzll(current_trips);
+        ++trip_histogram[std::min(bucket, LOOP_TRIP_BUCKETS - 1)];
+        current_trips = 0;
+    }
+    
+    void enter() {
+        closeActivation();
+        ++entries;
+        current_trips = 1;
+    }
+};
+
+// Log-linear (HDR-style) histogram of per-call durations. Values below
+// 2^SUB_BITS get exact buckets; every higher power of two is split into
+// 2^SUB_BITS buckets, so a bucket is never wider than 1/8 of its values.
+// Only the span of buckets between the shortest and longest call is
+// stored, which for one function is usually a few dozen counters.
+struct LatencyHistogram {
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = SUB_BUCKETS + (64 - SUB_BITS) * SUB_BUCKETS;
+    uint64_t calls;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    size_t first_bucket;                 // Bucket of counts[0]
+    std::pmr::vector<uint64_t> counts;   // Buckets first_bucket .. endBucket() - 1
+    
+    explicit LatencyHistogram(std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+        : calls(0), total(0), min(UINT64_MAX), max(0), first_bucket(0), counts(mr) {}
+    
+    static size_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+        const unsigned shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return SUB_BUCKETS + shift * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+    
+    static uint64_t bucketLow(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        const unsigned shift = static_cast<unsigned>((bucket - SUB_BUCKETS) / SUB_BUCKETS);
+        return (SUB_BUCKETS + (bucket - SUB_BUCKETS) % SUB_BUCKETS) << shift;
+    }
+    
+    static uint64_t bucketHigh(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        const unsigned shift = static_cast<unsigned>((bucket - SUB_BUCKETS) / SUB_BUCKETS);
+        return bucketLow(bucket) + ((uint64_t(1) << shift) - 1);
+    }
+    
+    inline void record(uint64_t duration) {
+        ++calls;
+        total += duration;
+        min = std::min(min, duration);
+        max = std::max(max, duration);
+        const size_t bucket = bucketOf(duration);
+        if (counts.empty()) {
+            first_bucket = bucket;
+            counts.push_back(0);
+        } else if (bucket < first_bucket) {
+            counts.insert(counts.begin(), first_bucket - bucket, 0);
+            first_bucket = bucket;
+        } else if (bucket >= endBucket()) {
+            counts.resize(bucket - first_bucket + 1, 0);
+        }
+        ++counts[bucket - first_bucket];
+    }
+    
+    size_t endBucket() const { return first_bucket + counts.size(); }
+    uint64_t count(size_t bucket) const {
+        return bucket >= first_bucket && bucket < endBucket() ? counts[bucket - first_bucket] : 0;
+    }
+    
+    // Duration at quantile q (0-1): the top of the bucket holding that
+    // rank, clamped to the observed range so exact buckets stay exact
+    uint64_t percentile(double q) const {
+        if (calls == 0) return 0;
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * calls)));
+        uint64_t seen = 0;
+        for (size_t b = first_bucket; b < endBucket(); ++b) {
+            seen += counts[b - first_bucket];
+            if (seen >= rank) return std::clamp(bucketHigh(b), min, max);
+        }
+        return max;
+    }
+};
+
+// Call duration summary for one function (see functionLatencies)
+struct FunctionLatency {
+    std::string func;
+    uint64_t calls;
+    uint64_t min;
+    double mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+// Atomic access counts for one site, lock or function
+struct AtomicCounts {
+    uint64_t accesses = 0;
+    uint64_t sc_failures = 0;
+    uint64_t spins = 0;       // Retries of the previous access (see recordAtomicAccess)
+    
+    void add(bool sc_failed, bool spin) {
+        ++accesses;
+        sc_failures += sc_failed;
+        spins += spin;
+    }
+};
+
+// One atomic instruction as executed by one hart
+struct AtomicSiteCounts {
+    uint64_t pc;
+    std::string func;
+    AtomicKind kind;
+    uint32_t hart;
+    AtomicCounts counts;
+};
+
+// One lock address and the functions that contend on it
+struct LockContention {
+    uint64_t address;
+    AtomicCounts counts;
+    uint64_t hart_mask;       // Bit h set if hart h (mod 64) accessed it
+    std::vector<std::pair<std::string, AtomicCounts>> functions;
+};
+
+// One weighted event in a derived-event formula
+struct EventTerm {
+    double coeff;
+    size_t event;    // Index into the configured events
+};
+
+// Event computed from the configured ones: a linear combination, or a
+// ratio of two ("Cycle / Ir"). Callgrind event: lines only carry linear
+// formulas with integer factors, so ratios are evaluated by the native
+// report (CallgrindGenerator::writeReport) instead.
+struct DerivedEvent {
+    std::string name;
+    std::string long_name;
+    std::vector<EventTerm> numerator;
+    std::vector<EventTerm> denominator;   // Empty for linear formulas
+    
+    static double sum(const std::vector<EventTerm>& terms, const uint64_t* events) {
+        double value = 0.0;
+        for (const auto& term : terms) value += term.coeff * events[term.event];
+        return value;
+    }
+    
+    double evaluate(const uint64_t* events) const {
+        double value = sum(numerator, events);
+        if (denominator.empty()) return value;
+        double divisor = sum(denominator, events);
+        return divisor != 0.0 ? value / divisor : 0.0;
+    }
+    
+    bool isCallgrindExpressible() const {
+        if (!denominator.empty()) return false;
+        for (const auto& term : numerator) {
+            if (term.coeff != std::floor(term.coeff)) return false;
+        }
+        return true;
+    }
+    
+    // "Ir + 10 * Bcm" form accepted by KCachegrind
+    std::string callgrindFormula(const std::vector<std::string>& event_names) const {
+        std::ostringstream out;
+        for (size_t i = 0; i < numerator.size(); ++i) {
+            const auto& term = numerator[i];
+            int64_t coeff = static_cast<int64_t>(term.coeff);
+            if (i > 0 || coeff < 0) out << (coeff < 0 ? (i > 0 ? " - " : "-") : " + ");
+            if (std::abs(coeff) != 1) out << std::abs(coeff) << " * ";
+            out << event_names[term.event];
+        }
+        return out.str();
+    }
+};
+
+// Parse a derived-event formula over event_names. Grammar:
+//   formula := side [ "/" side ]      side := linear | "(" linear ")"
+//   linear  := [+|-] term { (+|-) term }
+//   term    := number ["*"] event | event ["*" number] | event
+inline bool parseEventFormula(const std::string& formula, const std::vector<std::string>& event_names,
+                              DerivedEvent& derived, std::string& error) {
+    size_t pos = 0;
+    auto skip = [&]() { while (pos < formula.size() && std::isspace(static_cast<unsigned char>(formula[pos]))) ++pos; };
+    auto peek = [&]() { skip(); return pos < formula.size() ? formula[pos] : '\0'; };
+    auto number = [&](double& value) {
+        skip();
+        const char* start = formula.c_str() + pos;
+        char* end = nullptr;
+        value = std::strtod(start, &end);
+        if (end == start) return false;
+        pos += end - start;
+        return true;
+    };
+    auto event = [&](size_t& index) {
+        skip();
+        size_t start = pos;
+        while (pos < formula.size() && (std::isalnum(static_cast<unsigned char>(formula[pos])) || formula[pos] == '_')) ++pos;
+        std::string name = formula.substr(start, pos - start);
+        auto it = std::find(event_names.begin(), event_names.end(), name);
+        if (name.empty() || it == event_names.end()) {
+            error = name.empty() ? "expected an event name at offset " + std::to_string(start)
+                                 : "unknown event '" + name + "'";
+            return false;
+        }
+        index = it - event_names.begin();
+        return true;
+    };
+    auto linear = [&](std::vector<EventTerm>& terms) {
+        bool parenthesized = peek() == '(';
+        if (parenthesized) ++pos;
+        double sign = 1.0;
+        if (peek() == '+' || peek() == '-') sign = (formula[pos++] == '-') ? -1.0 : 1.0;
+        while (true) {
+            EventTerm term{sign, 0};
+            double coeff;
+            char c = peek();
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                if (!number(coeff)) { error = "bad number"; return false; }
+                term.coeff *= coeff;
+                if (peek() == '*') ++pos;
+            }
+            if (!event(term.event)) return false;
+            if (peek() == '*') {
+                ++pos;
+                if (!number(coeff)) { error = "expected a number after '*'"; return false; }
+                term.coeff *= coeff;
+            }
+            terms.push_back(term);
+            c = peek();
+            if (c != '+' && c != '-') break;
+            sign = (formula[pos++] == '-') ? -1.0 : 1.0;
+        }
+        if (parenthesized) {
+            if (peek() != ')') { error = "expected ')'"; return false; }
+            ++pos;
+        }
+        return true;
+    };
+    
+    derived.numerator.clear();
+    derived.denominator.clear();
+    if (!linear(derived.numerator)) return false;
+    if (peek() == '/') {
+        ++pos;
+        if (!linear(derived.denominator)) return false;
+    }
+    if (peek() != '\0') {
+        error = "unexpected '" + std::string(1, formula[pos]) + "' at offset " + std::to_string(pos);
+        return false;
+    }
+    return true;
+}
+
+// One retired instruction for CallgrindGenerator::recordRetire. Plain
+// data, so simulators can fill batches without touching the generator.
+struct RetireRecord {
+    uint64_t pc = 0;
+    uint64_t timestamp = 0;    // Core cycle counter at retirement
+    uint64_t blocking_pc = 0;  // Instruction this one waited on (0 = none)
+    int32_t dest_reg = -1;     // Written register (-1 = none)
+    uint8_t is_branch = 0;
+    uint8_t is_vector = 0;     // vl/vtype below are valid (see recordVector)
+    uint16_t vtype = 0;        // vtype CSR, low bits (vlmul 2:0, vsew 5:3)
+    uint32_t vl = 0;
 };
 
-// Call stack entry
-struct CallStackEntry {
+// Self costs at one point of a run, handed to a snapshot sink (see
+// CallgrindGenerator::setSnapshotSink). The recorder only copies its per-PC
+// cost columns; the consumer folds them into per-function rows with fold(),
+// off the recording thread. Name and PC tables are shared between
+// snapshots and only rebuilt when they grow.
+struct ProfileSnapshot {
+    uint64_t sequence = 0;
+    uint64_t instructions = 0;
+    uint64_t run = 0;                                            // Bumped by reset()
+    std::shared_ptr<const std::vector<std::string>> events;      // Event ID -> name
+    std::shared_ptr<const std::vector<std::string>> functions;   // fn_id -> name (0 = no function)
+    std::shared_ptr<const std::vector<uint32_t>> pc_functions;   // PC index -> fn_id
+    std::vector<uint64_t> pc_costs;                              // One column of PC indices per event
+    std::vector<uint64_t> costs;                                 // One row of events per fn_id (see fold)
+    
+    void fold() {
+        if (!events || !functions || !pc_functions) return;
+        const size_t stride = events->size();
+        const size_t pcs = pc_functions->size();
+        costs.assign(functions->size() * stride, 0);
+        for (size_t i = 0; i < stride; ++i) {
+            const uint64_t* column = pc_costs.data() + i * pcs;
+            for (size_t pc = 0; pc < pcs; ++pc) costs[(*pc_functions)[pc] * stride + i] += column[pc];
+        }
+    }
+};
+
+// Profiler self-instrumentation snapshot (see CallgrindGenerator::getStats)
+struct GeneratorStats {
+    uint64_t instructions_recorded = 0;
+    uint64_t sampled_records = 0;      // Records timed with the cycle counter
+    double ns_per_record = 0.0;        // Mean cost of recordExecution over the samples
+    
+    size_t pc_entries = 0;
+    double pc_load_factor = 0.0;
+    size_t call_sites = 0;
+    size_t call_edges = 0;
+    double call_load_factor = 0.0;
+    size_t jump_sites = 0;
+    size_t jump_edges = 0;
+    double jump_load_factor = 0.0;
+    size_t branch_sites = 0;
+    double branch_load_factor = 0.0;
+    size_t edge_table_bytes = 0;       // Estimated size of calls/jumps and edge costs
+    size_t spill_runs = 0;             // Runs in the spill file (see setMemoryBudget)
+    uint64_t spilled_edges = 0;        // Edge records evicted to it
+    
+    size_t call_stack_depth = 0;
+    size_t call_stack_max_depth = 0;
+    uint64_t call_stack_overflows = 0; // Calls made beyond the stack capacity
+    uint64_t resync_count = 0;         // Returns/tail calls seen with an empty call stack
+    
+    uint64_t stall_cycles_split = 0;   // Cycles charged to blocking instructions
+    
+    size_t call_log_records = 0;       // Deferred call/return records not yet folded
+    uint64_t call_log_folds = 0;
+    
+    uint64_t bytes_written = 0;        // Size of the last callgrind dump
+    double dump_wall_ms = 0.0;         // Wall time of the last callgrind dump
+};
+
+// Write stats as a single JSON object (no trailing newline)
+inline void writeStatsJson(std::ostream& out, const GeneratorStats& s) {
+    out << "{\"instructions_recorded\":" << s.instructions_recorded
+        << ",\"sampled_records\":" << s.sampled_records
+        << ",\"ns_per_record\":" << s.ns_per_record
+        << ",\"pc_entries\":" << s.pc_entries
+        << ",\"pc_load_factor\":" << s.pc_load_factor
+        << ",\"call_sites\":" << s.call_sites
+        << ",\"call_edges\":" << s.call_edges
+        << ",\"call_load_factor\":" << s.call_load_factor
+        << ",\"jump_sites\":" << s.jump_sites
+        << ",\"jump_edges\":" << s.jump_edges
+        << ",\"jump_load_factor\":" << s.jump_load_factor
+        << ",\"branch_sites\":" << s.branch_sites
+        << ",\"branch_load_factor\":" << s.branch_load_factor
+        << ",\"edge_table_bytes\":" << s.edge_table_bytes
+        << ",\"spill_runs\":" << s.spill_runs
+        << ",\"spilled_edges\":" << s.spilled_edges
+        << ",\"call_stack_depth\":" << s.call_stack_depth
+        << ",\"call_stack_max_depth\":" << s.call_stack_max_depth
+        << ",\"call_stack_overflows\":" << s.call_stack_overflows
+        << ",\"resync_count\":" << s.resync_count
+        << ",\"stall_cycles_split\":" << s.stall_cycles_split
+        << ",\"call_log_records\":" << s.call_log_records
+        << ",\"call_log_folds\":" << s.call_log_folds
+        << ",\"bytes_written\":" << s.bytes_written
+        << ",\"dump_wall_ms\":" << s.dump_wall_ms << "}";
+}
+
+// Call stack frame; its event snapshot lives in CallStack's parallel buffer
+struct CallFrame {
     uint64_t caller_pc;
     uint64_t callee_pc;
-    std::string caller_func;
-    std::string callee_func;
-    uint64_t events_at_entry[MAX_EVENTS];
+    uint64_t return_pc;       // Where the matching return lands (caller's next instruction)
+    uint32_t caller_fn;       // Function IDs (PCInfo::fn_id)
+    uint32_t callee_fn;
     bool is_tail_call;
+    uint32_t chained_tail_calls;  // Deferred mode: tail calls folded into this frame
+    uint64_t entry_time;          // Latency clock at entry (see enableLatencyHistograms)
+};
+
+// Deferred call log record: an entry into edge_id, or an exit closing the
+// last exit_frames open entries (a frame plus the tail calls chained to it)
+struct CallLogRecord {
+    uint32_t edge_id;
+    uint32_t exit_frames;  // 0 = entry
+};
+
+// Fixed-capacity contiguous call stack. Frames and event snapshots sit in
+// preallocated buffers, so push/pop are plain stores. Calls beyond the
+// capacity (runaway recursion) only bump a virtual depth: the outermost
+// frames, which carry the large inclusive costs, stay exact, and the
+// innermost retained frame stands in for return detection (recursive
+// frames share their return address).
+class CallStack {
+private:
+    std::pmr::vector<CallFrame> frames;
+    std::pmr::vector<CallFrame> virtual_frames;  // Ring of the frames beyond capacity, for return matching only
+    std::pmr::vector<uint64_t> snapshots;        // capacity x stride
+    std::pmr::vector<uint64_t> depth_histogram;  // Pushes per depth; last bucket = deeper
+    size_t cap;
+    size_t stride;
+    size_t depth;       // Logical depth, including virtual frames
+    size_t valid;       // Frames actually stored
+    size_t max_depth;
+    uint64_t overflows;
+    
+public:
+    explicit CallStack(std::pmr::memory_resource* mr)
+        : frames(mr), virtual_frames(mr), snapshots(mr), depth_histogram(mr),
+          cap(0), stride(0), depth(0), valid(0), max_depth(0), overflows(0) {}
+    
+    // stride = events per snapshot
+    void init(size_t capacity, size_t event_stride) {
+        cap = std::max<size_t>(capacity, 1);
+        stride = event_stride;
+        frames.assign(cap, CallFrame{});
+        virtual_frames.assign(cap, CallFrame{});
+        snapshots.assign(cap * stride, 0);
+        depth_histogram.assign(cap + 1, 0);
+        depth = valid = max_depth = 0;
+        overflows = 0;
+    }
+    
+    inline void push(const CallFrame& frame, const uint64_t* events) {
+        if (valid < cap) {
+            frames[valid] = frame;
+            std::copy(events, events + stride, snapshots.data() + valid * stride);
+            ++valid;
+        } else {
+            virtual_frames[(depth - valid) % cap] = frame;
+            ++overflows;
+        }
+        ++depth;
+        max_depth = std::max(max_depth, depth);
+        ++depth_histogram[std::min(depth, cap)];
+    }
+    
+    inline bool empty() const { return valid == 0; }
+    inline bool full() const { return valid == cap; }
+    inline bool topIsRetained() const { return depth == valid; }
+    inline const CallFrame& top() const { return frames[valid - 1]; }
+    // The logical top, virtual or not. Only the last cap virtual frames are
+    // kept, which is exact for recursion (its frames repeat) and for any
+    // chain less than twice the capacity deep.
+    inline const CallFrame& innermost() const {
+        return depth == valid ? frames[valid - 1] : virtual_frames[(depth - valid - 1) % cap];
+    }
+    inline const uint64_t* topEvents() const { return snapshots.data() + (valid - 1) * stride; }
+    inline void chainTailCall() { ++frames[valid - 1].chained_tail_calls; }
+    inline void pop() {
+        if (depth == valid) --valid;
+        --depth;
+    }
+    
+    size_t logicalDepth() const { return depth; }
+    size_t maxDepth() const { return max_depth; }
+    size_t capacity() const { return cap; }
+    uint64_t overflowCount() const { return overflows; }
+    const std::pmr::vector<uint64_t>& depthHistogram() const { return depth_histogram; }
+};
+
+// Edge records evicted under a memory budget (see setMemoryBudget). Every
+// eviction appends one run to the spill file: the call records, then the
+// jump records, each sorted by (from_pc, to_pc). A record is from_pc,
+// to_pc and count, followed for calls by the run's stride of inclusive
+// costs. Runs add up, so an edge may appear in several of them.
+struct SpillRun {
+    uint64_t offset;  // Of the first call record
+    uint64_t calls;
+    uint64_t jumps;
+    uint32_t stride;  // Events per call record
+    
+    size_t callWidth() const { return 3 + stride; }
+    uint64_t jumpOffset() const { return offset + calls * callWidth() * sizeof(uint64_t); }
+    uint64_t end() const { return jumpOffset() + jumps * 3 * sizeof(uint64_t); }
+};
+
+// Sort flat records of width words by (from_pc, to_pc), summing the count
+// and costs of duplicates
+inline void combineEdgeRecords(std::vector<uint64_t>& records, size_t width) {
+    const size_t n = records.size() / width;
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const uint64_t* ra = records.data() + a * width;
+        const uint64_t* rb = records.data() + b * width;
+        return ra[0] != rb[0] ? ra[0] < rb[0] : ra[1] < rb[1];
+    });
+    std::vector<uint64_t> combined;
+    combined.reserve(records.size());
+    for (size_t i : order) {
+        const uint64_t* r = records.data() + i * width;
+        uint64_t* last = combined.empty() ? nullptr : combined.data() + combined.size() - width;
+        if (last && last[0] == r[0] && last[1] == r[1]) {
+            for (size_t w = 2; w < width; ++w) last[w] += r[w];
+        } else {
+            combined.insert(combined.end(), r, r + width);
+        }
+    }
+    records.swap(combined);
+}
+
+// Sequential reader over the call or jump section of one run. Records
+// come out width words wide: costs beyond the run's stride read as 0.
+class SpillCursor {
+private:
+    std::ifstream in;
+    uint64_t remaining;
+    size_t file_width;
+    std::vector<uint64_t> record;
+    
+public:
+    SpillCursor(const std::string& path, const SpillRun& run, bool call_section, size_t width)
+        : in(path, std::ios::binary),
+          remaining(call_section ? run.calls : run.jumps),
+          file_width(call_section ? run.callWidth() : 3),
+          record(std::max(width, file_width), 0) {
+        in.seekg(static_cast<std::streamoff>(call_section ? run.offset : run.jumpOffset()));
+        next();
+    }
+    
+    bool valid() const { return !record.empty(); }
+    const uint64_t* current() const { return record.data(); }
+    
+    void next() {
+        if (remaining == 0 || !in.read(reinterpret_cast<char*>(record.data()), file_width * sizeof(uint64_t))) {
+            record.clear();
+            return;
+        }
+        --remaining;
+    }
 };
 
-class CallgrindGenerator {
+// Spilled records of every run, visited in ascending from_pc
+class SpillMerger {
 private:
+    std::vector<SpillCursor> cursors;
+    size_t width;
+    
+public:
+    SpillMerger(const std::string& path, const std::vector<SpillRun>& runs, bool call_section, size_t width)
+        : width(width) {
+        cursors.reserve(runs.size());
+        for (const SpillRun& run : runs) cursors.emplace_back(path, run, call_section, width);
+    }
+    
+    // Smallest from_pc not yet collected; false once every run is drained
+    bool nextPc(uint64_t& pc) const {
+        bool found = false;
+        for (const SpillCursor& cursor : cursors) {
+            if (cursor.valid() && (!found || cursor.current()[0] < pc)) {
+                pc = cursor.current()[0];
+                found = true;
+            }
+        }
+        return found;
+    }
+    
+    // Whether records leave pc; records below pc are skipped for good
+    bool has(uint64_t pc) {
+        for (SpillCursor& cursor : cursors) {
+            while (cursor.valid() && cursor.current()[0] < pc) cursor.next();
+            if (cursor.valid() && cursor.current()[0] == pc) return true;
+        }
+        return false;
+    }
+    
+    // Append the records leaving pc; records below pc are skipped for good
+    void collect(uint64_t pc, std::vector<uint64_t>& out) {
+        for (SpillCursor& cursor : cursors) {
+            while (cursor.valid() && cursor.current()[0] < pc) cursor.next();
+            while (cursor.valid() && cursor.current()[0] == pc) {
+                out.insert(out.end(), cursor.current(), cursor.current() + width);
+                cursor.next();
+            }
+        }
+    }
+};
+
+// Conditional branch misprediction models for Bcm (a generator policy's
+// Predictor). mispredicted() sees the site's counts with this outcome
+// already included.
+struct MinorityPathPredictor {
+    static constexpr bool enabled = true;
+    
+    // Outcomes on the less frequent path count as mispredicted
+    static inline bool mispredicted(const BranchInfo& branch, bool taken, bool backward) {
+        (void)taken;
+        (void)backward;
+        if (branch.taken_count == 0 || branch.fallthrough_count == 0 || branch.total_executed <= 1) return false;
+        const uint64_t minority = std::min(branch.taken_count, branch.fallthrough_count);
+        return minority == branch.taken_count || minority == branch.fallthrough_count;
+    }
+};
+
+struct StaticBtfnPredictor {
+    static constexpr bool enabled = true;
+    
+    // Backward taken, forward not taken; a not-taken branch with no taken
+    // target seen yet is assumed to be forward
+    static inline bool mispredicted(const BranchInfo& branch, bool taken, bool backward) {
+        (void)branch;
+        return taken != backward;
+    }
+};
+
+struct NoPredictor {
+    static constexpr bool enabled = false;
+    
+    static inline bool mispredicted(const BranchInfo&, bool, bool) { return false; }
+};
+
+// Compile-time feature set of BasicCallgrindGenerator. A disabled feature
+// is compiled out of the record path; an enabled one keeps its runtime
+// switch (setOptions, setLoopProfiling, ...).
+struct DefaultGeneratorPolicy {
+    static constexpr bool track_control_flow = true;  // Branch classification, call graph, inclusive costs
+    static constexpr bool collect_jumps = true;       // Branch/jump tables, Bc/Bcm/Bi/Bim
+    static constexpr bool helper_aware = true;        // __riscv_save/__riscv_restore as part of their caller
+    static constexpr bool instrumentation = true;     // Sampled self-timing, stats log, hot-branch selection
+    using Predictor = MinorityPathPredictor;
+};
+
+// Call graph without jump tables or branch events
+struct CallGraphGeneratorPolicy : DefaultGeneratorPolicy {
+    static constexpr bool collect_jumps = false;
+    static constexpr bool instrumentation = false;
+    using Predictor = NoPredictor;
+};
+
+// Flat per-PC self costs only: a record is a PC lookup and a counter add
+struct IrOnlyGeneratorPolicy {
+    static constexpr bool track_control_flow = false;
+    static constexpr bool collect_jumps = false;
+    static constexpr bool helper_aware = false;
+    static constexpr bool instrumentation = false;
+    using Predictor = NoPredictor;
+};
+
+#define CALLGRIND_GENERATOR_POLICIES 1
+
+template <typename Policy>
+class BasicCallgrindGenerator {
+    // Benchmarks drive detectBranchType/handleBranch directly
+    friend struct CallgrindBenchAccess;
+    
+private:
+    // Arenas (declared first so they outlive every container using them).
+    // The image arena lives as long as the generator; the run arena holds
+    // edges and the call stack and is released in bulk by reset(). The pool
+    // recycles nodes and buffers the run tables free while recording.
+    // Not arena-backed: the PCInfo and fn_names strings (image lifetime,
+    // written once at load) and the outer cost_columns vector (one entry
+    // per event; the columns themselves come from the pool).
+    static constexpr size_t IMAGE_ARENA_INITIAL = 1 << 20;
+    static constexpr size_t RUN_ARENA_INITIAL = 1 << 20;
+    std::pmr::monotonic_buffer_resource image_arena;
+    std::pmr::monotonic_buffer_resource run_arena;
+    std::pmr::unsynchronized_pool_resource run_pool;
+    
     // Main data
-    std::unordered_map<uint64_t, PCInfo> info;
+    std::pmr::unordered_map<uint64_t, PCInfo> info;
+    
+    // Self cost, one column per event ID indexed by PCInfo::index, so a
+    // record touches only the column of the event it counts
+    std::vector<std::pmr::vector<uint64_t>> cost_columns;
     
     // Control flow tracking - unified structure
-    std::unordered_map<uint64_t, std::unordered_map<uint64_t, CallTargetInfo>> calls;  // from_pc -> (to_pc -> CallTargetInfo)
-    std::unordered_map<uint64_t, std::unordered_map<uint64_t, uint64_t>> jumps;        // from_pc -> (to_pc -> count)
-    std::unordered_map<uint64_t, BranchInfo> branches;                                 // from_pc -> BranchInfo
+    std::pmr::unordered_map<uint64_t, std::pmr::unordered_map<uint64_t, CallTargetInfo>> calls;  // from_pc -> (to_pc -> CallTargetInfo)
+    std::pmr::unordered_map<uint64_t, std::pmr::unordered_map<uint64_t, uint64_t>> jumps;        // from_pc -> (to_pc -> count)
+    std::pmr::unordered_map<uint64_t, BranchInfo> branches;                                      // from_pc -> BranchInfo
+    
+    // Memory budget for calls/jumps and the edge cost rows (see
+    // setMemoryBudget); 0 = unbounded. Sizes are estimates kept up to date
+    // on insertion.
+    static constexpr size_t SITE_BYTES = 2 * sizeof(void*) + sizeof(uint64_t) +
+        sizeof(std::pmr::unordered_map<uint64_t, uint64_t>);
+    static constexpr size_t JUMP_EDGE_BYTES = 2 * sizeof(void*) + 2 * sizeof(uint64_t);
+    static constexpr size_t CALL_EDGE_BYTES = 3 * sizeof(void*) + sizeof(uint64_t) + sizeof(CallTargetInfo);
+    static constexpr size_t MAX_SPILL_RUNS = 16;  // More are merged into one
+    size_t memory_budget;
+    size_t edge_table_bytes;
+    std::string spill_path;
+    std::ofstream spill_out;
+    std::vector<SpillRun> spill_runs;
+    uint64_t spilled_edges;
+    
+    // Function name interning (IDs start at 1; 0 = no function)
+    std::pmr::unordered_map<std::string, uint32_t> fn_id_map;
+    std::pmr::vector<std::string> fn_names;
+    uint32_t unknown_fn_id;
+    
+    // Inclusive cost per call edge: one row of event IDs per edge_id
+    std::pmr::vector<CallTargetInfo*> edge_targets;  // edge_id -> edge (0 unused)
+    std::pmr::vector<uint64_t> edge_costs;
     
     // Runtime state
-    std::stack<CallStackEntry> call_stack;
+    static constexpr size_t DEFAULT_CALL_STACK_CAPACITY = 4096;
+    CallStack call_stack;
+    size_t call_stack_capacity;
     uint64_t last_pc;
     int last_dest_reg;
     bool last_was_branch;
     uint32_t last_inst_size;
-    uint64_t accumulated_events[MAX_EVENTS];
+    std::vector<uint64_t> accumulated_events;        // Per event ID
+    
+    // Deferred inclusive costs (see setDeferredInclusive). Calls and returns
+    // append a record plus an accumulated-counter snapshot; foldCallLog()
+    // replays them into the edges. Entries still open after a fold carry over.
+    static constexpr size_t DEFAULT_CALL_LOG_LIMIT = 4096;  // Keeps the pending log cache-resident
+    bool deferred_inclusive;
+    size_t call_log_limit;
+    uint64_t call_log_folds;
+    std::pmr::vector<CallLogRecord> call_log;
+    std::pmr::vector<uint64_t> call_log_counters;    // stride per record
+    std::pmr::vector<uint32_t> open_edges;
+    std::pmr::vector<uint64_t> open_counters;        // stride per open edge
+    
+    // Branch history recorder (see enableBranchHistory)
+    size_t branch_history_top_n;
+    uint64_t branch_history_warmup;
+    uint64_t branch_history_start;   // Hot sites are picked at this record count (0 = done/off)
+    uint32_t branch_history_bits;
+    std::pmr::vector<BranchHistory> branch_history;
+    std::pmr::vector<uint32_t> branch_patterns;  // 2 << bits per tracked branch
+    
+    // Per-call duration histograms (see enableLatencyHistograms). Only
+    // functions that return get one: latency_slots maps fn_id -> slot + 1.
+    std::string latency_event_name;
+    uint32_t latency_event;
+    std::pmr::vector<uint32_t> latency_slots;
+    std::pmr::vector<LatencyHistogram> latency;
+    
+    // Atomic contention (see recordAtomicAccess): per site and hart, and
+    // per lock address with the functions touching it
+    struct HartAtomicState {
+        bool valid = false;
+        bool failed = false;          // Failed SC or CAS
+        uint64_t pc = 0;
+        uint64_t address = 0;
+        uint64_t reservation_pc = 0;  // Latest LR
+        uint64_t at = 0;              // instructions_recorded at the access
+    };
+    struct LockState {
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+        explicit LockState(const allocator_type& alloc = {}) : by_fn(alloc) {}
+        
+        AtomicCounts counts;
+        uint64_t hart_mask = 0;
+        uint32_t last_hart = 0;
+        std::pmr::vector<std::pair<uint32_t, AtomicCounts>> by_fn;
+    };
+    static constexpr uint64_t DEFAULT_SPIN_WINDOW = 256;
+    uint64_t atomic_spin_window;
+    std::pmr::vector<HartAtomicState> hart_atomic;
+    std::pmr::unordered_map<uint64_t, std::pmr::vector<AtomicCounts>> atomic_sites;  // pc -> per hart
+    std::pmr::unordered_map<uint64_t, LockState> locks;
+    
+    // Energy estimation (see setEnergyModel), evaluated only at dump time
+    bool energy_enabled;
+    EnergyModel energy_model;
+    
+    // Loop profiling (see setLoopProfiling); PCInfo::loop_id indexes loops + 1
+    bool loop_profiling;
+    std::pmr::vector<LoopInfo> loops;
+    
+    // Track the real caller when in compiler helper functions
+    uint64_t real_caller_pc;
+    uint32_t real_caller_fn;
+    
+    // Configuration
+    std::string output_filename;
+    bool dump_instr;
+    bool branch_sim;
+    bool collect_jumps;
+    
+    // Event configuration; branch events are counted only if registered
+    EventRegistry events;
+    std::vector<DerivedEvent> derived_events;
+    uint32_t bc_event;
+    uint32_t bcm_event;
+    uint32_t bi_event;
+    uint32_t bim_event;
+    uint32_t ir_event;
+    uint32_t cycle_event;
+    uint32_t sc_fail_event;
+    uint32_t spin_event;
+    
+    // RVV utilization (see enableVectorProfiling); 0 = off
+    uint32_t vlen_bits;
+    uint32_t vinst_event;
+    uint32_t velem_event;
+    uint32_t vslots_event;
+    uint32_t vlmul_event;
+    
+    // Timestamp-driven cycle attribution (see recordRetire)
+    bool split_stalls;
+    bool have_retire_timestamp;
+    uint64_t last_retire_timestamp;
+    uint64_t stall_cycles_split;
+    
+    // Self-instrumentation (1 in STATS_SAMPLE_PERIOD records is timed)
+    static constexpr uint64_t STATS_SAMPLE_PERIOD = 1024;
+    uint64_t instructions_recorded;
+    uint64_t sampled_records;
+    uint64_t sampled_ticks;
+    uint64_t resync_count;
+    uint64_t bytes_written;
+    double dump_wall_ms;
+    uint64_t tsc_at_start;
+    std::chrono::steady_clock::time_point clock_at_start;
+    
+    // Optional periodic JSON-lines stats log
+    std::ofstream stats_log;
+    uint64_t stats_log_interval;
+    uint64_t next_stats_log;
+    
+    // Periodic per-function snapshots for live viewers (see setSnapshotSink)
+    std::function<void(ProfileSnapshot&)> snapshot_sink;
+    uint64_t snapshot_interval;
+    uint64_t next_snapshot;
+    uint64_t snapshot_run;
+    ProfileSnapshot snapshot;
+    
+    // Constants for helper function detection
+    static constexpr std::string_view SAVE_PREFIX = "__riscv_save";
+    static constexpr std::string_view RESTORE_PREFIX = "__riscv_restore";
+    
+    // Determine function type from name (called once when loading)
+    inline static FunctionType determineFunctionType(const std::string& func_name) {
+        std::string_view sv(func_name);
+        if (sv.substr(0, SAVE_PREFIX.size()) == SAVE_PREFIX) {
+            return FunctionType::SAVE_HELPER;
+        }
+        if (sv.substr(0, RESTORE_PREFIX.size()) == RESTORE_PREFIX) {
+            return FunctionType::RESTORE_HELPER;
+        }
+        return FunctionType::NORMAL;
+    }
+    
+    // Fast inline checks using cached type
+    inline bool isSaveHelper(FunctionType type) const {
+        return Policy::helper_aware && type == FunctionType::SAVE_HELPER;
+    }
+    
+    inline bool isRestoreHelper(FunctionType type) const {
+        return Policy::helper_aware && type == FunctionType::RESTORE_HELPER;
+    }
+    
+    inline bool isCompilerHelper(FunctionType type) const {
+        return Policy::helper_aware && type != FunctionType::NORMAL;
+    }
+    
+    uint32_t getFnId(const std::string& fnname) {
+        if (fnname.empty()) return 0;
+        auto it = fn_id_map.find(fnname);
+        if (it != fn_id_map.end()) return it->second;
+        uint32_t id = fn_names.size() + 1;
+        fn_id_map.emplace(fnname, id);
+        fn_names.push_back(fnname);
+        return id;
+    }
+    
+    // PCs loaded without a function name have fn_id 0; report them as unknown
+    const std::string& fnName(uint32_t fn_id) const {
+        return fn_names[(fn_id ? fn_id : unknown_fn_id) - 1];
+    }
+    
+    // Cost row width: one slot per registered event
+    size_t eventStride() const {
+        return events.size();
+    }
+    
+    // Call-stack snapshot width; deferred frames carry no snapshot
+    size_t frameStride() const {
+        return deferred_inclusive ? 0 : eventStride();
+    }
+    
+    // Insert a PC with the next dense index and a zero cost in every column
+    PCInfo& addPC(uint64_t pc) {
+        auto [it, inserted] = info.try_emplace(pc);
+        if (inserted) {
+            it->second.pc = pc;
+            it->second.index = static_cast<uint32_t>(info.size() - 1);
+            for (auto& column : cost_columns) column.push_back(0);
+        }
+        return it->second;
+    }
+    
+    // Resolve the control transfer from the previous instruction to this one
+    inline void advanceStream(const PCInfo& pc_info, int dest_reg, bool is_branch_instruction) {
+        const uint64_t pc = pc_info.pc;
+        
+        // Handle previous branch
+        if (last_pc != 0 && last_was_branch) {
+            bool is_sequential = (pc == last_pc + last_inst_size);
+            BranchType branch_type = detectBranchType(last_pc, pc, last_dest_reg, is_sequential);
+            handleBranch(last_pc, pc, branch_type, is_sequential);
+        }
+        
+        if (pc_info.loop_id != 0) {
+            noteLoopHeader(pc_info);
+        }
+        
+        // Update state
+        last_pc = pc;
+        last_dest_reg = dest_reg;
+        last_was_branch = is_branch_instruction;
+        last_inst_size = pc_info.assembly.empty() ? 4 : detectInstructionSize(pc_info.assembly);
+    }
+    
+    // Self-instrumentation and periodic work after each record
+    // True for the 1 in STATS_SAMPLE_PERIOD records that get timed
+    inline bool sampleRecord() {
+        ++instructions_recorded;
+        return Policy::instrumentation && (instructions_recorded % STATS_SAMPLE_PERIOD) == 0;
+    }
+    
+    inline void finishRecord(bool timed, uint64_t t_start) {
+        if constexpr (!Policy::instrumentation) return;
+        if (timed) {
+            sampled_ticks += readTimestamp() - t_start;
+            ++sampled_records;
+        }
+        if (stats_log_interval != 0 && instructions_recorded >= next_stats_log) {
+            logStats();
+        }
+        if (snapshot_interval != 0 && instructions_recorded >= next_snapshot) {
+            publishSnapshot();
+        }
+        if (branch_history_start != 0 && instructions_recorded >= branch_history_start) {
+            selectHotBranches();
+        }
+    }
+    
+    // Existing PC, or a new one attributed to "unknown". Unknown PCs are not
+    // bounded: each distinct one keeps a record and a cost slot per event
+    // until the image is reloaded, outside any memory budget.
+    PCInfo& lookupPC(uint64_t pc) {
+        auto it = info.find(pc);
+        if (it != info.end()) return it->second;
+        PCInfo& pc_info = addPC(pc);
+        pc_info.func = "unknown";
+        pc_info.file = "unknown";
+        pc_info.line = 0;
+        pc_info.func_type = FunctionType::NORMAL;
+        pc_info.fn_id = unknown_fn_id;
+        return pc_info;
+    }
+    
+    inline uint64_t pcCost(const PCInfo& pc_info, uint32_t event) const {
+        return cost_columns[event][pc_info.index];
+    }
+    
+    inline void countEvent(uint32_t event, uint64_t pc) {
+        if (event == EventRegistry::INVALID) return;
+        auto it = info.find(pc);
+        if (it != info.end()) ++cost_columns[event][it->second.index];
+    }
+    
+    // Look up or create a call edge; new edges get an ID and a zero cost row
+    CallTargetInfo& callTarget(uint64_t from_pc, uint64_t to_pc) {
+        auto& targets = calls[from_pc];
+        CallTargetInfo& call_info = targets[to_pc];
+        if (call_info.edge_id == 0) {
+            call_info.edge_id = static_cast<uint32_t>(edge_targets.size());
+            edge_targets.push_back(&call_info);
+            edge_costs.resize(edge_targets.size() * eventStride(), 0);
+            edge_table_bytes += callEdgeBytes() + (targets.size() == 1 ? SITE_BYTES : 0);
+            if (memory_budget != 0 && edge_table_bytes > memory_budget) {
+                spillColdEdges(call_info.edge_id);
+            }
+        }
+        return call_info;
+    }
+    
+    // Count a jump; returns the number of targets seen from from_pc
+    size_t countJump(uint64_t from_pc, uint64_t to_pc) {
+        auto& targets = jumps[from_pc];
+        auto [it, inserted] = targets.try_emplace(to_pc, 0);
+        ++it->second;
+        const size_t target_count = targets.size();
+        if (inserted) {
+            edge_table_bytes += JUMP_EDGE_BYTES + (target_count == 1 ? SITE_BYTES : 0);
+            if (memory_budget != 0 && edge_table_bytes > memory_budget) {
+                spillColdEdges(0, &it->second);
+            }
+        }
+        return target_count;
+    }
+    
+    size_t callEdgeBytes() const {
+        return CALL_EDGE_BYTES + eventStride() * sizeof(uint64_t);
+    }
+    
+    void recountEdgeTableBytes() {
+        edge_table_bytes = (calls.size() + jumps.size()) * SITE_BYTES;
+        for (const auto& [_, targets] : calls) edge_table_bytes += targets.size() * callEdgeBytes();
+        for (const auto& [_, targets] : jumps) edge_table_bytes += targets.size() * JUMP_EDGE_BYTES;
+    }
+    
+    // Evict the least counted call and jump edges until the tables are at
+    // 3/4 of the budget, appending them to the spill file as one run. The
+    // call edge keep_edge_id, the jump counted by keep_jump and, in deferred
+    // mode, edges still open on the call stack stay resident. Surviving
+    // edges are renumbered in place.
+    void spillColdEdges(uint32_t keep_edge_id, const uint64_t* keep_jump = nullptr) {
+        if (deferred_inclusive && !call_log.empty()) foldCallLog();
+        const size_t stride = eventStride();
+        const size_t target = memory_budget / 4 * 3;
+        if (edge_table_bytes <= target || !spill_out.is_open()) return;
+        
+        std::vector<uint8_t> pinned(edge_targets.size(), 0);
+        if (keep_edge_id != 0) pinned[keep_edge_id] = 1;
+        for (uint32_t id : open_edges) pinned[id] = 1;
+        
+        std::vector<uint64_t> counts;
+        for (const auto& [_, targets] : calls) {
+            for (const auto& [_, call_info] : targets) {
+                if (!pinned[call_info.edge_id]) counts.push_back(call_info.count);
+            }
+        }
+        for (const auto& [_, targets] : jumps) {
+            for (const auto& [_, count] : targets) {
+                if (&count != keep_jump) counts.push_back(count);
+            }
+        }
+        if (counts.empty()) return;
+        
+        // Evict the k coldest; of the edges at the threshold count, the
+        // first ones in table iteration order (calls, then jumps) go
+        const double fraction = static_cast<double>(edge_table_bytes - target) / edge_table_bytes;
+        size_t k = std::min(counts.size(), static_cast<size_t>(std::ceil(fraction * counts.size())));
+        std::nth_element(counts.begin(), counts.begin() + (k - 1), counts.end());
+        const uint64_t threshold = counts[k - 1];
+        size_t at_threshold = k - static_cast<size_t>(std::count_if(counts.begin(), counts.end(),
+            [threshold](uint64_t c) { return c < threshold; }));
+        auto evict = [&](uint64_t count) {
+            if (count < threshold) return true;
+            if (count == threshold && at_threshold != 0) {
+                --at_threshold;
+                return true;
+            }
+            return false;
+        };
+        
+        std::vector<uint64_t> call_records;
+        for (auto site = calls.begin(); site != calls.end();) {
+            auto& targets = site->second;
+            for (auto it = targets.begin(); it != targets.end();) {
+                const CallTargetInfo& call_info = it->second;
+                if (pinned[call_info.edge_id] || !evict(call_info.count)) {
+                    ++it;
+                    continue;
+                }
+                call_records.insert(call_records.end(), {site->first, it->first, call_info.count});
+                const uint64_t* inclusive = edgeCosts(call_info.edge_id);
+                call_records.insert(call_records.end(), inclusive, inclusive + stride);
+                edge_targets[call_info.edge_id] = nullptr;
+                it = targets.erase(it);
+            }
+            site = targets.empty() ? calls.erase(site) : std::next(site);
+        }
+        std::vector<uint64_t> jump_records;
+        for (auto site = jumps.begin(); site != jumps.end();) {
+            auto& targets = site->second;
+            for (auto it = targets.begin(); it != targets.end();) {
+                if (&it->second == keep_jump || !evict(it->second)) {
+                    ++it;
+                    continue;
+                }
+                jump_records.insert(jump_records.end(), {site->first, it->first, it->second});
+                it = targets.erase(it);
+            }
+            site = targets.empty() ? jumps.erase(site) : std::next(site);
+        }
+        
+        // Compact edge IDs and cost rows over the evicted edges
+        std::vector<uint32_t> remap(edge_targets.size(), 0);
+        uint32_t next_id = 1;
+        for (uint32_t id = 1; id < edge_targets.size(); ++id) {
+            CallTargetInfo* call_info = edge_targets[id];
+            if (!call_info) continue;
+            if (next_id != id) {
+                std::copy(edge_costs.begin() + id * stride, edge_costs.begin() + (id + 1) * stride,
+                          edge_costs.begin() + next_id * stride);
+                edge_targets[next_id] = call_info;
+                call_info->edge_id = next_id;
+            }
+            remap[id] = next_id++;
+        }
+        edge_targets.resize(next_id);
+        edge_costs.resize(next_id * stride);
+        for (uint32_t& id : open_edges) id = remap[id];
+        
+        combineEdgeRecords(call_records, 3 + stride);
+        combineEdgeRecords(jump_records, 3);
+        SpillRun run{spill_runs.empty() ? 0 : spill_runs.back().end(), call_records.size() / (3 + stride),
+                     jump_records.size() / 3, static_cast<uint32_t>(stride)};
+        spill_out.write(reinterpret_cast<const char*>(call_records.data()), call_records.size() * sizeof(uint64_t));
+        spill_out.write(reinterpret_cast<const char*>(jump_records.data()), jump_records.size() * sizeof(uint64_t));
+        spill_out.flush();
+        if (!spill_out) {
+            std::cerr << "Failed to write spill file: " << spill_path << std::endl;
+        }
+        spill_runs.push_back(run);
+        spilled_edges += run.calls + run.jumps;
+        recountEdgeTableBytes();
+        if (spill_runs.size() > MAX_SPILL_RUNS) mergeSpillRuns();
+    }
+    
+    // Rewrite the spill file as a single run, so dumps read a bounded
+    // number of runs side by side
+    void mergeSpillRuns() {
+        const size_t stride = eventStride();
+        const std::string merged_path = spill_path + ".merge";
+        std::ofstream merged(merged_path, std::ios::binary | std::ios::trunc);
+        if (!merged.is_open()) {
+            std::cerr << "Failed to open spill file: " << merged_path << std::endl;
+            return;
+        }
+        SpillRun run{0, 0, 0, static_cast<uint32_t>(stride)};
+        std::vector<uint64_t> records;
+        for (int call_section = 1; call_section >= 0; --call_section) {
+            const size_t width = call_section ? 3 + stride : 3;
+            SpillMerger spilled(spill_path, spill_runs, call_section, width);
+            uint64_t pc = 0;
+            while (spilled.nextPc(pc)) {
+                records.clear();
+                spilled.collect(pc, records);
+                combineEdgeRecords(records, width);
+                merged.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(uint64_t));
+                (call_section ? run.calls : run.jumps) += records.size() / width;
+            }
+        }
+        merged.close();
+        // On failure the existing runs stay valid; keep them and retry next spill
+        if (!merged) {
+            std::cerr << "Failed to write spill file: " << merged_path << std::endl;
+            std::remove(merged_path.c_str());
+            return;
+        }
+        spill_out.close();
+        const bool renamed = std::rename(merged_path.c_str(), spill_path.c_str()) == 0;
+        if (!renamed) {
+            std::cerr << "Failed to merge spill file: " << spill_path << std::endl;
+            std::remove(merged_path.c_str());
+        }
+        spill_out.open(spill_path, std::ios::binary | std::ios::app);
+        if (renamed) spill_runs.assign(1, run);
+    }
+    
+    void removeSpillFile() {
+        if (spill_path.empty()) return;
+        spill_out.close();
+        std::remove(spill_path.c_str());
+    }
+    
+    // Merged readers over the spill runs, or null if nothing was spilled
+    std::unique_ptr<SpillMerger> spilledCalls() const {
+        if (spill_runs.empty()) return nullptr;
+        return std::make_unique<SpillMerger>(spill_path, spill_runs, true, 3 + eventStride());
+    }
+    
+    std::unique_ptr<SpillMerger> spilledJumps() const {
+        if (spill_runs.empty()) return nullptr;
+        return std::make_unique<SpillMerger>(spill_path, spill_runs, false, 3);
+    }
+    
+    // fn(to_pc, count, inclusive) for every call edge leaving pc, spilled
+    // records included. With a spill, pcs must be visited in ascending order.
+    template <typename Fn>
+    void forEachCall(uint64_t pc, SpillMerger* spilled, std::vector<uint64_t>& scratch, Fn&& fn) const {
+        auto call_it = calls.find(pc);
+        if (!spilled) {
+            if (call_it == calls.end()) return;
+            for (const auto& [target_pc, call_info] : call_it->second) {
+                fn(target_pc, call_info.count, edgeCosts(call_info.edge_id));
+            }
+            return;
+        }
+        const size_t width = 3 + eventStride();
+        scratch.clear();
+        if (call_it != calls.end()) {
+            for (const auto& [target_pc, call_info] : call_it->second) {
+                scratch.insert(scratch.end(), {pc, target_pc, call_info.count});
+                const uint64_t* inclusive = edgeCosts(call_info.edge_id);
+                scratch.insert(scratch.end(), inclusive, inclusive + eventStride());
+            }
+        }
+        spilled->collect(pc, scratch);
+        combineEdgeRecords(scratch, width);
+        for (size_t r = 0; r < scratch.size(); r += width) {
+            fn(scratch[r + 1], scratch[r + 2], scratch.data() + r + 3);
+        }
+    }
+    
+    // fn(to_pc, count) for every jump edge leaving pc, as forEachCall
+    template <typename Fn>
+    void forEachJump(uint64_t pc, SpillMerger* spilled, std::vector<uint64_t>& scratch, Fn&& fn) const {
+        auto jump_it = jumps.find(pc);
+        if (!spilled) {
+            if (jump_it == jumps.end()) return;
+            for (const auto& [target_pc, count] : jump_it->second) fn(target_pc, count);
+            return;
+        }
+        scratch.clear();
+        if (jump_it != jumps.end()) {
+            for (const auto& [target_pc, count] : jump_it->second) {
+                scratch.insert(scratch.end(), {pc, target_pc, count});
+            }
+        }
+        spilled->collect(pc, scratch);
+        combineEdgeRecords(scratch, 3);
+        for (size_t r = 0; r < scratch.size(); r += 3) fn(scratch[r + 1], scratch[r + 2]);
+    }
+    
+    inline uint64_t* edgeCosts(uint32_t edge_id) {
+        return edge_costs.data() + edge_id * eventStride();
+    }
+    
+    inline const uint64_t* edgeCosts(uint32_t edge_id) const {
+        return edge_costs.data() + edge_id * eventStride();
+    }
+    
+    // Fit per-event storage to the registry after it changed. Costs of the
+    // first min(old, new) event IDs are kept; call-stack state is dropped,
+    // so events should be registered before recording starts.
+    void resizeEventStorage(size_t old_stride) {
+        const size_t stride = eventStride();
+        const size_t keep = std::min(old_stride, stride);
+        while (cost_columns.size() > stride) cost_columns.pop_back();
+        while (cost_columns.size() < stride) cost_columns.emplace_back(info.size(), 0, &run_pool);
+        
+        std::pmr::vector<uint64_t> restrided(edge_targets.size() * stride, 0, &run_pool);
+        for (size_t edge = 0; edge < edge_targets.size(); ++edge) {
+            std::copy(edge_costs.begin() + edge * old_stride, edge_costs.begin() + edge * old_stride + keep,
+                      restrided.begin() + edge * stride);
+        }
+        edge_costs.swap(restrided);
+        accumulated_events.resize(stride, 0);
+        
+        call_stack.init(call_stack_capacity, frameStride());
+        call_log.clear();
+        call_log_counters.clear();
+        open_edges.clear();
+        open_counters.clear();
+        
+        bc_event = events.find("Bc");
+        bcm_event = events.find("Bcm");
+        bi_event = events.find("Bi");
+        bim_event = events.find("Bim");
+        ir_event = events.find("Ir");
+        cycle_event = events.find("Cycle");
+        sc_fail_event = events.find("ScFail");
+        spin_event = events.find("Spin");
+        vinst_event = events.find("VInst");
+        velem_event = events.find("VElemOps");
+        vslots_event = events.find("VLaneSlots");
+        vlmul_event = events.find("VLmulEighths");
+        latency_event = latency_event_name.empty() ? EventRegistry::INVALID : events.find(latency_event_name);
+        recountEdgeTableBytes();
+    }
+    
+    inline uint64_t latencyClock() const {
+        return latency_event != EventRegistry::INVALID ? accumulated_events[latency_event] : 0;
+    }
+    
+    // Duration of a closing frame, charged to the function it entered
+    inline void recordLatency(const CallFrame& frame) {
+        if (latency_event == EventRegistry::INVALID) return;
+        if (frame.callee_fn >= latency_slots.size()) {
+            latency_slots.resize(fn_names.size() + 1, 0);
+        }
+        uint32_t& slot = latency_slots[frame.callee_fn];
+        if (slot == 0) {
+            latency.emplace_back(&run_pool);
+            slot = static_cast<uint32_t>(latency.size());
+        }
+        latency[slot - 1].record(accumulated_events[latency_event] - frame.entry_time);
+    }
+    
+    inline void logCallEnter(const CallTargetInfo& call_info) {
+        appendCallLog({call_info.edge_id, 0});
+    }
+    
+    inline void logCallExit(uint32_t frames) {
+        appendCallLog({0, frames});
+    }
+    
+    inline void appendCallLog(CallLogRecord record) {
+        call_log.push_back(record);
+        call_log_counters.insert(call_log_counters.end(), accumulated_events.begin(), accumulated_events.end());
+        if (call_log.size() >= call_log_limit) {
+            foldCallLog();
+        }
+    }
+    
+    // A taken backward branch within one function closes an iteration of the
+    // loop headed at its target (found here the first time it is taken)
+    void noteBackEdge(uint64_t latch_pc, typename decltype(info)::iterator header_it) {
+        PCInfo& header = header_it->second;
+        if (header.loop_id == 0) {
+            loops.emplace_back(header.pc, latch_pc, header.fn_id);
+            header.loop_id = static_cast<uint32_t>(loops.size());
+            // The activation in progress was entered before the loop was known
+            loops.back().enter();
+        }
+        LoopInfo& loop = loops[header.loop_id - 1];
+        loop.end_pc = std::max(loop.end_pc, latch_pc);
+        if (loop.current_trips == 0) {
+            loop.enter();
+        }
+        ++loop.current_trips;
+    }
+    
+    // Arriving at a loop header from outside the body starts an activation
+    inline void noteLoopHeader(const PCInfo& header) {
+        LoopInfo& loop = loops[header.loop_id - 1];
+        if (last_pc < loop.header_pc || last_pc > loop.end_pc) {
+            loop.enter();
+        }
+    }
+    
+    // Start recording outcomes of the branch_history_top_n most executed sites
+    void selectHotBranches() {
+        branch_history_start = 0;
+        std::vector<std::pair<uint64_t, BranchInfo*>> sites;
+        sites.reserve(branches.size());
+        for (auto& [pc, branch] : branches) {
+            branch.history_slot = 0;  // Drop any earlier selection
+            sites.emplace_back(pc, &branch);
+        }
+        
+        const size_t n = std::min(branch_history_top_n, sites.size());
+        std::partial_sort(sites.begin(), sites.begin() + n, sites.end(), [](const auto& a, const auto& b) {
+            return a.second->total_executed > b.second->total_executed;
+        });
+        
+        branch_history.clear();
+        branch_history.reserve(n);
+        branch_patterns.assign(n << (branch_history_bits + 1), 0);
+        for (size_t i = 0; i < n; ++i) {
+            branch_history.emplace_back(sites[i].first);
+            sites[i].second->history_slot = static_cast<uint32_t>(i + 1);
+        }
+    }
+    
+    BranchPredictability analyzeBranch(size_t slot) const {
+        const BranchHistory& h = branch_history[slot];
+        BranchPredictability r{};
+        r.pc = h.pc;
+        auto pc_it = info.find(h.pc);
+        r.func = pc_it != info.end() ? pc_it->second.func : "unknown";
+        r.outcomes = h.outcomes;
+        if (h.outcomes == 0) return r;
+        
+        auto binary_entropy = [](double p) {
+            return (p <= 0.0 || p >= 1.0) ? 0.0 : -(p * std::log2(p) + (1 - p) * std::log2(1 - p));
+        };
+        const double n = static_cast<double>(h.outcomes);
+        r.taken_rate = h.taken / n;
+        r.entropy = binary_entropy(r.taken_rate);
+        r.transition_rate = h.outcomes > 1 ? h.transitions / (n - 1) : 0.0;
+        r.static_accuracy = std::max(h.taken, h.outcomes - h.taken) / n;
+        r.bimodal_accuracy = h.bimodal_correct / n;
+        
+        const uint32_t* patterns = branch_patterns.data() + (slot << (branch_history_bits + 1));
+        uint64_t local_correct = 0;
+        for (size_t p = 0; p < (size_t(1) << branch_history_bits); ++p) {
+            const uint32_t taken = patterns[2 * p];
+            const uint32_t total = patterns[2 * p + 1];
+            if (total == 0) continue;
+            local_correct += std::max(taken, total - taken);
+            r.conditional_entropy += (total / n) * binary_entropy(double(taken) / total);
+        }
+        r.local_accuracy = local_correct / n;
+        
+        if (pc_it != info.end() && bc_event != EventRegistry::INVALID && bcm_event != EventRegistry::INVALID &&
+            pcCost(pc_it->second, bc_event)) {
+            r.modeled_mispredict_rate = double(pcCost(pc_it->second, bcm_event)) / pcCost(pc_it->second, bc_event);
+        }
+        for (uint64_t i = 0; i < std::min<uint64_t>(h.outcomes, 64); ++i) {
+            const size_t bit = (h.outcomes - 1 - i) % (BranchHistory::RING_WORDS * 64);
+            r.recent |= ((h.ring[bit / 64] >> (bit % 64)) & 1) << i;
+        }
+        return r;
+    }
+    
+    // Energy evaluated from the dense counters and the static decode. Self
+    // energy per PC is exact. On call edges the event and leakage terms come
+    // from the inclusive counters; the opcode-class term, which no counter
+    // tracks inclusively, uses the callee's own energy per instruction.
+    struct EnergyEstimate {
+        std::vector<uint64_t> self;          // Per PCInfo::index
+        std::vector<double> event_weight;    // Per event ID
+        std::vector<double> class_rate;      // Per fn_id: op-class energy per Ir
+        uint32_t ir_event;
+        
+        uint64_t edge(const uint64_t* inclusive, uint32_t callee_fn) const {
+            double energy = 0.0;
+            for (size_t i = 0; i < event_weight.size(); ++i) energy += event_weight[i] * inclusive[i];
+            if (ir_event != EventRegistry::INVALID) energy += class_rate[callee_fn] * inclusive[ir_event];
+            return static_cast<uint64_t>(std::llround(energy));
+        }
+    };
     
-    // Track the real caller when in compiler helper functions
-    uint64_t real_caller_pc;
-    std::string real_caller_func;
+    EnergyEstimate evaluateEnergy() const {
+        const size_t stride = eventStride();
+        const size_t num_pcs = info.size();
+        EnergyEstimate estimate;
+        estimate.ir_event = ir_event;
+        estimate.event_weight.assign(stride, 0.0);
+        for (const auto& [name, energy] : energy_model.events) {
+            const uint32_t id = events.find(name);
+            if (id != EventRegistry::INVALID) estimate.event_weight[id] += energy;
+        }
+        if (cycle_event != EventRegistry::INVALID) {
+            estimate.event_weight[cycle_event] += energy_model.leakage_per_cycle;
+        }
+        
+        // Column-wise passes over the dense counters
+        std::vector<double> class_weight(num_pcs, 0.0);
+        for (const auto& [_, pc_info] : info) {
+            class_weight[pc_info.index] = energy_model.op_class[static_cast<size_t>(pc_info.op_class)];
+        }
+        std::vector<double> class_energy(num_pcs, 0.0);
+        if (ir_event != EventRegistry::INVALID) {
+            const uint64_t* ir = cost_columns[ir_event].data();
+            for (size_t idx = 0; idx < num_pcs; ++idx) class_energy[idx] = class_weight[idx] * ir[idx];
+        }
+        std::vector<double> energy(class_energy);
+        for (size_t i = 0; i < stride; ++i) {
+            const double weight = estimate.event_weight[i];
+            if (weight == 0.0) continue;
+            const uint64_t* column = cost_columns[i].data();
+            for (size_t idx = 0; idx < num_pcs; ++idx) energy[idx] += weight * column[idx];
+        }
+        estimate.self.resize(num_pcs);
+        for (size_t idx = 0; idx < num_pcs; ++idx) {
+            estimate.self[idx] = static_cast<uint64_t>(std::llround(energy[idx]));
+        }
+        
+        std::vector<double> fn_class(fn_names.size() + 1, 0.0);
+        std::vector<double> fn_ir(fn_names.size() + 1, 0.0);
+        for (const auto& [_, pc_info] : info) {
+            fn_class[pc_info.fn_id] += class_energy[pc_info.index];
+            if (ir_event != EventRegistry::INVALID) fn_ir[pc_info.fn_id] += pcCost(pc_info, ir_event);
+        }
+        estimate.class_rate.assign(fn_names.size() + 1, 0.0);
+        for (size_t fn = 0; fn < fn_class.size(); ++fn) {
+            if (fn_ir[fn] > 0.0) estimate.class_rate[fn] = fn_class[fn] / fn_ir[fn];
+        }
+        return estimate;
+    }
     
-    // Configuration
-    std::string output_filename;
-    bool dump_instr;
-    bool branch_sim;
-    bool collect_jumps;
+    uint32_t fnIdAt(uint64_t pc) const {
+        auto it = info.find(pc);
+        return it != info.end() ? it->second.fn_id : unknown_fn_id;
+    }
     
-    // Event configuration
-    std::vector<std::string> event_names;
-    size_t num_events;
+    // Loop pseudo-functions for the callgrind dump, indexed by loop ID
+    struct LoopLayout {
+        std::vector<uint32_t> innermost;    // Per sorted PC (0 = not in a loop)
+        std::vector<uint32_t> parent;       // Enclosing loop (0 = the function)
+        std::vector<uint32_t> order;        // By header, outer loops first
+        std::vector<std::string> names;
+        std::vector<uint64_t> inclusive;    // Event row per loop: body self cost plus its calls
+        std::vector<uint64_t> energy;       // Per loop, same scope (when an energy model is set)
+    };
     
-    // Constants for helper function detection
-    static constexpr std::string_view SAVE_PREFIX = "__riscv_save";
-    static constexpr std::string_view RESTORE_PREFIX = "__riscv_restore";
+    std::vector<uint32_t> loopsByHeader() const {
+        std::vector<uint32_t> order(loops.size());
+        for (uint32_t id = 1; id <= loops.size(); ++id) order[id - 1] = id;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            const LoopInfo& la = loops[a - 1];
+            const LoopInfo& lb = loops[b - 1];
+            return la.header_pc != lb.header_pc ? la.header_pc < lb.header_pc : la.end_pc > lb.end_pc;
+        });
+        return order;
+    }
     
-    // Determine function type from name (called once when loading)
-    inline static FunctionType determineFunctionType(const std::string& func_name) {
-        std::string_view sv(func_name);
-        if (sv.substr(0, SAVE_PREFIX.size()) == SAVE_PREFIX) {
-            return FunctionType::SAVE_HELPER;
+    LoopLayout layoutLoops(const std::vector<uint64_t>& sorted_pcs, const EnergyEstimate* energy) const {
+        LoopLayout layout;
+        layout.innermost.assign(sorted_pcs.size(), 0);
+        layout.parent.assign(loops.size() + 1, 0);
+        layout.order = loopsByHeader();
+        layout.names.resize(loops.size() + 1);
+        const size_t stride = eventStride();
+        layout.inclusive.assign((loops.size() + 1) * stride, 0);
+        layout.energy.assign(loops.size() + 1, 0);
+        for (uint32_t id = 1; id <= loops.size(); ++id) {
+            std::ostringstream name;
+            name << fnName(loops[id - 1].fn_id) << "'loop@0x" << std::hex << loops[id - 1].header_pc;
+            layout.names[id] = name.str();
         }
-        if (sv.substr(0, RESTORE_PREFIX.size()) == RESTORE_PREFIX) {
-            return FunctionType::RESTORE_HELPER;
+        
+        std::vector<uint32_t> open;
+        auto spilled = spilledCalls();
+        std::vector<uint64_t> scratch;
+        size_t next = 0;
+        for (size_t p = 0; p < sorted_pcs.size(); ++p) {
+            const uint64_t pc = sorted_pcs[p];
+            const PCInfo& pc_info = info.at(pc);
+            while (!open.empty() && loops[open.back() - 1].end_pc < pc) {
+                open.pop_back();
+            }
+            while (next < layout.order.size() && loops[layout.order[next] - 1].header_pc <= pc) {
+                uint32_t id = layout.order[next++];
+                layout.parent[id] = open.empty() ? 0 : open.back();
+                open.push_back(id);
+            }
+            if (open.empty() || loops[open.back() - 1].fn_id != pc_info.fn_id) continue;
+            layout.innermost[p] = open.back();
+            
+            std::vector<uint64_t> cost(stride);
+            for (size_t i = 0; i < stride; ++i) cost[i] = pcCost(pc_info, i);
+            uint64_t cost_energy = energy ? energy->self[pc_info.index] : 0;
+            forEachCall(pc, spilled.get(), scratch, [&](uint64_t target_pc, uint64_t, const uint64_t* inclusive) {
+                for (size_t i = 0; i < stride; ++i) cost[i] += inclusive[i];
+                if (energy) cost_energy += energy->edge(inclusive, fnIdAt(target_pc));
+            });
+            for (uint32_t id : open) {
+                if (loops[id - 1].fn_id != pc_info.fn_id) continue;
+                uint64_t* inclusive = layout.inclusive.data() + id * stride;
+                for (size_t i = 0; i < stride; ++i) inclusive[i] += cost[i];
+                layout.energy[id] += cost_energy;
+            }
         }
-        return FunctionType::NORMAL;
+        return layout;
     }
     
-    // Fast inline checks using cached type
-    inline bool isSaveHelper(FunctionType type) const {
-        return type == FunctionType::SAVE_HELPER;
+    // Cheap timestamp for sampling; TSC ticks on x86, nanoseconds elsewhere
+    static inline uint64_t readTimestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
     }
     
-    inline bool isRestoreHelper(FunctionType type) const {
-        return type == FunctionType::RESTORE_HELPER;
+    // Nanoseconds per timestamp tick, calibrated against steady_clock since construction
+    double nsPerTick() const {
+#if defined(__x86_64__) || defined(__i386__)
+        uint64_t ticks = readTimestamp() - tsc_at_start;
+        double ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - clock_at_start).count();
+        return ticks ? ns / ticks : 0.0;
+#else
+        return 1.0;
+#endif
     }
     
-    inline bool isCompilerHelper(FunctionType type) const {
-        return type != FunctionType::NORMAL;
+    void logStats() {
+        writeStatsJson(stats_log, getStats());
+        stats_log << "\n";
+        stats_log.flush();
+        next_stats_log = instructions_recorded + stats_log_interval;
     }
     
     // Detect instruction size
@@ -196,17 +1919,25 @@ private:
             }
         }
         
-        // Check for return
+        // Writing a link register is a call, even into the same function (recursion)
+        if (!is_sequential && dest_reg > 0) {
+            return BranchType::CALL;
+        }
+        
+        // Check for return: the expected return address, or any jump back into
+        // the caller's function (unwinding past the call site)
         if (!is_sequential && !call_stack.empty()) {
-            const auto& stack_top = call_stack.top();
-            auto caller_it = info.find(stack_top.caller_pc);
-            if (caller_it != info.end() && to_info.func == caller_it->second.func) {
+            const CallFrame& stack_top = call_stack.innermost();
+            if (to_pc == stack_top.return_pc) {
+                return BranchType::RETURN;
+            }
+            if (from_info.fn_id != to_info.fn_id && to_info.fn_id == stack_top.caller_fn) {
                 return BranchType::RETURN;
             }
         }
         
         // Different function = call or tail call (but only for non-sequential)
-        if (!is_sequential && from_info.func != to_info.func) {
+        if (!is_sequential && from_info.fn_id != to_info.fn_id) {
             return (dest_reg == 0) ? BranchType::TAIL_CALL : BranchType::CALL;
         }
         
@@ -234,8 +1965,8 @@ private:
         auto from_it = info.find(from_pc);
         auto to_it = info.find(to_pc);
         
-        std::string from_func = (from_it != info.end()) ? from_it->second.func : "unknown";
-        std::string to_func = (to_it != info.end()) ? to_it->second.func : "unknown";
+        uint32_t from_fn = (from_it != info.end()) ? from_it->second.fn_id : unknown_fn_id;
+        uint32_t to_fn = (to_it != info.end()) ? to_it->second.fn_id : unknown_fn_id;
         FunctionType to_type = (to_it != info.end()) ? to_it->second.func_type : FunctionType::NORMAL;
         FunctionType from_type = (from_it != info.end()) ? from_it->second.func_type : FunctionType::NORMAL;
         
@@ -243,15 +1974,15 @@ private:
             case BranchType::CALL: {
                 // Keep a copy of original values
                 uint64_t original_from_pc = from_pc;
-                std::string original_from_func = from_func;
+                uint32_t original_from_fn = from_fn;
                 bool used_real_caller = false;
                 
                 // Handle calls FROM save helpers (after prologue)
                 if (isCompilerHelper(from_type)) {
-                    if (isSaveHelper(from_type) && !real_caller_func.empty()) {
+                    if (isSaveHelper(from_type) && real_caller_fn != 0) {
                         // Use the real caller for this call
                         from_pc = real_caller_pc;
-                        from_func = real_caller_func;
+                        from_fn = real_caller_fn;
                         used_real_caller = true;
                     } else {
                         // Calls from restore helpers are ignored
@@ -262,26 +1993,24 @@ private:
                 // Remember real caller if calling a save helper
                 if (isSaveHelper(to_type) && !used_real_caller) {
                     real_caller_pc = original_from_pc;
-                    real_caller_func = original_from_func;
+                    real_caller_fn = original_from_fn;
                 }
                 
                 // Push to call stack
-                CallStackEntry entry;
-                entry.caller_pc = from_pc;
-                entry.callee_pc = to_pc;
-                entry.caller_func = from_func;
-                entry.callee_func = to_func;
-                entry.is_tail_call = false;
-                std::copy(accumulated_events, accumulated_events + MAX_EVENTS, entry.events_at_entry);
-                call_stack.push(entry);
+                call_stack.push({from_pc, to_pc, original_from_pc + last_inst_size,
+                                 from_fn, to_fn, false, 0, latencyClock()}, accumulated_events.data());
                 
                 // Record call (including to helpers)
-                ++calls[from_pc][to_pc].count;
+                auto& call_info = callTarget(from_pc, to_pc);
+                ++call_info.count;
+                if (deferred_inclusive) {
+                    logCallEnter(call_info);
+                }
                 
                 // Clear real_caller if we used it
                 if (used_real_caller) {
                     real_caller_pc = 0;
-                    real_caller_func.clear();
+                    real_caller_fn = 0;
                 }
                 break;
             }
@@ -296,190 +2025,1272 @@ private:
                 // Don't push to stack - restore helper will handle the return
                 if (isRestoreHelper(to_type)) {
                     // Record the call for visibility
-                    ++calls[from_pc][to_pc].count;
+                    ++callTarget(from_pc, to_pc).count;
                     // But DON'T push to stack - the current function is ending
                     // The restore helper will return to the original caller
                     return;
                 }
                 
                 // Normal tail call handling
-                ++calls[from_pc][to_pc].count;
+                auto& call_info = callTarget(from_pc, to_pc);
+                ++call_info.count;
+                
+                if (deferred_inclusive) {
+                    // The chain closes with its frame's single exit record
+                    if (!call_stack.empty()) {
+                        if (call_stack.topIsRetained()) {
+                            call_stack.chainTailCall();
+                            logCallEnter(call_info);
+                        }
+                    } else {
+                        ++resync_count;
+                    }
+                } else if (!call_stack.empty()) {
+                    // Returns to the original caller. A frame that cannot be
+                    // stored would lose its tail flag, so the replaced frame
+                    // simply keeps the cost.
+                    if (call_stack.topIsRetained() && !call_stack.full()) {
+                        call_stack.push({from_pc, to_pc, call_stack.top().return_pc,
+                                         from_fn, to_fn, true, 0, latencyClock()}, accumulated_events.data());
+                    }
+                } else {
+                    ++resync_count;
+                }
+                break;
+            }
+            
+            case BranchType::RETURN: {
+                if (deferred_inclusive) {
+                    if (!call_stack.empty()) {
+                        // Virtual frames were logged on entry but never chain tail calls
+                        uint32_t frames = 1;
+                        if (call_stack.topIsRetained()) {
+                            frames += call_stack.top().chained_tail_calls;
+                            recordLatency(call_stack.top());
+                        }
+                        call_stack.pop();
+                        logCallExit(frames);
+                    } else {
+                        ++resync_count;
+                    }
+                } else if (!call_stack.empty() && !call_stack.topIsRetained()) {
+                    call_stack.pop();  // Virtual frame beyond capacity: cost not tracked
+                } else if (!call_stack.empty()) {
+                    // Close the frame and every tail call that replaced it
+                    const size_t stride = eventStride();
+                    bool was_tail_call;
+                    do {
+                        const CallFrame& entry = call_stack.top();
+                        const uint64_t* events_at_entry = call_stack.topEvents();
+                        uint64_t* inclusive = edgeCosts(callTarget(entry.caller_pc, entry.callee_pc).edge_id);
+                        for (size_t i = 0; i < stride; ++i) {
+                            inclusive[i] += accumulated_events[i] - events_at_entry[i];
+                        }
+                        recordLatency(entry);
+                        was_tail_call = entry.is_tail_call;
+                        call_stack.pop();
+                    } while (was_tail_call && !call_stack.empty());
+                } else {
+                    ++resync_count;
+                }
+                break;
+            }
+            
+            case BranchType::BRANCH: {
+                if (loop_profiling && !is_sequential && to_pc < from_pc &&
+                    from_fn == to_fn && from_fn != 0 && from_fn != unknown_fn_id) {
+                    noteBackEdge(from_pc, to_it);
+                }
+                
+                if (Policy::collect_jumps && collect_jumps) {
+                    auto& branch = branches[from_pc];
+                    ++branch.total_executed;
+                    
+                    if (is_sequential) {
+                        branch.fallthrough_target = to_pc;
+                        ++branch.fallthrough_count;
+                    } else {
+                        branch.taken_target = to_pc;
+                        ++branch.taken_count;
+                    }
+                    
+                    if (branch.history_slot) {
+                        const uint32_t slot = branch.history_slot - 1;
+                        branch_history[slot].record(!is_sequential,
+                                                    branch_patterns.data() + (size_t(slot) << (branch_history_bits + 1)),
+                                                    (1u << branch_history_bits) - 1);
+                    }
+                    
+                    // Update branch statistics
+                    countEvent(bc_event, from_pc);
+                    
+                    if (Policy::Predictor::enabled && branch_sim) {
+                        const bool backward = is_sequential ? branch.taken_target != 0 && branch.taken_target < from_pc
+                                                            : to_pc < from_pc;
+                        if (Policy::Predictor::mispredicted(branch, !is_sequential, backward)) {
+                            countEvent(bcm_event, from_pc);
+                        }
+                    }
+                }
+                break;
+            }
+            
+            case BranchType::DIRECT_JUMP:
+            case BranchType::INDIRECT_JUMP: {
+                // Skip jumps from compiler helpers
+                if (isCompilerHelper(from_type)) {
+                    return;
+                }
                 
-                if (!call_stack.empty()) {
-                    CallStackEntry tail_entry;
-                    tail_entry.caller_pc = from_pc;
-                    tail_entry.callee_pc = to_pc;
-                    tail_entry.caller_func = from_func;
-                    tail_entry.callee_func = to_func;
-                    tail_entry.is_tail_call = true;
-                    std::copy(accumulated_events, accumulated_events + MAX_EVENTS, tail_entry.events_at_entry);
-                    call_stack.push(tail_entry);
+                if (Policy::collect_jumps && collect_jumps) {
+                    const size_t targets = countJump(from_pc, to_pc);
+                    
+                    if (type == BranchType::INDIRECT_JUMP) {
+                        countEvent(bi_event, from_pc);
+                        // Misprediction for indirect jumps with multiple targets
+                        if (branch_sim && targets > 1) {
+                            countEvent(bim_event, from_pc);
+                        }
+                    }
                 }
                 break;
             }
-            
-            case BranchType::RETURN: {
-                if (!call_stack.empty()) {
-                    auto& entry = call_stack.top();
-                    auto& call_info = calls[entry.caller_pc][entry.callee_pc];
-                    
-                    // Update inclusive costs directly
-                    for (size_t i = 0; i < MAX_EVENTS; ++i) {
-                        call_info.inclusive_events[i] += accumulated_events[i] - entry.events_at_entry[i];
-                    }
-                    
-                    bool was_tail_call = entry.is_tail_call;
-                    call_stack.pop();
-                    
-                    // Handle tail call chain
-                    if (was_tail_call && !call_stack.empty()) {
-                        auto& original_entry = call_stack.top();
-                        auto& original_call = calls[original_entry.caller_pc][original_entry.callee_pc];
-                        
-                        // Update original call's inclusive costs
-                        for (size_t i = 0; i < MAX_EVENTS; ++i) {
-                            original_call.inclusive_events[i] += accumulated_events[i] - original_entry.events_at_entry[i];
-                        }
-                        
-                        call_stack.pop();
-                    }
-                }
-                break;
+            
+            default:
+                break;
+        }
+    }
+    
+public:
+    BasicCallgrindGenerator(const std::string& filename = "callgrind.out") 
+        : image_arena(IMAGE_ARENA_INITIAL),
+          run_arena(RUN_ARENA_INITIAL),
+          run_pool(&run_arena),
+          info(&image_arena),
+          calls(&run_pool),
+          jumps(&run_pool),
+          branches(&run_pool),
+          memory_budget(0),
+          edge_table_bytes(0),
+          spilled_edges(0),
+          fn_id_map(&image_arena),
+          fn_names(&image_arena),
+          unknown_fn_id(0),
+          edge_targets(1, nullptr, &run_pool),
+          edge_costs(&run_pool),
+          call_stack(&run_pool),
+          call_stack_capacity(DEFAULT_CALL_STACK_CAPACITY),
+          last_pc(0),
+          last_dest_reg(-1),
+          last_was_branch(false),
+          last_inst_size(4),
+          deferred_inclusive(false),
+          call_log_limit(DEFAULT_CALL_LOG_LIMIT),
+          call_log_folds(0),
+          call_log(&run_pool),
+          call_log_counters(&run_pool),
+          open_edges(&run_pool),
+          open_counters(&run_pool),
+          branch_history_top_n(0),
+          branch_history_warmup(0),
+          branch_history_start(0),
+          branch_history_bits(8),
+          branch_history(&run_pool),
+          branch_patterns(&run_pool),
+          latency_event(EventRegistry::INVALID),
+          latency_slots(&run_pool),
+          latency(&run_pool),
+          atomic_spin_window(DEFAULT_SPIN_WINDOW),
+          hart_atomic(&run_pool),
+          atomic_sites(&run_pool),
+          locks(&run_pool),
+          energy_enabled(false),
+          loop_profiling(false),
+          loops(&run_pool),
+          real_caller_pc(0),
+          real_caller_fn(0),
+          output_filename(filename),
+          dump_instr(true),
+          branch_sim(true),
+          collect_jumps(true),
+          events(EventRegistry::builtin()),
+          bc_event(EventRegistry::INVALID),
+          bcm_event(EventRegistry::INVALID),
+          bi_event(EventRegistry::INVALID),
+          bim_event(EventRegistry::INVALID),
+          ir_event(EventRegistry::INVALID),
+          cycle_event(EventRegistry::INVALID),
+          sc_fail_event(EventRegistry::INVALID),
+          spin_event(EventRegistry::INVALID),
+          vlen_bits(0),
+          vinst_event(EventRegistry::INVALID),
+          velem_event(EventRegistry::INVALID),
+          vslots_event(EventRegistry::INVALID),
+          vlmul_event(EventRegistry::INVALID),
+          split_stalls(false),
+          have_retire_timestamp(false),
+          last_retire_timestamp(0),
+          stall_cycles_split(0),
+          instructions_recorded(0),
+          sampled_records(0),
+          sampled_ticks(0),
+          resync_count(0),
+          bytes_written(0),
+          dump_wall_ms(0.0),
+          tsc_at_start(readTimestamp()),
+          clock_at_start(std::chrono::steady_clock::now()),
+          stats_log_interval(0),
+          next_stats_log(0),
+          snapshot_interval(0),
+          next_snapshot(0),
+          snapshot_run(0) {
+        
+        unknown_fn_id = getFnId("unknown");
+        resizeEventStorage(0);
+    }
+    
+    ~BasicCallgrindGenerator() {
+        removeSpillFile();
+    }
+    
+    void setOptions(bool dump_instr_opt, bool branch_sim_opt, bool collect_jumps_opt) {
+        dump_instr = dump_instr_opt;
+        branch_sim = branch_sim_opt;
+        collect_jumps = collect_jumps_opt;
+    }
+    
+    // Replace the registered events with names, in order (IDs 0..n-1).
+    // Callers recording with EventType IDs must list the built-ins first, in
+    // EventType order. Drops recorded costs and derived events, whose
+    // formulas index the previous names; call before recording starts.
+    void configureEvents(const std::vector<std::string>& names) {
+        events = EventRegistry();
+        for (const auto& name : names) events.registerEvent(name);
+        derived_events.clear();
+        cost_columns.clear();
+        resizeEventStorage(0);
+    }
+    
+    // Add a named event (e.g. a stall reason) and return its ID for
+    // recordExecution; registering an existing name returns its ID
+    uint32_t registerEvent(const std::string& name, const std::string& long_name = "") {
+        const size_t old_stride = eventStride();
+        uint32_t id = events.registerEvent(name, long_name);
+        if (eventStride() != old_stride) resizeEventStorage(old_stride);
+        return id;
+    }
+    
+    // ID of a registered event (EventRegistry::INVALID if unknown)
+    uint32_t eventId(const std::string& name) const {
+        return events.find(name);
+    }
+    
+    const EventRegistry& eventRegistry() const {
+        return events;
+    }
+    
+    // Define an event computed from the configured ones, e.g. "Cycle / Ir"
+    // or "Ir + 10 * Bcm". Linear formulas with integer factors are also
+    // written as callgrind event: lines so KCachegrind can show them; every
+    // formula is evaluated in the native report.
+    bool addDerivedEvent(const std::string& name, const std::string& formula,
+                         const std::string& long_name = "") {
+        DerivedEvent derived;
+        derived.name = name;
+        derived.long_name = long_name;
+        std::string error;
+        if (!parseEventFormula(formula, events.names(), derived, error)) {
+            std::cerr << "Bad formula for derived event " << name << ": " << error << std::endl;
+            return false;
+        }
+        derived_events.push_back(std::move(derived));
+        return true;
+    }
+    
+    // Frames stored before calls only bump a virtual depth.
+    // Like configureEvents, call before recording starts.
+    void setCallStackCapacity(size_t capacity) {
+        call_stack_capacity = std::max<size_t>(capacity, 1);
+        call_stack.init(call_stack_capacity, frameStride());
+    }
+    
+    // Bound the call and jump edge tables to about budget_bytes (0 = no
+    // bound). Past the budget the least counted edges are evicted to an
+    // append-only run file at spill_path and merged back when the profile
+    // is dumped or queried, so costs stay exact; an evicted edge that is
+    // taken again just starts a new record. Edges open on the deferred call
+    // stack are never evicted. The spill file defaults to the output file
+    // name plus ".spill" and is removed with the generator. The budget does
+    // not cover the PC table (see lookupPC).
+    bool setMemoryBudget(size_t budget_bytes, const std::string& path = "") {
+        memory_budget = budget_bytes;
+        const std::string new_path = path.empty() ? output_filename + ".spill" : path;
+        if (budget_bytes == 0 || (spill_out.is_open() && new_path == spill_path)) return true;
+        if (!spill_runs.empty()) {
+            std::cerr << "Spill file already holds runs: " << spill_path << std::endl;
+            return false;
+        }
+        removeSpillFile();
+        spill_path = new_path;
+        spill_out.open(spill_path, std::ios::binary | std::ios::trunc);
+        if (!spill_out.is_open()) {
+            std::cerr << "Failed to open spill file: " << spill_path << std::endl;
+            memory_budget = 0;
+            return false;
+        }
+        return true;
+    }
+    
+    // Log compact call/return records instead of updating inclusive costs on
+    // every return; they are folded into the edges at dump time, or whenever
+    // log_limit records are pending. Frames then carry no event snapshot, a
+    // return closes its tail-call chain in O(1), and calls beyond the stack
+    // capacity still get inclusive costs. Call before recording starts.
+    void setDeferredInclusive(bool enabled, size_t log_limit = DEFAULT_CALL_LOG_LIMIT) {
+        deferred_inclusive = enabled;
+        call_log_limit = std::max<size_t>(log_limit, 1);
+        call_stack.init(call_stack_capacity, frameStride());
+    }
+    
+    // Replay pending call-log records into the edges' inclusive costs
+    void foldCallLog() {
+        const size_t stride = eventStride();
+        const uint64_t* counters = call_log_counters.data();
+        for (const CallLogRecord& record : call_log) {
+            if (record.exit_frames == 0) {
+                open_edges.push_back(record.edge_id);
+                open_counters.insert(open_counters.end(), counters, counters + stride);
+            } else {
+                for (uint32_t f = 0; f < record.exit_frames && !open_edges.empty(); ++f) {
+                    uint64_t* inclusive = edgeCosts(open_edges.back());
+                    const uint64_t* at_entry = open_counters.data() + open_counters.size() - stride;
+                    for (size_t i = 0; i < stride; ++i) {
+                        inclusive[i] += counters[i] - at_entry[i];
+                    }
+                    open_edges.pop_back();
+                    open_counters.resize(open_counters.size() - stride);
+                }
+            }
+            counters += stride;
+        }
+        call_log.clear();
+        call_log_counters.clear();
+        ++call_log_folds;
+    }
+    
+    // Find loops from taken back-edges and track entries and trip counts.
+    // Loops are also written to the callgrind dump as pseudo-functions
+    // ("func'loop@0xheader") called from their function or enclosing loop.
+    void setLoopProfiling(bool enabled) {
+        loop_profiling = enabled;
+    }
+    
+    // Loops found so far, with any open activation counted as closed
+    std::vector<LoopInfo> loopStats() const {
+        std::vector<LoopInfo> stats(loops.begin(), loops.end());
+        for (auto& loop : stats) loop.closeActivation();
+        return stats;
+    }
+    
+    // Per-loop report, hottest first: entries, trip counts and body self cost per iteration
+    bool writeLoopReport(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open loop report: " << path << std::endl;
+            return false;
+        }
+        
+        std::vector<uint64_t> sorted_pcs;
+        sorted_pcs.reserve(info.size());
+        for (const auto& [pc, _] : info) sorted_pcs.push_back(pc);
+        std::sort(sorted_pcs.begin(), sorted_pcs.end());
+        
+        const size_t stride = eventStride();
+        std::vector<LoopInfo> stats = loopStats();
+        std::vector<uint64_t> self(stats.size() * stride, 0);
+        for (size_t l = 0; l < stats.size(); ++l) {
+            auto pc_it = std::lower_bound(sorted_pcs.begin(), sorted_pcs.end(), stats[l].header_pc);
+            for (; pc_it != sorted_pcs.end() && *pc_it <= stats[l].end_pc; ++pc_it) {
+                const PCInfo& pc_info = info.at(*pc_it);
+                if (pc_info.fn_id != stats[l].fn_id) continue;
+                for (size_t i = 0; i < stride; ++i) self[l * stride + i] += pcCost(pc_info, i);
+            }
+        }
+        
+        std::vector<size_t> order(stats.size());
+        for (size_t l = 0; l < order.size(); ++l) order[l] = l;
+        std::sort(order.begin(), order.end(), [&self, stride](size_t a, size_t b) {
+            return self[a * stride] > self[b * stride];
+        });
+        
+        out << "# function header end entries iterations mean_trips max_trips";
+        for (size_t i = 0; i < stride; ++i) {
+            out << " " << events.name(i) << "/iter";
+        }
+        out << " trips(bucket_floor:count)\n";
+        for (size_t l : order) {
+            const LoopInfo& loop = stats[l];
+            const double iterations = static_cast<double>(loop.iterations);
+            out << fnName(loop.fn_id)
+                << std::hex << " 0x" << loop.header_pc << " 0x" << loop.end_pc << std::dec
+                << " " << loop.entries << " " << loop.iterations
+                << " " << (loop.entries ? iterations / loop.entries : 0.0)
+                << " " << loop.max_trips;
+            for (size_t i = 0; i < stride; ++i) {
+                out << " " << (loop.iterations ? self[l * stride + i] / iterations : 0.0);
+            }
+            for (size_t b = 0; b < LOOP_TRIP_BUCKETS; ++b) {
+                if (loop.trip_histogram[b]) out << " " << (uint64_t(1) << b) << ":" << loop.trip_histogram[b];
+            }
+            out << "\n";
+        }
+        return true;
+    }
+    
+    // Dynamic instruction mix per function (by Ir), hottest first
+    std::vector<std::pair<std::string, InstructionMix>> instructionMixByFunction() const {
+        std::vector<std::pair<std::string, InstructionMix>> mix;
+        if (ir_event == EventRegistry::INVALID) return mix;
+        std::vector<InstructionMix> by_fn(fn_names.size() + 1);
+        for (const auto& [_, pc_info] : info) {
+            by_fn[pc_info.fn_id].ir[static_cast<size_t>(pc_info.op_class)] += pcCost(pc_info, ir_event);
+        }
+        
+        for (uint32_t id = 1; id < by_fn.size(); ++id) {
+            if (by_fn[id].total()) mix.emplace_back(fn_names[id - 1], by_fn[id]);
+        }
+        std::sort(mix.begin(), mix.end(), [](const auto& a, const auto& b) {
+            return a.second.total() > b.second.total();
+        });
+        return mix;
+    }
+    
+    // Instruction mix CSV: one row per function plus a "*total*" row
+    bool writeInstructionMix(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open instruction mix file: " << path << std::endl;
+            return false;
+        }
+        
+        out << "function,ir";
+        for (const char* name : OP_CLASS_NAMES) out << "," << name;
+        out << "\n";
+        
+        InstructionMix total;
+        auto write_row = [&out](const std::string& name, const InstructionMix& mix) {
+            out << name << "," << mix.total();
+            for (uint64_t count : mix.ir) out << "," << count;
+            out << "\n";
+        };
+        for (const auto& [func, mix] : instructionMixByFunction()) {
+            write_row(func, mix);
+            for (size_t c = 0; c < OP_CLASS_COUNT; ++c) total.ir[c] += mix.ir[c];
+        }
+        write_row("*total*", total);
+        return true;
+    }
+    
+    // Record outcome histories of the top_n most executed conditional
+    // branches, picked once warmup_instructions more records have been seen.
+    // history_bits (1-16) sets the local history used for the per-pattern
+    // predictor. Needs jump collection (setOptions).
+    void enableBranchHistory(size_t top_n, uint64_t warmup_instructions, uint32_t history_bits = 8) {
+        branch_history_top_n = top_n;
+        branch_history_warmup = warmup_instructions;
+        branch_history_bits = std::min<uint32_t>(std::max<uint32_t>(history_bits, 1), 16);
+        branch_history_start = top_n ? instructions_recorded + std::max<uint64_t>(warmup_instructions, 1) : 0;
+    }
+    
+    // Per-site predictability of the recorded branches, most executed first.
+    // Low local accuracy means the branch is inherently hard to predict;
+    // high local or bimodal accuracy with a high modeled mispredict rate
+    // points at aliasing or a too-simple predictor instead.
+    std::vector<BranchPredictability> branchPredictability() const {
+        std::vector<BranchPredictability> result;
+        result.reserve(branch_history.size());
+        for (size_t slot = 0; slot < branch_history.size(); ++slot) {
+            result.push_back(analyzeBranch(slot));
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return a.outcomes > b.outcomes;
+        });
+        return result;
+    }
+    
+    bool writeBranchReport(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open branch report: " << path << std::endl;
+            return false;
+        }
+        out << "# pc function outcomes taken_rate entropy cond_entropy transition_rate"
+            << " static_acc bimodal_acc local" << branch_history_bits << "_acc modeled_bcm_rate recent64\n";
+        for (const auto& r : branchPredictability()) {
+            out << "0x" << std::hex << r.pc << std::dec << " " << r.func << " " << r.outcomes
+                << " " << r.taken_rate << " " << r.entropy << " " << r.conditional_entropy
+                << " " << r.transition_rate << " " << r.static_accuracy << " " << r.bimodal_accuracy
+                << " " << r.local_accuracy << " " << r.modeled_mispredict_rate
+                << " 0x" << std::hex << r.recent << std::dec << "\n";
+        }
+        return true;
+    }
+    
+    // Native per-function report (self cost), top_n functions by the first
+    // event plus a total row, with every configured and derived event
+    bool writeReport(const std::string& path, size_t top_n = 50) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open report: " << path << std::endl;
+            return false;
+        }
+        
+        const size_t stride = eventStride();
+        std::vector<uint64_t> by_fn((fn_names.size() + 1) * stride, 0);
+        std::vector<uint64_t> totals(stride, 0);
+        for (size_t i = 0; i < stride; ++i) {
+            const auto& column = cost_columns[i];
+            for (const auto& [_, pc_info] : info) {
+                by_fn[pc_info.fn_id * stride + i] += column[pc_info.index];
+                totals[i] += column[pc_info.index];
+            }
+        }
+        
+        std::vector<uint64_t> energy_by_fn(fn_names.size() + 1, 0);
+        if (energy_enabled) {
+            const std::vector<uint64_t> energy = evaluateEnergy().self;
+            for (const auto& [_, pc_info] : info) energy_by_fn[pc_info.fn_id] += energy[pc_info.index];
+        }
+        
+        std::vector<uint32_t> order;
+        for (uint32_t id = 1; id <= fn_names.size(); ++id) {
+            if (stride && by_fn[id * stride] != 0) order.push_back(id);
+        }
+        std::sort(order.begin(), order.end(), [&by_fn, stride](uint32_t a, uint32_t b) {
+            return by_fn[a * stride] > by_fn[b * stride];
+        });
+        if (order.size() > top_n) order.resize(top_n);
+        
+        out << "# function";
+        for (size_t i = 0; i < stride; ++i) out << " " << events.name(i);
+        if (energy_enabled) out << " Energy(" << energy_model.unit << ")";
+        for (const auto& derived : derived_events) out << " " << derived.name;
+        out << "\n";
+        auto write_row = [&](const std::string& name, const uint64_t* costs, uint64_t energy) {
+            out << name;
+            for (size_t i = 0; i < stride; ++i) out << " " << costs[i];
+            if (energy_enabled) out << " " << energy;
+            for (const auto& derived : derived_events) out << " " << derived.evaluate(costs);
+            out << "\n";
+        };
+        uint64_t total_energy = 0;
+        for (uint64_t energy : energy_by_fn) total_energy += energy;
+        for (uint32_t id : order) {
+            write_row(fn_names[id - 1], by_fn.data() + id * stride, energy_by_fn[id]);
+        }
+        write_row("*total*", totals.data(), total_energy);
+        
+        if (latency_event != EventRegistry::INVALID) {
+            std::vector<FunctionLatency> latencies = functionLatencies();
+            if (latencies.size() > top_n) latencies.resize(top_n);
+            out << "\n# latency (" << latency_event_name << " per call): function calls min mean p50 p90 p99 max\n";
+            for (const auto& l : latencies) {
+                out << l.func << " " << l.calls << " " << l.min << " " << l.mean << " " << l.p50
+                    << " " << l.p90 << " " << l.p99 << " " << l.max << "\n";
+            }
+        }
+        return true;
+    }
+    
+    // Report one executed atomic instruction (LR, SC or AMO, from the static
+    // decode) of hart on address; sc_failed is a failed SC or, for an AMO,
+    // a CAS whose compare missed. An access is a spin iteration when the
+    // same hart repeats its previous atomic on that address within the spin
+    // window and was held off: the LR whose SC just failed, or the same LR
+    // or AMO again after a failed CAS or after another hart touched the
+    // address in between. A hart re-running an uncontended atomic is not
+    // spinning. ScFail and Spin are also counted as callgrind events if
+    // registered.
+    void recordAtomicAccess(uint32_t hart, uint64_t pc, uint64_t address, bool sc_failed = false) {
+        PCInfo& pc_info = lookupPC(pc);
+        const AtomicKind kind = pc_info.atomic != AtomicKind::NONE ? pc_info.atomic : AtomicKind::AMO;
+        if (hart >= hart_atomic.size()) hart_atomic.resize(hart + 1);
+        HartAtomicState& prev = hart_atomic[hart];
+        auto [lock_it, new_lock] = locks.try_emplace(address);
+        LockState& lock = lock_it->second;
+        
+        // Contended: another hart touched the address since this hart did
+        bool spin = false;
+        if (prev.valid && prev.address == address && instructions_recorded - prev.at <= atomic_spin_window) {
+            const bool contended = !new_lock && lock.last_hart != hart;
+            spin = (prev.pc == pc && (prev.failed || contended)) ||
+                   (kind == AtomicKind::LR && prev.failed && prev.reservation_pc == pc);
+        }
+        const bool failed = sc_failed && kind != AtomicKind::LR;
+        sc_failed = sc_failed && kind == AtomicKind::SC;
+        
+        auto& site = atomic_sites[pc];
+        if (hart >= site.size()) site.resize(hart + 1);
+        site[hart].add(sc_failed, spin);
+        
+        lock.counts.add(sc_failed, spin);
+        lock.hart_mask |= uint64_t(1) << (hart % 64);
+        lock.last_hart = hart;
+        auto fn_it = std::find_if(lock.by_fn.begin(), lock.by_fn.end(),
+                                  [&pc_info](const auto& f) { return f.first == pc_info.fn_id; });
+        if (fn_it == lock.by_fn.end()) fn_it = lock.by_fn.insert(lock.by_fn.end(), {pc_info.fn_id, AtomicCounts()});
+        fn_it->second.add(sc_failed, spin);
+        
+        if (sc_failed && sc_fail_event != EventRegistry::INVALID) {
+            ++cost_columns[sc_fail_event][pc_info.index];
+            ++accumulated_events[sc_fail_event];
+        }
+        if (spin && spin_event != EventRegistry::INVALID) {
+            ++cost_columns[spin_event][pc_info.index];
+            ++accumulated_events[spin_event];
+        }
+        
+        if (kind == AtomicKind::LR) prev.reservation_pc = pc;
+        prev.valid = true;
+        prev.failed = failed;
+        prev.pc = pc;
+        prev.address = address;
+        prev.at = instructions_recorded;
+    }
+    
+    // Records (all harts) within which a repeated atomic counts as a spin
+    void setAtomicSpinWindow(uint64_t records) {
+        atomic_spin_window = records;
+    }
+    
+    // Atomic sites per hart, most retried first
+    std::vector<AtomicSiteCounts> atomicSites() const {
+        std::vector<AtomicSiteCounts> result;
+        for (const auto& [pc, harts] : atomic_sites) {
+            auto it = info.find(pc);
+            for (uint32_t hart = 0; hart < harts.size(); ++hart) {
+                if (harts[hart].accesses == 0) continue;
+                result.push_back({pc, it->second.func, it->second.atomic, hart, harts[hart]});
+            }
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            const uint64_t ra = a.counts.spins + a.counts.sc_failures;
+            const uint64_t rb = b.counts.spins + b.counts.sc_failures;
+            if (ra != rb) return ra > rb;
+            return a.pc != b.pc ? a.pc < b.pc : a.hart < b.hart;
+        });
+        return result;
+    }
+    
+    // Lock addresses with their contending functions, most retried first
+    std::vector<LockContention> lockContention() const {
+        std::vector<LockContention> result;
+        for (const auto& [address, lock] : locks) {
+            LockContention entry{address, lock.counts, lock.hart_mask, {}};
+            for (const auto& [fn_id, counts] : lock.by_fn) {
+                entry.functions.emplace_back(fnName(fn_id), counts);
+            }
+            std::sort(entry.functions.begin(), entry.functions.end(), [](const auto& a, const auto& b) {
+                return a.second.spins + a.second.sc_failures > b.second.spins + b.second.sc_failures;
+            });
+            result.push_back(std::move(entry));
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            const uint64_t ra = a.counts.spins + a.counts.sc_failures;
+            const uint64_t rb = b.counts.spins + b.counts.sc_failures;
+            return ra != rb ? ra > rb : a.address < b.address;
+        });
+        return result;
+    }
+    
+    bool writeContentionReport(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open contention report: " << path << std::endl;
+            return false;
+        }
+        static constexpr const char* KIND_NAMES[] = {"none", "lr", "sc", "amo"};
+        
+        out << "# lock accesses sc_failures spins harts\n#   function accesses sc_failures spins\n";
+        for (const auto& lock : lockContention()) {
+            out << "0x" << std::hex << lock.address << std::dec << " " << lock.counts.accesses
+                << " " << lock.counts.sc_failures << " " << lock.counts.spins
+                << " " << __builtin_popcountll(lock.hart_mask) << "\n";
+            for (const auto& [func, counts] : lock.functions) {
+                out << "  " << func << " " << counts.accesses << " " << counts.sc_failures
+                    << " " << counts.spins << "\n";
+            }
+        }
+        
+        out << "\n# pc function kind hart accesses sc_failures spins\n";
+        for (const auto& site : atomicSites()) {
+            out << "0x" << std::hex << site.pc << std::dec << " " << site.func
+                << " " << KIND_NAMES[static_cast<size_t>(site.kind)] << " " << site.hart
+                << " " << site.counts.accesses << " " << site.counts.sc_failures
+                << " " << site.counts.spins << "\n";
+        }
+        return true;
+    }
+    
+    // Estimate energy at dump time: an Energy column in the callgrind output
+    // and the native report. Unknown event names are rejected; the model's
+    // op-class energies apply to the static decode of every PC.
+    bool setEnergyModel(const EnergyModel& model) {
+        for (const auto& [name, _] : model.events) {
+            if (events.find(name) == EventRegistry::INVALID) {
+                std::cerr << "Unknown event in energy model: " << name << std::endl;
+                return false;
+            }
+        }
+        if (model.leakage_per_cycle != 0.0 && cycle_event == EventRegistry::INVALID) {
+            std::cerr << "Energy model has leakage but no Cycle event is registered" << std::endl;
+            return false;
+        }
+        energy_model = model;
+        energy_enabled = true;
+        return true;
+    }
+    
+    // Self energy per function, highest first (empty without an energy model)
+    std::vector<std::pair<std::string, uint64_t>> energyByFunction() const {
+        std::vector<std::pair<std::string, uint64_t>> result;
+        if (!energy_enabled) return result;
+        
+        const std::vector<uint64_t> energy = evaluateEnergy().self;
+        std::vector<uint64_t> by_fn(fn_names.size() + 1, 0);
+        for (const auto& [_, pc_info] : info) by_fn[pc_info.fn_id] += energy[pc_info.index];
+        for (uint32_t id = 1; id < by_fn.size(); ++id) {
+            if (by_fn[id]) result.emplace_back(fn_names[id - 1], by_fn[id]);
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return a.second > b.second;
+        });
+        return result;
+    }
+    
+    // Histogram every call's duration, in counts of event_name from call to
+    // return (e.g. "Cycle", or "Ir" when the simulator has no cycle count).
+    // Tail-called functions get their own duration in immediate mode; in
+    // deferred mode a chain counts once, for the function first called.
+    // Enable before recording: calls already open have no entry time.
+    bool enableLatencyHistograms(const std::string& event_name = "Cycle") {
+        if (events.find(event_name) == EventRegistry::INVALID) {
+            std::cerr << "Unknown latency event: " << event_name << std::endl;
+            return false;
+        }
+        latency_event_name = event_name;
+        latency_event = events.find(event_name);
+        return true;
+    }
+    
+    // Per-function call durations, worst tail (p99) first
+    std::vector<FunctionLatency> functionLatencies() const {
+        std::vector<FunctionLatency> result;
+        for (uint32_t id = 1; id < latency_slots.size(); ++id) {
+            if (latency_slots[id] == 0) continue;
+            const LatencyHistogram& hist = latency[latency_slots[id] - 1];
+            result.push_back({fn_names[id - 1], hist.calls, hist.min,
+                              static_cast<double>(hist.total) / hist.calls,
+                              hist.percentile(0.5), hist.percentile(0.9),
+                              hist.percentile(0.99), hist.max});
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return a.p99 != b.p99 ? a.p99 > b.p99 : a.calls > b.calls;
+        });
+        return result;
+    }
+    
+    // JSON sidecar: summary plus the non-empty buckets ([low, high, count]) per function
+    bool writeLatencyJson(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open latency file: " << path << std::endl;
+            return false;
+        }
+        
+        out << "{\"event\":\"" << latency_event_name << "\",\"functions\":[";
+        bool first = true;
+        for (const auto& l : functionLatencies()) {
+            const LatencyHistogram& hist = latency[latency_slots[fn_id_map.at(l.func)] - 1];
+            out << (first ? "" : ",") << "\n{\"name\":\"";
+            for (char c : l.func) {
+                if (c == '"' || c == '\\') out << '\\';
+                out << c;
+            }
+            out << "\",\"calls\":" << l.calls << ",\"min\":" << l.min << ",\"mean\":" << l.mean
+                << ",\"p50\":" << l.p50 << ",\"p90\":" << l.p90 << ",\"p99\":" << l.p99
+                << ",\"max\":" << l.max << ",\"buckets\":[";
+            bool first_bucket = true;
+            for (size_t b = hist.first_bucket; b < hist.endBucket(); ++b) {
+                if (hist.count(b) == 0) continue;
+                out << (first_bucket ? "" : ",") << "[" << LatencyHistogram::bucketLow(b)
+                    << "," << LatencyHistogram::bucketHigh(b) << "," << hist.count(b) << "]";
+                first_bucket = false;
+            }
+            out << "]}";
+            first = false;
+        }
+        out << "\n]}\n";
+        return true;
+    }
+    
+    // lcov tracefile from the execution counters: per line the highest Ir
+    // of its instructions, per function the Ir of its lowest PC, and with
+    // jump collection BRDA taken/fallthrough counts of every conditional
+    // branch ("-" when never reached). One pass over PCs sorted by
+    // file, line and address.
+    bool writeLcov(const std::string& path, const std::string& test_name = "") const {
+        if (ir_event == EventRegistry::INVALID) {
+            std::cerr << "lcov export needs the Ir event" << std::endl;
+            return false;
+        }
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            std::cerr << "Failed to open lcov file: " << path << std::endl;
+            return false;
+        }
+        
+        std::vector<const PCInfo*> sorted;
+        sorted.reserve(info.size());
+        std::vector<const PCInfo*> fn_entry(fn_names.size() + 1, nullptr);
+        for (const auto& [pc, pc_info] : info) {
+            if (pc_info.line == 0 || pc_info.fn_id == unknown_fn_id) continue;
+            sorted.push_back(&pc_info);
+            const PCInfo*& entry = fn_entry[pc_info.fn_id];
+            if (!entry || pc < entry->pc) entry = &pc_info;
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const PCInfo* a, const PCInfo* b) {
+            if (a->file != b->file) return a->file < b->file;
+            return a->line != b->line ? a->line < b->line : a->pc < b->pc;
+        });
+        auto is_conditional = [](const PCInfo& pc_info) {
+            return pc_info.op_class == OpClass::BRANCH &&
+                   (pc_info.assembly[0] == 'b' || pc_info.assembly.compare(0, 3, "c.b") == 0);
+        };
+        
+        // Spilled jump counts of conditional branch sites (see setMemoryBudget)
+        std::unordered_map<uint64_t, uint64_t> spilled_taken;
+        if (auto spilled = spilledJumps()) {
+            std::vector<uint64_t> records;
+            uint64_t pc = 0;
+            while (spilled->nextPc(pc)) {
+                records.clear();
+                spilled->collect(pc, records);
+                if (!branches.count(pc)) continue;
+                for (size_t r = 0; r < records.size(); r += 3) spilled_taken[pc] += records[r + 2];
             }
+        }
+        
+        size_t begin = 0;
+        while (begin < sorted.size()) {
+            const std::string& file = sorted[begin]->file;
+            size_t end = begin;
+            while (end < sorted.size() && sorted[end]->file == file) ++end;
             
-            case BranchType::BRANCH: {
-                if (collect_jumps) {
-                    auto& branch = branches[from_pc];
-                    ++branch.total_executed;
-                    
-                    if (is_sequential) {
-                        branch.fallthrough_target = to_pc;
-                        ++branch.fallthrough_count;
-                    } else {
-                        branch.taken_target = to_pc;
-                        ++branch.taken_count;
-                    }
-                    
-                    // Update branch statistics
-                    ++info[from_pc].event[EVENT_BC];
-                    
-                    // Simple misprediction model - minority path
-                    if (branch.taken_count > 0 && branch.fallthrough_count > 0) {
-                        uint64_t minority = std::min(branch.taken_count, branch.fallthrough_count);
-                        if (branch.total_executed > 1 && 
-                            (minority == branch.taken_count || minority == branch.fallthrough_count)) {
-                            ++info[from_pc].event[EVENT_BCM];
-                        }
-                    }
-                }
-                break;
+            out << "TN:" << test_name << "\nSF:" << file << "\n";
+            size_t functions = 0, functions_hit = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const PCInfo& pc_info = *sorted[i];
+                if (fn_entry[pc_info.fn_id] != &pc_info) continue;
+                const uint64_t calls = pcCost(pc_info, ir_event);
+                out << "FN:" << pc_info.line << "," << pc_info.func << "\n"
+                    << "FNDA:" << calls << "," << pc_info.func << "\n";
+                ++functions;
+                functions_hit += calls != 0;
             }
+            out << "FNF:" << functions << "\nFNH:" << functions_hit << "\n";
             
-            case BranchType::DIRECT_JUMP:
-            case BranchType::INDIRECT_JUMP: {
-                // Skip jumps from compiler helpers
-                if (isCompilerHelper(from_type)) {
-                    return;
-                }
-                
-                if (collect_jumps) {
-                    ++jumps[from_pc][to_pc];
+            std::ostringstream lines;
+            size_t branch_count = 0, branches_hit = 0, line_count = 0, lines_hit = 0;
+            for (size_t i = begin; i < end;) {
+                const uint32_t line = sorted[i]->line;
+                uint64_t count = 0;
+                uint32_t block = 0;
+                for (; i < end && sorted[i]->line == line; ++i) {
+                    const PCInfo& pc_info = *sorted[i];
+                    const uint64_t ir = pcCost(pc_info, ir_event);
+                    count = std::max(count, ir);
+                    if (!collect_jumps || !is_conditional(pc_info)) continue;
                     
-                    if (type == BranchType::INDIRECT_JUMP) {
-                        ++info[from_pc].event[EVENT_BI];
-                        // Misprediction for indirect jumps with multiple targets
-                        if (jumps[from_pc].size() > 1) {
-                            ++info[from_pc].event[EVENT_BIM];
+                    // Taken branches classified as jumps (e.g. onto a return) are in jumps
+                    auto branch_it = branches.find(pc_info.pc);
+                    uint64_t taken = branch_it != branches.end() ? branch_it->second.taken_count : 0;
+                    const uint64_t fallthrough = branch_it != branches.end() ? branch_it->second.fallthrough_count : 0;
+                    auto jump_it = jumps.find(pc_info.pc);
+                    if (jump_it != jumps.end()) {
+                        for (const auto& [_, count] : jump_it->second) taken += count;
+                    }
+                    auto spilled_it = spilled_taken.find(pc_info.pc);
+                    if (spilled_it != spilled_taken.end()) taken += spilled_it->second;
+                    for (uint32_t side = 0; side < 2; ++side) {
+                        const uint64_t hits = side == 0 ? taken : fallthrough;
+                        out << "BRDA:" << line << "," << block << "," << side << ",";
+                        if (ir) {
+                            out << hits;
+                        } else {
+                            out << "-";
                         }
+                        out << "\n";
+                        ++branch_count;
+                        branches_hit += hits != 0;
                     }
+                    ++block;
                 }
-                break;
+                lines << "DA:" << line << "," << count << "\n";
+                ++line_count;
+                lines_hit += count != 0;
             }
-            
-            default:
-                break;
+            if (collect_jumps) out << "BRF:" << branch_count << "\nBRH:" << branches_hit << "\n";
+            out << lines.str() << "LF:" << line_count << "\nLH:" << lines_hit << "\nend_of_record\n";
+            begin = end;
         }
+        return true;
     }
     
-public:
-    CallgrindGenerator(const std::string& filename = "callgrind.out") 
-        : output_filename(filename),
-          last_pc(0),
-          last_dest_reg(-1),
-          last_was_branch(false),
-          last_inst_size(4),
-          dump_instr(true),
-          branch_sim(true),
-          collect_jumps(true),
-          num_events(2),
-          real_caller_pc(0) {
-        
-        event_names = {"Ir", "Cycle", "Bc", "Bcm", "Bi", "Bim"};
-        std::fill(accumulated_events, accumulated_events + MAX_EVENTS, 0);
-    }
-    
-    void setOptions(bool dump_instr_opt, bool branch_sim_opt, bool collect_jumps_opt) {
-        dump_instr = dump_instr_opt;
-        branch_sim = branch_sim_opt;
-        collect_jumps = collect_jumps_opt;
-    }
-    
-    void configureEvents(const std::vector<std::string>& names) {
-        event_names = names;
-        num_events = names.size();
+    // Number of calls made at each call depth (index = depth after the call,
+    // last bucket collects everything deeper than the stack capacity)
+    std::vector<uint64_t> callDepthHistogram() const {
+        const auto& hist = call_stack.depthHistogram();
+        return std::vector<uint64_t>(hist.begin(), hist.end());
     }
     
     // Load objdump data
     void loadPCInfo(uint64_t pc, const std::string& func, 
                     const std::string& assembly, const std::string& file, 
                     uint32_t line) {
-        PCInfo& pc_info = info[pc];
-        pc_info.pc = pc;
+        PCInfo& pc_info = addPC(pc);
         pc_info.func = func;
         pc_info.assembly = assembly;
         pc_info.file = file;
         pc_info.line = line;
         pc_info.func_type = determineFunctionType(func);  // Cache function type
+        pc_info.fn_id = getFnId(func);
+        pc_info.op_class = classifyOpClass(assembly);
+        pc_info.atomic = classifyAtomic(assembly);
     }
     
-    // Record instruction execution
-    void recordExecution(uint64_t pc, EventType event_type, uint64_t count, 
-                        int dest_reg = -1, bool is_branch_instruction = false) {
-        auto it = info.find(pc);
-        if (it == info.end()) {
-            PCInfo& pc_info = info[pc];
-            pc_info.pc = pc;
-            pc_info.func = "unknown";
-            pc_info.file = "unknown";
-            pc_info.line = 0;
-            pc_info.func_type = FunctionType::NORMAL;
-            it = info.find(pc);  // Update iterator
+    // Pre-size the PC table for an image of num_pcs instructions
+    void reserve(size_t num_pcs) {
+        info.reserve(num_pcs);
+        for (auto& column : cost_columns) column.reserve(num_pcs);
+    }
+    
+    // Drop recorded costs, edges and call-stack state but keep the loaded image.
+    // The swapped-out run tables still destroy their nodes one by one, but
+    // that only hands blocks back to the pool; the pool and run arena are
+    // then returned upstream in a single release each.
+    void reset() {
+        { decltype(calls) empty(&run_pool); calls.swap(empty); }
+        { decltype(jumps) empty(&run_pool); jumps.swap(empty); }
+        { decltype(branches) empty(&run_pool); branches.swap(empty); }
+        call_stack = CallStack(&run_pool);
+        cost_columns.clear();
+        edge_costs = decltype(edge_costs)(&run_pool);
+        call_log = decltype(call_log)(&run_pool);
+        call_log_counters = decltype(call_log_counters)(&run_pool);
+        edge_targets = decltype(edge_targets)(&run_pool);
+        open_edges = decltype(open_edges)(&run_pool);
+        open_counters = decltype(open_counters)(&run_pool);
+        loops = decltype(loops)(&run_pool);
+        branch_history = decltype(branch_history)(&run_pool);
+        branch_patterns = decltype(branch_patterns)(&run_pool);
+        latency_slots = decltype(latency_slots)(&run_pool);
+        latency = decltype(latency)(&run_pool);
+        hart_atomic = decltype(hart_atomic)(&run_pool);
+        { decltype(atomic_sites) empty(&run_pool); atomic_sites.swap(empty); }
+        { decltype(locks) empty(&run_pool); locks.swap(empty); }
+        run_pool.release();
+        run_arena.release();
+        if (!spill_runs.empty()) {
+            spill_out.close();
+            spill_out.open(spill_path, std::ios::binary | std::ios::trunc);
+            spill_runs.clear();
+        }
+        spilled_edges = 0;
+        edge_targets.push_back(nullptr);
+        edge_costs.assign(eventStride(), 0);
+        resizeEventStorage(eventStride());  // Fresh zeroed cost columns and call stack
+        call_log_folds = 0;
+        
+        for (auto& [_, pc_info] : info) {
+            pc_info.loop_id = 0;
+        }
+        std::fill(accumulated_events.begin(), accumulated_events.end(), 0);
+        last_pc = 0;
+        last_dest_reg = -1;
+        last_was_branch = false;
+        last_inst_size = 4;
+        real_caller_pc = 0;
+        real_caller_fn = 0;
+        resync_count = 0;
+        have_retire_timestamp = false;
+        last_retire_timestamp = 0;
+        stall_cycles_split = 0;
+        ++snapshot_run;
+        if (branch_history_top_n) {
+            enableBranchHistory(branch_history_top_n, branch_history_warmup, branch_history_bits);
+        }
+    }
+    
+    // Append a JSON stats line every interval_instructions records (0 disables)
+    bool enableStatsLog(const std::string& path, uint64_t interval_instructions) {
+        if (stats_log.is_open()) stats_log.close();
+        stats_log_interval = 0;
+        if (interval_instructions == 0) return true;
+        
+        stats_log.open(path, std::ios::out | std::ios::trunc);
+        if (!stats_log.is_open()) {
+            std::cerr << "Failed to open stats log: " << path << std::endl;
+            return false;
+        }
+        stats_log_interval = interval_instructions;
+        next_stats_log = instructions_recorded + interval_instructions;
+        return true;
+    }
+    
+    // Pass a self-cost snapshot to sink every interval_instructions records
+    // (0 disables), e.g. LiveProfileServer::publish. The sink runs on the
+    // recording thread with the generator's buffer and must not block; it
+    // may swap the buffer with one of its own. Publishing copies the cost
+    // columns, about 8 ms at 1M PCs and six events (0.4 ms at 100k), so
+    // size the interval to the image; the per-function fold is left to the
+    // consumer. Policies without instrumentation only publish on
+    // publishSnapshot().
+    void setSnapshotSink(std::function<void(ProfileSnapshot&)> sink, uint64_t interval_instructions) {
+        snapshot_sink = std::move(sink);
+        snapshot_interval = snapshot_sink ? interval_instructions : 0;
+        next_snapshot = instructions_recorded + snapshot_interval;
+    }
+    
+    void publishSnapshot() {
+        next_snapshot = instructions_recorded + snapshot_interval;
+        if (!snapshot_sink) return;
+        const size_t stride = eventStride();
+        if (!snapshot.events || *snapshot.events != events.names()) {
+            snapshot.events = std::make_shared<const std::vector<std::string>>(events.names());
         }
+        if (!snapshot.functions || snapshot.functions->size() != fn_names.size() + 1) {
+            auto functions = std::make_shared<std::vector<std::string>>(1, "(none)");
+            functions->insert(functions->end(), fn_names.begin(), fn_names.end());
+            snapshot.functions = std::move(functions);
+        }
+        if (!snapshot.pc_functions || snapshot.pc_functions->size() != info.size()) {
+            auto pc_functions = std::make_shared<std::vector<uint32_t>>(info.size(), 0);
+            for (const auto& [_, pc_info] : info) (*pc_functions)[pc_info.index] = pc_info.fn_id;
+            snapshot.pc_functions = std::move(pc_functions);
+        }
+        ++snapshot.sequence;
+        snapshot.instructions = instructions_recorded;
+        snapshot.run = snapshot_run;
+        snapshot.pc_costs.resize(stride * info.size());
+        for (size_t i = 0; i < stride; ++i) {
+            std::copy(cost_columns[i].begin(), cost_columns[i].begin() + info.size(),
+                      snapshot.pc_costs.begin() + i * info.size());
+        }
+        const uint64_t sequence = snapshot.sequence;
+        snapshot_sink(snapshot);
+        snapshot.sequence = sequence;  // The sink may have swapped in an older buffer
+    }
+    
+    // Snapshot of profiler overhead and table sizes
+    GeneratorStats getStats() const {
+        GeneratorStats s;
+        s.instructions_recorded = instructions_recorded;
+        s.sampled_records = sampled_records;
+        s.ns_per_record = sampled_records ? (sampled_ticks * nsPerTick()) / sampled_records : 0.0;
+        
+        s.pc_entries = info.size();
+        s.pc_load_factor = info.load_factor();
+        s.call_sites = calls.size();
+        for (const auto& [_, targets] : calls) s.call_edges += targets.size();
+        s.call_load_factor = calls.load_factor();
+        s.jump_sites = jumps.size();
+        for (const auto& [_, targets] : jumps) s.jump_edges += targets.size();
+        s.jump_load_factor = jumps.load_factor();
+        s.branch_sites = branches.size();
+        s.branch_load_factor = branches.load_factor();
+        s.edge_table_bytes = edge_table_bytes;
+        s.spill_runs = spill_runs.size();
+        s.spilled_edges = spilled_edges;
+        
+        s.call_stack_depth = call_stack.logicalDepth();
+        s.call_stack_max_depth = call_stack.maxDepth();
+        s.call_stack_overflows = call_stack.overflowCount();
+        s.resync_count = resync_count;
+        s.stall_cycles_split = stall_cycles_split;
+        s.call_log_records = call_log.size();
+        s.call_log_folds = call_log_folds;
+        s.bytes_written = bytes_written;
+        s.dump_wall_ms = dump_wall_ms;
+        return s;
+    }
+    
+    // Self cost of one PC (0 if never seen or not registered)
+    uint64_t pcEvent(uint64_t pc, uint32_t event) const {
+        auto it = info.find(pc);
+        return (it != info.end() && event < eventStride()) ? pcCost(it->second, event) : 0;
+    }
+    
+    // Call count and inclusive costs of one call edge (zeros if never taken).
+    // In deferred mode, costs cover records folded so far (see foldCallLog).
+    CallEdgeCost callEdge(uint64_t from_pc, uint64_t to_pc) const {
+        CallEdgeCost cost;
+        cost.inclusive_events.assign(eventStride(), 0);
+        auto spilled = spilledCalls();
+        std::vector<uint64_t> scratch;
+        forEachCall(from_pc, spilled.get(), scratch, [&](uint64_t target_pc, uint64_t count, const uint64_t* inclusive) {
+            if (target_pc != to_pc) return;
+            cost.count = count;
+            std::copy(inclusive, inclusive + eventStride(), cost.inclusive_events.begin());
+        });
+        return cost;
+    }
+    
+    // Add count of a registered event to pc without advancing the
+    // instruction stream (stall cycles, cache misses, ...). Unknown PCs are
+    // attributed to "unknown" like in recordExecution. False (nothing
+    // counted) if event is not a registered ID.
+    bool addEvent(uint64_t pc, uint32_t event, uint64_t count) {
+        if (event >= eventStride()) return false;
+        cost_columns[event][lookupPC(pc).index] += count;
+        accumulated_events[event] += count;
+        return true;
+    }
+    
+    // Add a call edge with known totals: count calls and one inclusive cost
+    // per event ID. For importers of already aggregated profiles (see
+    // verilator_profile.hpp); the instruction stream is not advanced and
+    // repeated edges accumulate.
+    void addCallEdge(uint64_t from_pc, uint64_t to_pc, uint64_t count, const uint64_t* inclusive) {
+        lookupPC(from_pc);
+        lookupPC(to_pc);
+        CallTargetInfo& call_info = callTarget(from_pc, to_pc);
+        call_info.count += count;
+        uint64_t* costs = edgeCosts(call_info.edge_id);
+        for (size_t i = 0; i < eventStride(); ++i) costs[i] += inclusive[i];
+    }
+    
+    // Record instruction execution; event is a registered event ID. An
+    // unregistered ID (e.g. EVENT_BC after configureEvents dropped it) is
+    // not counted, like an unregistered branch event, but the instruction
+    // still advances the stream.
+    void recordExecution(uint64_t pc, uint32_t event, uint64_t count, 
+                        int dest_reg = -1, bool is_branch_instruction = false) {
+        const bool timed = sampleRecord();
+        const uint64_t t_start = timed ? readTimestamp() : 0;
+        
+        const PCInfo& pc_info = lookupPC(pc);
         
         // Update events for ALL functions including helpers
-        info[pc].event[event_type] += count;
-        accumulated_events[event_type] += count;
+        if (event < eventStride()) {
+            cost_columns[event][pc_info.index] += count;
+            accumulated_events[event] += count;
+        }
         
-        // Handle previous branch
-        if (last_pc != 0 && last_was_branch) {
-            bool is_sequential = (pc == last_pc + last_inst_size);
-            BranchType branch_type = detectBranchType(last_pc, pc, last_dest_reg, is_sequential);
-            handleBranch(last_pc, pc, branch_type, is_sequential);
+        if constexpr (Policy::track_control_flow) advanceStream(pc_info, dest_reg, is_branch_instruction);
+        finishRecord(timed, t_start);
+    }
+    
+    // Record one retired instruction from the core's cycle counter: Ir += 1
+    // and the cycles since the previous retirement go to Cycle (the first
+    // retirement only sets the reference). With stall splitting enabled and
+    // a blocking_pc given, the retiring PC keeps one cycle and the rest of
+    // the gap is charged to the blocking instruction.
+    void recordRetire(uint64_t pc, uint64_t timestamp, int dest_reg = -1,
+                      bool is_branch_instruction = false, uint64_t blocking_pc = 0) {
+        const bool timed = sampleRecord();
+        const uint64_t t_start = timed ? readTimestamp() : 0;
+        
+        const PCInfo& pc_info = lookupPC(pc);
+        const uint64_t cycles = (have_retire_timestamp && timestamp > last_retire_timestamp)
+            ? timestamp - last_retire_timestamp : 0;
+        last_retire_timestamp = timestamp;
+        have_retire_timestamp = true;
+        
+        if (ir_event != EventRegistry::INVALID) {
+            ++cost_columns[ir_event][pc_info.index];
+            ++accumulated_events[ir_event];
+        }
+        if (cycles != 0 && cycle_event != EventRegistry::INVALID) {
+            uint64_t own_cycles = cycles;
+            if (split_stalls && blocking_pc != 0 && blocking_pc != pc && cycles > 1) {
+                own_cycles = 1;
+                cost_columns[cycle_event][lookupPC(blocking_pc).index] += cycles - 1;
+                stall_cycles_split += cycles - 1;
+            }
+            cost_columns[cycle_event][pc_info.index] += own_cycles;
+            accumulated_events[cycle_event] += cycles;
         }
         
-        // Update state
-        last_pc = pc;
-        last_dest_reg = dest_reg;
-        last_was_branch = is_branch_instruction;
-        last_inst_size = it->second.assembly.empty() ? 4 : detectInstructionSize(it->second.assembly);
+        if constexpr (Policy::track_control_flow) advanceStream(pc_info, dest_reg, is_branch_instruction);
+        finishRecord(timed, t_start);
+    }
+    
+    void recordRetireBatch(const RetireRecord* records, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            const RetireRecord& r = records[i];
+            recordRetire(r.pc, r.timestamp, r.dest_reg, r.is_branch != 0, r.blocking_pc);
+            if (r.is_vector) recordVector(r.pc, r.vl, r.vtype);
+        }
+    }
+    
+    // Count vector work per PC with events VInst, VElemOps (vl elements),
+    // VLaneSlots (VLMAX = LMUL * VLEN / SEW, the elements the vtype could
+    // have held) and VLmulEighths (LMUL in eighths), plus the derived
+    // VUtil = VElemOps / VLaneSlots, AvgVL and AvgLMUL. Short loops show
+    // up as low VUtil, misconfigured ones as an unexpected AvgLMUL.
+    // Registers events, so call before recording starts.
+    void enableVectorProfiling(uint32_t vlen) {
+        vlen_bits = vlen;
+        if (vlen == 0) return;
+        registerEvent("VInst", "Vector instructions");
+        registerEvent("VElemOps", "Vector element operations");
+        registerEvent("VLaneSlots", "Vector lane slots (VLMAX)");
+        registerEvent("VLmulEighths", "Vector LMUL (eighths)");
+        auto has_derived = [this](const std::string& name) {
+            return std::any_of(derived_events.begin(), derived_events.end(),
+                               [&name](const DerivedEvent& d) { return d.name == name; });
+        };
+        if (!has_derived("VUtil")) addDerivedEvent("VUtil", "VElemOps / VLaneSlots", "Vector lane utilization");
+        if (!has_derived("AvgVL")) addDerivedEvent("AvgVL", "VElemOps / VInst", "Mean vector length");
+        if (!has_derived("AvgLMUL")) addDerivedEvent("AvgLMUL", "0.125 * VLmulEighths / VInst", "Mean LMUL");
+    }
+    
+    // Vector work of one retired RVV instruction, alongside recordExecution
+    // or recordRetire. Masked-off elements are not known and count as active.
+    void recordVector(uint64_t pc, uint32_t vl, uint32_t vtype) {
+        if (vlen_bits == 0) return;
+        static constexpr uint32_t LMUL_EIGHTHS[8] = {8, 16, 32, 64, 8, 1, 2, 4};  // vlmul 4 is reserved
+        const uint32_t index = lookupPC(pc).index;
+        const uint32_t sew = 8u << ((vtype >> 3) & 7);
+        const uint32_t lmul_eighths = LMUL_EIGHTHS[vtype & 7];
+        const uint64_t vlmax = uint64_t(vlen_bits) * lmul_eighths / (8 * uint64_t(sew));
+        auto count = [this, index](uint32_t event, uint64_t n) {
+            if (event == EventRegistry::INVALID) return;
+            cost_columns[event][index] += n;
+            accumulated_events[event] += n;
+        };
+        count(vinst_event, 1);
+        count(velem_event, vl);
+        count(vslots_event, vlmax);
+        count(vlmul_event, lmul_eighths);
+    }
+    
+    // Charge stall cycles to the blocking instruction in recordRetire
+    void setStallSplit(bool enabled) {
+        split_stalls = enabled;
     }
     
-    // Write output
-    void writeOutput() {
+    // Write output; false if the file could not be opened or written
+    bool writeOutput() {
+        auto dump_start = std::chrono::steady_clock::now();
+        if (!call_log.empty()) {
+            foldCallLog();
+        }
         std::ofstream out(output_filename);
         if (!out.is_open()) {
             std::cerr << "Failed to open output file: " << output_filename << std::endl;
-            return;
+            return false;
         }
         
         // Header
@@ -492,12 +3303,32 @@ public:
             << "positions:";
         
         if (dump_instr) out << " instr";
-        out << " line\n"
-            << "events:";
+        out << " line\n";
+        
+        const size_t stride = eventStride();
+        for (uint32_t i = 0; i < stride; ++i) {
+            if (!events.longName(i).empty()) {
+                out << "event: " << events.name(i) << " : " << events.longName(i) << "\n";
+            }
+        }
+        EnergyEstimate energy;
+        if (energy_enabled) {
+            energy = evaluateEnergy();
+            out << "event: Energy : Estimated energy (" << energy_model.unit << ")\n";
+        }
+        for (const auto& derived : derived_events) {
+            if (!derived.isCallgrindExpressible()) continue;
+            out << "event: " << derived.name << " = " << derived.callgrindFormula(events.names());
+            if (!derived.long_name.empty()) out << " : " << derived.long_name;
+            out << "\n";
+        }
+        
+        out << "events:";
         
-        for (size_t i = 0; i < num_events && i < event_names.size(); ++i) {
-            out << " " << event_names[i];
+        for (size_t i = 0; i < stride; ++i) {
+            out << " " << events.name(i);
         }
+        if (energy_enabled) out << " Energy";
         out << "\n\n";
         
         // Sort PCs - include ALL PCs
@@ -508,26 +3339,77 @@ public:
         }
         std::sort(sorted_pcs.begin(), sorted_pcs.end());
         
+        const bool emit_loops = loop_profiling && !loops.empty();
+        LoopLayout loop_layout;
+        if (emit_loops) {
+            loop_layout = layoutLoops(sorted_pcs, energy_enabled ? &energy : nullptr);
+        }
+        size_t next_loop = 0;
+        
+        // Spilled edges are merged back per PC (see setMemoryBudget)
+        auto spilled_calls = spilledCalls();
+        auto spilled_jumps = spilledJumps();
+        std::vector<uint64_t> scratch;
+        
         // Write costs
         std::string current_func;
         std::string current_file;
         
-        for (uint64_t pc : sorted_pcs) {
+        for (size_t p = 0; p < sorted_pcs.size(); ++p) {
+            const uint64_t pc = sorted_pcs[p];
             const PCInfo& pc_info = info[pc];
             
-            // Skip if no events
+            // Skip if no events and no calls (imported call-only positions, see addCallEdge)
             bool has_events = false;
-            for (size_t i = 0; i < MAX_EVENTS; ++i) {
-                if (pc_info.event[i] > 0) {
+            for (const auto& column : cost_columns) {
+                if (column[pc_info.index] > 0) {
                     has_events = true;
                     break;
                 }
             }
-            if (!has_events) continue;
+            if (!has_events && calls.find(pc) == calls.end() &&
+                !(spilled_calls && spilled_calls->has(pc))) continue;
+            
+            // Loops headed here are called from their function or enclosing loop
+            while (emit_loops && next_loop < loop_layout.order.size() &&
+                   loops[loop_layout.order[next_loop] - 1].header_pc <= pc) {
+                const uint32_t id = loop_layout.order[next_loop++];
+                const LoopInfo& loop = loops[id - 1];
+                if (loop.header_pc != pc) continue;
+                
+                const uint32_t parent = loop_layout.parent[id];
+                const std::string& parent_name = parent ? loop_layout.names[parent] : pc_info.func;
+                if (parent_name != current_func) {
+                    current_func = parent_name;
+                    out << "fn=" << current_func << "\n";
+                }
+                if (pc_info.file != current_file) {
+                    current_file = pc_info.file;
+                    out << "fl=" << current_file << "\n";
+                }
+                out << "cfn=" << loop_layout.names[id] << "\n"
+                    << "cfl=" << pc_info.file << "\n"
+                    << "calls=" << loop.entries << " ";
+                if (dump_instr) {
+                    out << "0x" << std::hex << pc << std::dec;
+                }
+                out << " " << pc_info.line << "\n";
+                if (dump_instr) {
+                    out << "0x" << std::hex << pc << std::dec;
+                }
+                out << " " << pc_info.line;
+                for (size_t i = 0; i < stride; ++i) {
+                    out << " " << loop_layout.inclusive[id * stride + i];
+                }
+                if (energy_enabled) out << " " << loop_layout.energy[id];
+                out << "\n";
+            }
             
             // Output function/file changes
-            if (pc_info.func != current_func) {
-                current_func = pc_info.func;
+            const std::string& func_name = (emit_loops && loop_layout.innermost[p])
+                ? loop_layout.names[loop_layout.innermost[p]] : pc_info.func;
+            if (func_name != current_func) {
+                current_func = func_name;
                 out << "fn=" << current_func << "\n";
             }
             
@@ -542,9 +3424,10 @@ public:
             }
             out << " " << pc_info.line;
             
-            for (size_t i = 0; i < num_events; ++i) {
-                out << " " << pc_info.event[i];
+            for (size_t i = 0; i < stride; ++i) {
+                out << " " << pcCost(pc_info, i);
             }
+            if (energy_enabled) out << " " << energy.self[pc_info.index];
             
             if (dump_instr && !pc_info.assembly.empty()) {
                 out << " # " << pc_info.assembly;
@@ -554,34 +3437,34 @@ public:
             // Output calls - now includes calls to helpers
             // Only skip calls FROM helpers (not TO helpers)
             if (!isCompilerHelper(pc_info.func_type)) {
-                auto call_it = calls.find(pc);
-                if (call_it != calls.end()) {
-                    for (const auto& [target_pc, call_info] : call_it->second) {
-                        auto callee_it = info.find(target_pc);
-                        if (callee_it != info.end()) {
-                            out << "cfn=" << callee_it->second.func << "\n"
-                                << "cfl=" << callee_it->second.file << "\n";
-                        } else {
-                            out << "cfn=unknown\n";
-                        }
-                        
-                        out << "calls=" << call_info.count << " ";
-                        if (dump_instr) {
-                            out << "0x" << std::hex << target_pc << std::dec;
-                        }
-                        out << " " << (callee_it != info.end() ? callee_it->second.line : 0) << "\n";
-                        
-                        // Inclusive costs
-                        if (dump_instr) {
-                            out << "0x" << std::hex << pc << std::dec;
-                        }
-                        out << " " << pc_info.line;
-                        for (size_t i = 0; i < num_events; ++i) {
-                            out << " " << call_info.inclusive_events[i];
-                        }
-                        out << "\n";
+                forEachCall(pc, spilled_calls.get(), scratch, [&](uint64_t target_pc, uint64_t count, const uint64_t* inclusive) {
+                    auto callee_it = info.find(target_pc);
+                    if (callee_it != info.end()) {
+                        out << "cfn=" << callee_it->second.func << "\n"
+                            << "cfl=" << callee_it->second.file << "\n";
+                    } else {
+                        out << "cfn=unknown\n";
                     }
-                }
+                    
+                    out << "calls=" << count << " ";
+                    if (dump_instr) {
+                        out << "0x" << std::hex << target_pc << std::dec;
+                    }
+                    out << " " << (callee_it != info.end() ? callee_it->second.line : 0) << "\n";
+                    
+                    // Inclusive costs
+                    if (dump_instr) {
+                        out << "0x" << std::hex << pc << std::dec;
+                    }
+                    out << " " << pc_info.line;
+                    for (size_t i = 0; i < stride; ++i) {
+                        out << " " << inclusive[i];
+                    }
+                    if (energy_enabled) {
+                        out << " " << energy.edge(inclusive, callee_it != info.end() ? callee_it->second.fn_id : unknown_fn_id);
+                    }
+                    out << "\n";
+                });
             }
             
             // Output branches
@@ -612,66 +3495,280 @@ public:
                 }
                 
                 // Output unconditional jumps
-                auto jump_it = jumps.find(pc);
-                if (jump_it != jumps.end()) {
-                    for (const auto& [target_pc, count] : jump_it->second) {
-                        auto target_it = info.find(target_pc);
-                        out << "jump=";
-                        if (dump_instr) {
-                            out << "0x" << std::hex << target_pc << std::dec;
-                        }
-                        out << "/" << (target_it != info.end() ? target_it->second.func : "unknown")
-                            << " " << count << "\n";
+                forEachJump(pc, spilled_jumps.get(), scratch, [&](uint64_t target_pc, uint64_t count) {
+                    auto target_it = info.find(target_pc);
+                    out << "jump=";
+                    if (dump_instr) {
+                        out << "0x" << std::hex << target_pc << std::dec;
                     }
-                }
+                    out << "/" << (target_it != info.end() ? target_it->second.func : "unknown")
+                        << " " << count << "\n";
+                });
             }
         }
         
         // Summary
         out << "\n# Summary\n"
             << "totals:";
-        uint64_t totals[MAX_EVENTS] = {0};
-        for (const auto& [_, pc_info] : info) {
-            for (size_t i = 0; i < num_events; ++i) {
-                totals[i] += pc_info.event[i];
-            }
+        for (const auto& column : cost_columns) {
+            uint64_t total = 0;
+            for (uint64_t cost : column) total += cost;
+            out << " " << total;
         }
-        for (size_t i = 0; i < num_events; ++i) {
-            out << " " << totals[i];
+        if (energy_enabled) {
+            uint64_t total = 0;
+            for (uint64_t cost : energy.self) total += cost;
+            out << " " << total;
         }
         out << "\n";
         
+        bytes_written = out ? static_cast<uint64_t>(out.tellp()) : 0;
         out.close();
+        dump_wall_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - dump_start).count();
+        if (stats_log.is_open()) logStats();
+        if (!out) {
+            std::cerr << "Failed to write output file: " << output_filename << std::endl;
+            return false;
+        }
         std::cout << "Callgrind output written to: " << output_filename << std::endl;
+        return true;
     }
 };
 
+using CallgrindGenerator = BasicCallgrindGenerator<DefaultGeneratorPolicy>;
+
+// Read the image from `objdump -d -l` output: "<func>:" headers name the
+// function and clear the source position, "path:line" lines set it and
+// instruction lines ("  addr:\tbytes\tmnemonic\toperands") become entries.
+// Entries without a position (no -l, or no line info for the function)
+// are at line 0 of "unknown".
+inline bool readObjdump(const std::string& path,
+                        std::vector<std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>>& entries) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open objdump file: " << path << std::endl;
+        return false;
+    }
+    std::string func = "unknown";
+    std::string file = "unknown";
+    uint32_t line_no = 0;
+    for (std::string line; std::getline(in, line);) {
+        if (line.empty()) continue;
+        if (line[0] == ' ') {
+            const size_t colon = line.find(":\t");
+            const size_t bytes_end = colon == std::string::npos ? colon : line.find('\t', colon + 2);
+            if (bytes_end == std::string::npos) continue;
+            char* end = nullptr;
+            const uint64_t pc = std::strtoull(line.c_str(), &end, 16);
+            if (end != line.c_str() + colon) continue;
+            std::string assembly = line.substr(bytes_end + 1);
+            const size_t trailing = assembly.find_last_not_of(" \t");
+            assembly.erase(trailing == std::string::npos ? 0 : trailing + 1);
+            if (assembly.empty()) continue;  // Continuation of a long byte dump
+            entries.emplace_back(pc, func, assembly, file, line_no);
+        } else if (line.back() == ':' && line.find(" <") != std::string::npos) {
+            const size_t open = line.find(" <");
+            const size_t close = line.rfind('>');
+            if (close != std::string::npos && close > open) func = line.substr(open + 2, close - open - 2);
+            file = "unknown";
+            line_no = 0;
+        } else if (line.back() != ':') {
+            // "path:line" or "path:line (discriminator n)"
+            const size_t colon = line.rfind(':', line.find(" (discriminator"));
+            if (colon == std::string::npos || colon + 1 >= line.size() ||
+                !std::isdigit(static_cast<unsigned char>(line[colon + 1]))) continue;
+            file = line.substr(0, colon);
+            line_no = static_cast<uint32_t>(std::strtoul(line.c_str() + colon + 1, nullptr, 10));
+        }
+    }
+    return true;
+}
+
 // Simulator interface
-class SimulatorInterface {
+template <typename Policy>
+class BasicSimulatorInterface {
 private:
-    CallgrindGenerator generator;
+    BasicCallgrindGenerator<Policy> generator;
     
 public:
-    SimulatorInterface(const std::string& output_file = "callgrind.out.sim") 
+    BasicSimulatorInterface(const std::string& output_file = "callgrind.out.sim") 
         : generator(output_file) {
-        generator.setOptions(true, true, true);
-        generator.configureEvents({"Ir", "Cycle", "Bc", "Bcm", "Bi", "Bim"});
+        generator.setOptions(true, Policy::Predictor::enabled, Policy::collect_jumps);
+        if (Policy::collect_jumps) {
+            generator.configureEvents({"Ir", "Cycle", "Bc", "Bcm", "Bi", "Bim"});
+        } else {
+            generator.configureEvents({"Ir", "Cycle"});
+        }
+        generator.addDerivedEvent("CPI", "Cycle / Ir", "Cycles per instruction");
+        if (Policy::collect_jumps) {
+            generator.addDerivedEvent("BcmRate", "Bcm / Bc", "Conditional branch mispredict rate");
+            generator.addDerivedEvent("BimRate", "Bim / Bi", "Indirect branch mispredict rate");
+        }
     }
     
     void loadObjdumpData(const std::vector<std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>>& objdump_data) {
+        generator.reserve(objdump_data.size());
         for (const auto& [pc, func, assembly, file, line] : objdump_data) {
             generator.loadPCInfo(pc, func, assembly, file, line);
         }
     }
     
-    void onInstruction(uint64_t pc, EventType event, uint64_t count, 
+    // Load the image from an `objdump -d -l` listing (see readObjdump)
+    bool loadObjdumpFile(const std::string& path) {
+        std::vector<std::tuple<uint64_t, std::string, std::string, std::string, uint32_t>> objdump_data;
+        if (!readObjdump(path, objdump_data)) return false;
+        loadObjdumpData(objdump_data);
+        return true;
+    }
+    
+    // Register a simulator-specific event (e.g. a stall reason) at startup
+    uint32_t registerEvent(const std::string& name, const std::string& long_name = "") {
+        return generator.registerEvent(name, long_name);
+    }
+    
+    uint32_t eventId(const std::string& name) const {
+        return generator.eventId(name);
+    }
+    
+    const EventRegistry& eventRegistry() const {
+        return generator.eventRegistry();
+    }
+    
+    void onInstruction(uint64_t pc, uint32_t event, uint64_t count, 
                       int dest_reg = -1, bool is_branch = false) {
         generator.recordExecution(pc, event, count, dest_reg, is_branch);
     }
     
-    void finalize() {
-        generator.writeOutput();
+    bool onEvent(uint64_t pc, uint32_t event, uint64_t count) {
+        return generator.addEvent(pc, event, count);
+    }
+    
+    // LR/SC/AMO executed by hart; register ScFail and Spin for callgrind columns
+    void onAtomic(uint32_t hart, uint64_t pc, uint64_t address, bool sc_failed = false) {
+        generator.recordAtomicAccess(hart, pc, address, sc_failed);
+    }
+    
+    bool writeContentionReport(const std::string& path) {
+        return generator.writeContentionReport(path);
+    }
+    
+    // Ir and Cycle from retirement timestamps, in place of onInstruction
+    void onRetire(uint64_t pc, uint64_t timestamp, int dest_reg = -1,
+                  bool is_branch = false, uint64_t blocking_pc = 0) {
+        generator.recordRetire(pc, timestamp, dest_reg, is_branch, blocking_pc);
+    }
+    
+    void onRetireBatch(const RetireRecord* records, size_t count) {
+        generator.recordRetireBatch(records, count);
+    }
+    
+    void enableVectorProfiling(uint32_t vlen_bits) {
+        generator.enableVectorProfiling(vlen_bits);
+    }
+    
+    // vl/vtype of an RVV instruction just reported through onInstruction or onRetire
+    void onVector(uint64_t pc, uint32_t vl, uint32_t vtype) {
+        generator.recordVector(pc, vl, vtype);
+    }
+    
+    void setStallSplit(bool enabled) {
+        generator.setStallSplit(enabled);
+    }
+    
+    // Keep edge tables near budget_bytes, spilling cold edges to spill_path
+    // (default: the output file name plus ".spill")
+    bool setMemoryBudget(size_t budget_bytes, const std::string& spill_path = "") {
+        return generator.setMemoryBudget(budget_bytes, spill_path);
+    }
+    
+    bool finalize() {
+        return generator.writeOutput();
+    }
+    
+    bool writeReport(const std::string& path, size_t top_n = 50) {
+        return generator.writeReport(path, top_n);
+    }
+    
+    // Line and branch coverage of the same run
+    bool writeLcov(const std::string& path, const std::string& test_name = "") {
+        return generator.writeLcov(path, test_name);
+    }
+    
+    bool setEnergyModel(const EnergyModel& model) {
+        return generator.setEnergyModel(model);
+    }
+    
+    bool enableLatencyHistograms(const std::string& event_name = "Cycle") {
+        return generator.enableLatencyHistograms(event_name);
+    }
+    
+    bool writeLatencyJson(const std::string& path) {
+        return generator.writeLatencyJson(path);
+    }
+    
+    // Start a new profile over the same image, releasing the previous run's memory
+    void reset() {
+        generator.reset();
+    }
+    
+    GeneratorStats stats() const {
+        return generator.getStats();
+    }
+    
+    uint64_t pcEvent(uint64_t pc, uint32_t event) const {
+        return generator.pcEvent(pc, event);
+    }
+    
+    CallEdgeCost callEdge(uint64_t from_pc, uint64_t to_pc) const {
+        return generator.callEdge(from_pc, to_pc);
+    }
+    
+    bool enableStatsLog(const std::string& path, uint64_t interval_instructions) {
+        return generator.enableStatsLog(path, interval_instructions);
+    }
+    
+    void setSnapshotSink(std::function<void(ProfileSnapshot&)> sink, uint64_t interval_instructions) {
+        generator.setSnapshotSink(std::move(sink), interval_instructions);
+    }
+    
+    void publishSnapshot() {
+        generator.publishSnapshot();
     }
 };
 
+using SimulatorInterface = BasicSimulatorInterface<DefaultGeneratorPolicy>;
+
+// Collection level picked at simulator startup (e.g. from a command line
+// flag); each maps to a policy, so the hot path is compiled per level
+enum class ProfileMode {
+    FULL,        // DefaultGeneratorPolicy
+    CALL_GRAPH,  // CallGraphGeneratorPolicy
+    IR_ONLY      // IrOnlyGeneratorPolicy
+};
+
+// Construct the interface for mode and run fn(interface), a generic lambda
+// instantiated once per policy, so the simulator loop inside fn pays no
+// per-record dispatch
+template <typename Fn>
+void withSimulatorInterface(ProfileMode mode, const std::string& output_file, Fn&& fn) {
+    switch (mode) {
+        case ProfileMode::CALL_GRAPH: {
+            BasicSimulatorInterface<CallGraphGeneratorPolicy> sim(output_file);
+            fn(sim);
+            break;
+        }
+        case ProfileMode::IR_ONLY: {
+            BasicSimulatorInterface<IrOnlyGeneratorPolicy> sim(output_file);
+            fn(sim);
+            break;
+        }
+        default: {
+            SimulatorInterface sim(output_file);
+            fn(sim);
+            break;
+        }
+    }
+}
+
 #endif // CALLGRIND_GENERATOR_FINAL_HPP
\ No newline at end of file
@@ -30,6 +30,8 @@ RTL_LIST="rtl_files.f"              # RTL 파일 리스트
 TB_FILE="tb_top.cpp"                # 테스트벤치 (없으면 빈 문자열)
 OUT_DIR="obj_dir"                   # 출력 디렉토리
 THREADS=$(nproc)                    # 병렬 스레드 수
+PROFILER_DPI=${PROFILER_DPI:-0}      # 1이면 simprof DPI 브리지(simprof_dpi.sv) 포함
+PROFILER_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"  # simprof 소스 경로
 
 #=============================================================================
 # 3. 환경 변수 확인
@@ -102,6 +104,16 @@ VERILATOR_OPTS=(
     -f "$RTL_LIST"
 )
 
+# 프로파일러 DPI 브리지 (리타이어 모니터 → callgrind 프로파일)
+if [ "$PROFILER_DPI" = "1" ]; then
+    VERILATOR_OPTS+=(
+        -CFLAGS "-I$PROFILER_DIR"
+        "$PROFILER_DIR/simprof_dpi.sv"
+        "$PROFILER_DIR/simprof_dpi.cpp"
+        "$PROFILER_DIR/simprof.cpp"
+    )
+fi
+
 # 테스트벤치가 있으면 추가
 if [ -n "$TB_FILE" ] && [ -f "$TB_FILE" ]; then
     VERILATOR_OPTS+=(--exe "$TB_FILE" -o "V$TOP_MODULE")
@@ -0,0 +1,434 @@
+// verilator_profile.hpp - Callgrind profiles of a Verilated model from Verilator's own profiling data
+//
+// Shows which RTL instances and lines dominate model evaluation time. Inputs,
+// any subset:
+//   - gprof flat profile of a model built with --prof-cfuncs
+//     (gprof -b -p obj_dir/Vtop gmon.out): self time and calls per C++
+//     function. --prof-cfuncs names each function
+//     <base>__PROF__<module>__l<line> after the RTL statement it evaluates.
+//   - profile_exec.dat of a --prof-exec run: time per mtask from the
+//     MTASK_BEGIN/MTASK_END records (or the older "VLPROF mtask" lines), in
+//     the ticks Verilator records.
+//   - The generated C++ (obj_dir/*.cpp), to find the functions each mtask
+//     body calls: bodies start at Verilated::mtaskId(<id>) or are defined
+//     as ...__Vmtask__<id>(...) and end at the function's closing brace.
+//   - The RTL sources, for the file and line of each module declaration.
+//
+// Function names carry the instance scope (_sequent__TOP__core__alu__3 runs
+// in TOP.core.alu), so each instance becomes a callgrind function in its
+// module's file with costs on the RTL lines, and calls its child instances
+// with their subtree as inclusive cost. An mtask's ticks are split over the
+// functions its body calls in proportion to their gprof self time (evenly
+// without one); unmapped mtasks show up as "mtask <id>". Functions without
+// a scope (eval loop, runtime) keep their C++ name.
+//
+//   VerilatorProfile profile;
+//   profile.readRtlSources({"rtl/top.v", "rtl/core.v"});
+//   profile.readGprof("cfuncs.txt");
+//   profile.readExecProfile("profile_exec.dat");
+//   profile.readModelSources({"obj_dir/Vtop___024root__DepSet_h0__0.cpp"});
+//   profile.writeCallgrind("callgrind.out.model");
+#ifndef VERILATOR_PROFILE_HPP
+#define VERILATOR_PROFILE_HPP
+
+#include "test2.cpp"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One Verilated C++ function, from its name and the profiles
+struct VerilatorCfunc {
+    std::string scope;      // Instance path, e.g. "TOP.core.alu" (empty = not RTL)
+    std::string module;     // From --prof-cfuncs names (empty if unknown)
+    uint32_t line = 0;
+    uint64_t self_ns = 0;
+    uint64_t calls = 0;
+    uint64_t ticks = 0;     // Share of mtask time
+};
+
+// Unqualified function name without parameters:
+// "Vtop_core::_combo__TOP__core__2(Vtop__Syms*)" -> "_combo__TOP__core__2"
+inline std::string verilatorCfuncKey(std::string_view name) {
+    name = name.substr(0, name.find('('));
+    for (std::string_view separator : {"::", "->", ".", " "}) {
+        const size_t at = name.rfind(separator);
+        if (at != std::string_view::npos) name.remove_prefix(at + separator.size());
+    }
+    return std::string(name);
+}
+
+// Undo Verilator's escapes of hierarchical names ("__DOT__" for '.',
+// "__BRA__"/"__KET__" for generate indices), so that "__" is left only
+// between scope words
+inline std::string decodeVerilatorEscapes(std::string_view name) {
+    static constexpr std::pair<std::string_view, char> escapes[] = {
+        {"__DOT__", '.'}, {"__BRA__", '['}, {"__KET__", ']'}};
+    std::string decoded;
+    decoded.reserve(name.size());
+    for (size_t i = 0; i < name.size();) {
+        bool escaped = false;
+        for (const auto& [escape, c] : escapes) {
+            if (name.substr(i, escape.size()) == escape) {
+                decoded += c;
+                i += escape.size();
+                escaped = true;
+                break;
+            }
+        }
+        if (!escaped) decoded += name[i++];
+    }
+    return decoded;
+}
+
+// Scope, module and line from a function key: the "__"-separated words from
+// TOP on, minus the function number, are the instance path
+inline VerilatorCfunc parseVerilatorCfunc(const std::string& key) {
+    VerilatorCfunc cfunc;
+    std::string_view base(key);
+    const size_t prof = key.find("__PROF__");
+    if (prof != std::string::npos) {
+        base = base.substr(0, prof);
+        const std::string_view tail = std::string_view(key).substr(prof + 8);  // <module>__l<line>
+        const size_t separator = tail.rfind("__");
+        if (separator != std::string_view::npos && separator > 0) {
+            size_t digits = separator + 2;
+            if (digits < tail.size() && tail[digits] == 'l') ++digits;
+            if (digits < tail.size() &&
+                tail.find_first_not_of("0123456789", digits) == std::string_view::npos) {
+                cfunc.module = std::string(tail.substr(0, separator));
+                cfunc.line = static_cast<uint32_t>(std::strtoul(std::string(tail.substr(digits)).c_str(), nullptr, 10));
+            }
+        }
+    }
+    const std::string scope_words = decodeVerilatorEscapes(base);
+    base = scope_words;
+    std::vector<std::string_view> words;
+    for (size_t start = 0;;) {
+        const size_t end = base.find("__", start);
+        words.push_back(base.substr(start, end - start));
+        if (end == std::string_view::npos) break;
+        start = end + 2;
+    }
+    auto top = std::find(words.begin(), words.end(), "TOP");
+    if (top == words.end()) return cfunc;
+    auto last = words.end();
+    if (last - top > 1 && !words.back().empty() &&
+        words.back().find_first_not_of("0123456789") == std::string_view::npos) --last;
+    for (auto it = top; it != last; ++it) {
+        if (!cfunc.scope.empty()) cfunc.scope += '.';
+        cfunc.scope += *it;
+    }
+    return cfunc;
+}
+
+class VerilatorProfile {
+private:
+    struct Mtask {
+        uint64_t ticks = 0;
+        uint64_t runs = 0;
+        std::vector<std::string> cfuncs;   // Keys called by the body
+    };
+
+    enum Cost { NS, CALLS, TICKS, COST_COUNT };
+    using Costs = std::array<uint64_t, COST_COUNT>;
+
+    std::unordered_map<std::string, VerilatorCfunc> cfuncs;
+    std::map<uint32_t, Mtask> mtasks;
+    std::unordered_map<std::string, std::pair<std::string, uint32_t>> modules;  // name -> (file, line)
+    bool have_gprof = false;
+    bool have_exec = false;
+
+    static VerilatorCfunc& cfuncFor(std::unordered_map<std::string, VerilatorCfunc>& table, const std::string& key) {
+        auto [it, inserted] = table.try_emplace(key);
+        if (inserted) it->second = parseVerilatorCfunc(key);
+        return it->second;
+    }
+
+    static bool isIdentifierChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    // Split an mtask's ticks over the functions its body calls, by self time
+    static void distribute(std::unordered_map<std::string, VerilatorCfunc>& table, uint32_t id, const Mtask& mtask) {
+        std::vector<VerilatorCfunc*> targets;
+        for (const std::string& key : mtask.cfuncs) targets.push_back(&cfuncFor(table, key));
+        if (targets.empty()) {
+            cfuncFor(table, "mtask " + std::to_string(id)).ticks += mtask.ticks;
+            return;
+        }
+        uint64_t total_ns = 0;
+        for (const VerilatorCfunc* cfunc : targets) total_ns += cfunc->self_ns;
+        auto weight = [total_ns](const VerilatorCfunc* cfunc) { return total_ns ? cfunc->self_ns : 1; };
+        const long double total = total_ns ? total_ns : targets.size();
+        uint64_t given = 0;
+        VerilatorCfunc* heaviest = targets[0];
+        for (VerilatorCfunc* cfunc : targets) {
+            const uint64_t share = static_cast<uint64_t>(mtask.ticks * static_cast<long double>(weight(cfunc)) / total);
+            cfunc->ticks += share;
+            given += share;
+            if (weight(cfunc) > weight(heaviest)) heaviest = cfunc;
+        }
+        heaviest->ticks += mtask.ticks - given;
+    }
+
+public:
+    // Module declarations ("module name" at the start of a line) in RTL files
+    bool readRtlSources(const std::vector<std::string>& paths) {
+        for (const std::string& path : paths) {
+            std::ifstream in(path);
+            if (!in.is_open()) {
+                std::cerr << "Failed to open RTL source: " << path << std::endl;
+                return false;
+            }
+            uint32_t line_no = 0;
+            for (std::string line; std::getline(in, line);) {
+                ++line_no;
+                std::istringstream words(line);
+                std::string keyword, name;
+                if (!(words >> keyword >> name) || (keyword != "module" && keyword != "macromodule")) continue;
+                const size_t end = std::find_if_not(name.begin(), name.end(), isIdentifierChar) - name.begin();
+                if (end != 0) modules.try_emplace(name.substr(0, end), path, line_no);
+            }
+        }
+        return true;
+    }
+
+    // gprof flat profile: "%time cumulative self [calls self/call total/call] name"
+    bool readGprof(const std::string& path) {
+        std::ifstream in(path);
+        if (!in.is_open()) {
+            std::cerr << "Failed to open gprof profile: " << path << std::endl;
+            return false;
+        }
+        bool in_table = false;
+        size_t rows = 0;
+        for (std::string line; std::getline(in, line);) {
+            if (!in_table) {
+                in_table = line.find("time") != std::string::npos && line.find("name") != std::string::npos;
+                continue;
+            }
+            if (line.find_first_not_of(" \t") == std::string::npos) {
+                if (rows) break;
+                continue;
+            }
+            double values[6];
+            size_t n = 0;
+            size_t pos = 0;
+            while (n < 6) {
+                const size_t start = line.find_first_not_of(" \t", pos);
+                if (start == std::string::npos) break;
+                char* end = nullptr;
+                const double value = std::strtod(line.c_str() + start, &end);
+                if (end == line.c_str() + start || (*end != ' ' && *end != '\t')) break;
+                values[n++] = value;
+                pos = end - line.c_str();
+            }
+            const size_t name_start = line.find_first_not_of(" \t", pos);
+            if (n < 3 || name_start == std::string::npos) continue;
+            VerilatorCfunc& cfunc = cfuncFor(cfuncs, verilatorCfuncKey(std::string_view(line).substr(name_start)));
+            cfunc.self_ns += static_cast<uint64_t>(std::llround(values[2] * 1e9));
+            if (n >= 4) cfunc.calls += static_cast<uint64_t>(values[3]);
+            ++rows;
+        }
+        if (rows == 0) {
+            std::cerr << "No flat profile in: " << path << std::endl;
+            return false;
+        }
+        have_gprof = true;
+        return true;
+    }
+
+    // profile_exec.dat: mtask time per id, begin/end paired per thread
+    bool readExecProfile(const std::string& path) {
+        std::ifstream in(path);
+        if (!in.is_open()) {
+            std::cerr << "Failed to open exec profile: " << path << std::endl;
+            return false;
+        }
+        std::unordered_map<uint32_t, std::pair<uint32_t, uint64_t>> running;  // thread -> (mtask, begin)
+        uint32_t thread = 0;
+        auto add = [this](uint32_t id, uint64_t ticks) {
+            Mtask& mtask = mtasks[id];
+            mtask.ticks += ticks;
+            ++mtask.runs;
+        };
+        for (std::string line; std::getline(in, line);) {
+            std::istringstream fields(line);
+            std::string tag, kind, key;
+            uint64_t time = 0, value = 0;
+            uint32_t id = 0;
+            fields >> tag;
+            if (tag == "VLPROFTHREAD") {
+                fields >> thread;
+            } else if (tag == "VLPROFEXEC" && (fields >> kind >> time >> key >> id) && key == "id") {
+                if (kind == "MTASK_BEGIN") {
+                    running[thread] = {id, time};
+                } else if (kind == "MTASK_END") {
+                    auto it = running.find(thread);
+                    if (it == running.end() || it->second.first != id || time < it->second.second) continue;
+                    add(id, time - it->second.second);
+                    running.erase(it);
+                }
+            } else if (tag == "VLPROF" && (fields >> kind >> id) && kind == "mtask") {
+                // VLPROF mtask <id> start <t> elapsed <ticks> ...
+                while (fields >> key >> value) {
+                    if (key == "elapsed") {
+                        add(id, value);
+                        break;
+                    }
+                }
+            }
+        }
+        have_exec = true;
+        return true;
+    }
+
+    // Functions called by each mtask body in the generated C++
+    bool readModelSources(const std::vector<std::string>& paths) {
+        static constexpr std::string_view MTASK_ID = "Verilated::mtaskId(";
+        static constexpr std::string_view MTASK_FN = "__Vmtask__";
+        for (const std::string& path : paths) {
+            std::ifstream in(path);
+            if (!in.is_open()) {
+                std::cerr << "Failed to open model source: " << path << std::endl;
+                return false;
+            }
+            Mtask* body = nullptr;
+            for (std::string line; std::getline(in, line);) {
+                size_t at = line.find(MTASK_ID);
+                if (at != std::string::npos) {
+                    body = &mtasks[static_cast<uint32_t>(std::strtoul(line.c_str() + at + MTASK_ID.size(), nullptr, 10))];
+                    continue;
+                }
+                at = line.find(MTASK_FN);
+                if (at != std::string::npos && line.find('(', at) != std::string::npos && line.back() != ';' &&
+                    std::isdigit(static_cast<unsigned char>(line[at + MTASK_FN.size()]))) {
+                    body = &mtasks[static_cast<uint32_t>(std::strtoul(line.c_str() + at + MTASK_FN.size(), nullptr, 10))];
+                    continue;
+                }
+                if (!body) continue;
+                if (!line.empty() && line[0] == '}') {
+                    body = nullptr;
+                    continue;
+                }
+                // Calls: identifiers followed by '(' that name a scoped function
+                for (size_t open = line.find('('); open != std::string::npos; open = line.find('(', open + 1)) {
+                    size_t start = open;
+                    while (start > 0 && isIdentifierChar(line[start - 1])) --start;
+                    if (start == open) continue;
+                    const std::string key = line.substr(start, open - start);
+                    if (parseVerilatorCfunc(key).scope.empty()) continue;
+                    if (std::find(body->cfuncs.begin(), body->cfuncs.end(), key) == body->cfuncs.end()) {
+                        body->cfuncs.push_back(key);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    const std::unordered_map<std::string, VerilatorCfunc>& functions() const {
+        return cfuncs;
+    }
+
+    // Fill a fresh generator: one position per (function, RTL line), events
+    // Ns/CfuncCalls (gprof) and Ticks (exec profile), and instance calls.
+    // Replaces the generator's events, so use one that has recorded nothing.
+    template <typename Policy>
+    void exportTo(BasicCallgrindGenerator<Policy>& generator) const {
+        std::unordered_map<std::string, VerilatorCfunc> table = cfuncs;
+        for (const auto& [id, mtask] : mtasks) distribute(table, id, mtask);
+
+        std::array<uint32_t, COST_COUNT> event;
+        event.fill(EventRegistry::INVALID);
+        generator.configureEvents({});
+        generator.setOptions(false, false, false);
+        if (have_gprof) {
+            event[NS] = generator.registerEvent("Ns", "Self time (ns)");
+            event[CALLS] = generator.registerEvent("CfuncCalls", "Verilated function calls");
+        }
+        if (have_exec) event[TICKS] = generator.registerEvent("Ticks", "Mtask time (ticks)");
+
+        // Module, file and declaration line of each instance
+        std::map<std::string, std::string> scope_modules;
+        for (const auto& [_, cfunc] : table) {
+            if (!cfunc.scope.empty() && !cfunc.module.empty()) scope_modules.emplace(cfunc.scope, cfunc.module);
+        }
+        auto source = [&](const std::string& scope) -> std::pair<std::string, uint32_t> {
+            auto module_it = scope_modules.find(scope);
+            if (module_it == scope_modules.end()) return {"unknown", 0};
+            auto source_it = modules.find(module_it->second);
+            if (source_it == modules.end()) return {"unknown", 0};
+            return source_it->second;
+        };
+
+        // Self cost per (function, line); instances with their ancestors
+        std::map<std::pair<std::string, uint32_t>, Costs> positions;
+        std::map<std::string, Costs> subtree;
+        for (const auto& [key, cfunc] : table) {
+            const Costs self = {cfunc.self_ns, cfunc.calls, cfunc.ticks};
+            Costs& costs = positions[{cfunc.scope.empty() ? key : cfunc.scope, cfunc.line}];
+            for (size_t i = 0; i < COST_COUNT; ++i) costs[i] += self[i];
+            if (cfunc.scope.empty()) continue;
+            Costs& total = subtree[cfunc.scope];
+            for (size_t i = 0; i < COST_COUNT; ++i) total[i] += self[i];
+        }
+        std::vector<std::string> scopes;
+        for (const auto& [scope, _] : subtree) scopes.push_back(scope);
+        for (size_t i = 0; i < scopes.size(); ++i) {
+            const size_t dot = scopes[i].rfind('.');
+            if (dot != std::string::npos && subtree.try_emplace(scopes[i].substr(0, dot)).second) {
+                scopes.push_back(scopes[i].substr(0, dot));
+            }
+        }
+        for (const std::string& scope : scopes) positions.try_emplace({scope, source(scope).second});
+
+        // Positions get PCs in (function, line) order so functions stay contiguous
+        std::map<std::pair<std::string, uint32_t>, uint64_t> pcs;
+        uint64_t next_pc = 1;
+        for (const auto& [position, costs] : positions) {
+            const uint64_t pc = next_pc++;
+            pcs.emplace(position, pc);
+            const auto scope_it = subtree.find(position.first);
+            generator.loadPCInfo(pc, position.first, "", scope_it != subtree.end() ? source(position.first).first : "unknown",
+                                 position.second);
+            for (size_t i = 0; i < COST_COUNT; ++i) {
+                if (event[i] != EventRegistry::INVALID && costs[i]) generator.addEvent(pc, event[i], costs[i]);
+            }
+        }
+
+        // Each instance is called once from its parent with its subtree cost
+        std::sort(scopes.begin(), scopes.end(), [](const std::string& a, const std::string& b) {
+            return std::count(a.begin(), a.end(), '.') > std::count(b.begin(), b.end(), '.');
+        });
+        std::vector<uint64_t> inclusive(generator.eventRegistry().size(), 0);
+        for (const std::string& scope : scopes) {
+            const size_t dot = scope.rfind('.');
+            if (dot == std::string::npos) continue;
+            const std::string parent = scope.substr(0, dot);
+            const Costs& costs = subtree[scope];
+            Costs& parent_costs = subtree[parent];
+            std::fill(inclusive.begin(), inclusive.end(), 0);
+            for (size_t i = 0; i < COST_COUNT; ++i) {
+                parent_costs[i] += costs[i];
+                if (event[i] != EventRegistry::INVALID) inclusive[event[i]] = costs[i];
+            }
+            generator.addCallEdge(pcs.at({parent, source(parent).second}), pcs.at({scope, source(scope).second}),
+                                  1, inclusive.data());
+        }
+    }
+
+    void writeCallgrind(const std::string& path) const {
+        CallgrindGenerator generator(path);
+        exportTo(generator);
+        generator.writeOutput();
+    }
+};
+
+#endif // VERILATOR_PROFILE_HPP